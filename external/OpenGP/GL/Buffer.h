@@ -90,6 +90,13 @@ public:
         glBufferData(TARGET, this->num_elems * sizeof(T), raw_data_ptr, usage);
     }
 
+    /// Overwrites num_elems elements starting at element first; the buffer
+    /// must already hold them
+    void upload_sub(const GLvoid* raw_data_ptr, GLintptr first, GLsizeiptr num_elems){
+        glBindBuffer(TARGET, this->buffer);
+        glBufferSubData(TARGET, first * sizeof(T), num_elems * sizeof(T), raw_data_ptr);
+    }
+
     GLsizeiptr elem_size() const { return sizeof(T); }
     GLenum get_data_type() const { return GLType<Scalar>(); }
     GLuint get_components() const { return ScalarComponents<T>(); }
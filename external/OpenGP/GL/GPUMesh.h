@@ -117,6 +117,20 @@ public:
 
     }
 
+    /// Overwrites part of an existing vbo, e.g. the vertices an edit touched
+    template <typename T>
+    void update_vbo(const std::string &name, const T *data, GLintptr first, GLsizeiptr num_elems) {
+
+        auto it = vbos.find(name);
+        if (it == vbos.end()) return;
+        auto *buffer = dynamic_cast<ArrayBuffer<T>*>(it->second.first.get());
+        if (buffer == nullptr || first + num_elems > buffer->size()) return;
+
+        buffer->upload_sub(data, first, num_elems);
+        buffer->unbind();
+
+    }
+
     void set_vpoint(const std::vector<Vec3> &vpoint) {
         set_vbo<Vec3>("vposition", vpoint);
     }
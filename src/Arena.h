@@ -0,0 +1,148 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Counters of an Arena since it was made
+struct ArenaStats {
+	long long allocations = 0;
+	long long bytesAllocated = 0;
+	// Most bytes in use at once, and bytes reserved from the heap
+	long long peakBytes = 0;
+	long long capacity = 0;
+	int blocks = 0;
+};
+
+// Monotonic allocator for the scratch memory of a generation: allocations
+// bump a pointer through large blocks and are never freed one by one.
+// Everything after a mark() is released at once by rewind(mark), usually
+// through an ArenaScope, and the blocks are kept for the next allocations,
+// so a generation reusing its arena stops going to the heap. Not thread
+// safe: one arena per generating task
+class Arena {
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	size_t blockSize;
+	std::vector<Block> blocks;
+	// Block being allocated from and bytes used in it
+	int current = 0;
+	size_t used = 0;
+	long long inUse = 0;
+	ArenaStats stats;
+
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+public:
+	struct Mark {
+		int block;
+		size_t used;
+		long long inUse;
+	};
+
+	Arena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	template <typename T>
+	T* allocate(size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+
+	Mark mark() const {
+		Mark m = { current, used, inUse };
+		return m;
+	}
+	// Releases everything allocated after m. Whatever lives there must not
+	// be used afterwards
+	void rewind(const Mark& m) {
+		current = m.block;
+		used = m.used;
+		inUse = m.inUse;
+	}
+	void reset() {
+		Mark start = { 0, 0, 0 };
+		rewind(start);
+	}
+
+	const ArenaStats& getStats() const { return stats; }
+};
+
+// Sizes past the end of the current block move on to the next block big
+// enough, or insert one, so a large allocation does not waste the blocks
+// after it
+void* Arena::allocate(size_t bytes, size_t alignment) {
+	while (true) {
+		if (current < blocks.size()) {
+			Block& block = blocks[current];
+			size_t address = reinterpret_cast<size_t>(block.data.get()) + used;
+			size_t padding = (alignment - address % alignment) % alignment;
+			if (used + padding + bytes <= block.size) {
+				unsigned char* p = block.data.get() + used + padding;
+				used += padding + bytes;
+				inUse += (long long)(padding + bytes);
+				stats.allocations++;
+				stats.bytesAllocated += (long long)bytes;
+				stats.peakBytes = std::max(stats.peakBytes, inUse);
+				return p;
+			}
+			// The rest of the block is lost until the next rewind
+			inUse += (long long)(block.size - used);
+			if (current + 1 < blocks.size() && blocks[current + 1].size >= bytes + alignment) {
+				current++;
+				used = 0;
+				continue;
+			}
+		}
+
+		Block block;
+		block.size = std::max(blockSize, bytes + alignment);
+		block.data = std::unique_ptr<unsigned char[]>(new unsigned char[block.size]);
+		stats.capacity += (long long)block.size;
+		stats.blocks++;
+		current = blocks.empty() ? 0 : current + 1;
+		blocks.insert(blocks.begin() + current, std::move(block));
+		used = 0;
+	}
+}
+
+// Rewinds an arena to where it was when the scope began. Containers using
+// the arena must be declared after the scope, so they die before it
+class ArenaScope {
+private:
+	Arena& arena;
+	Arena::Mark start;
+public:
+	ArenaScope(Arena& arena) : arena(arena), start(arena.mark()) {}
+	~ArenaScope() { arena.rewind(start); }
+};
+
+// Standard allocator over an Arena; deallocate() does nothing, the memory
+// goes back when the arena is rewound
+template <typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	Arena* arena;
+
+	ArenaAllocator(Arena& arena) : arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return arena->allocate<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef CAMERAPATH_H_
+#define CAMERAPATH_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// A camera pose at a point in time. yaw and pitch are the angles the mouse
+// controls in main.cpp
+struct CameraKeyframe {
+	float time = 0;
+	Vec3 position = Vec3(0, 0, 0);
+	float yaw = 0;
+	float pitch = 0;
+	float fov = 80;
+};
+
+// The direction a camera with the given yaw and pitch looks at
+Vec3 cameraDirection(float yaw, float pitch) {
+	return Vec3(sin(yaw) * cos(pitch), cos(yaw) * cos(pitch), sin(pitch)).normalized();
+}
+
+// A camera path through keyframes sorted by time. Positions follow a
+// Catmull-Rom spline, angles and fov are interpolated linearly.
+//
+// The text format has one keyframe per line, '#' starts a comment:
+//   time x y z yaw pitch fov
+class CameraPath {
+private:
+	std::vector<CameraKeyframe> keyframes;
+
+	static float lerpAngle(float a, float b, float t);
+public:
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+
+	// Keyframes must be added in time order
+	void add(const CameraKeyframe& keyframe) { keyframes.push_back(keyframe); }
+	void clear() { keyframes.clear(); }
+
+	bool empty() const { return keyframes.empty(); }
+	int size() const { return (int)keyframes.size(); }
+	float getDuration() const { return keyframes.empty() ? 0.0f : keyframes.back().time; }
+
+	// Clamped to the first and last keyframe
+	CameraKeyframe sample(float time) const;
+
+	// Two orbits around a planet of the given radius centered at the origin,
+	// the second one diving towards the surface
+	static CameraPath orbit(float radius, float duration);
+};
+
+bool CameraPath::load(const std::string& path) {
+	std::ifstream file(path.c_str());
+	if (!file) return false;
+
+	keyframes.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream values(line);
+
+		CameraKeyframe keyframe;
+		if (values >> keyframe.time >> keyframe.position[0] >> keyframe.position[1] >> keyframe.position[2]
+			>> keyframe.yaw >> keyframe.pitch >> keyframe.fov) {
+			if (!keyframes.empty() && keyframe.time < keyframes.back().time) return false;
+			keyframes.push_back(keyframe);
+		}
+	}
+	return !keyframes.empty();
+}
+
+bool CameraPath::save(const std::string& path) const {
+	std::ofstream file(path.c_str());
+	file << "# time x y z yaw pitch fov\n";
+	file.precision(9);
+	for (int i = 0; i < keyframes.size(); ++i) {
+		const CameraKeyframe& k = keyframes[i];
+		file << k.time << " " << k.position[0] << " " << k.position[1] << " " << k.position[2]
+			<< " " << k.yaw << " " << k.pitch << " " << k.fov << "\n";
+	}
+	return (bool)file;
+}
+
+// Interpolates along the shorter way around the circle
+float CameraPath::lerpAngle(float a, float b, float t) {
+	float delta = fmod(b - a, 2.0f * (float)M_PI);
+	if (delta > M_PI) delta -= 2.0f * (float)M_PI;
+	if (delta < -M_PI) delta += 2.0f * (float)M_PI;
+	return a + delta * t;
+}
+
+CameraKeyframe CameraPath::sample(float time) const {
+	if (keyframes.empty()) return CameraKeyframe();
+	if (time <= keyframes.front().time) return keyframes.front();
+	if (time >= keyframes.back().time) return keyframes.back();
+
+	int i = 0;
+	while (keyframes[i + 1].time <= time) ++i;
+
+	const CameraKeyframe& k1 = keyframes[i];
+	const CameraKeyframe& k2 = keyframes[i + 1];
+	const CameraKeyframe& k0 = keyframes[i > 0 ? i - 1 : i];
+	const CameraKeyframe& k3 = keyframes[i + 2 < keyframes.size() ? i + 2 : i + 1];
+
+	float span = k2.time - k1.time;
+	float t = span > 0 ? (time - k1.time) / span : 0.0f;
+	float t2 = t * t;
+	float t3 = t2 * t;
+
+	CameraKeyframe result;
+	result.time = time;
+	result.position = 0.5f * ((2.0f * k1.position) + (k2.position - k0.position) * t
+		+ (2.0f * k0.position - 5.0f * k1.position + 4.0f * k2.position - k3.position) * t2
+		+ (3.0f * k1.position - k0.position - 3.0f * k2.position + k3.position) * t3);
+	result.yaw = lerpAngle(k1.yaw, k2.yaw, t);
+	result.pitch = k1.pitch + (k2.pitch - k1.pitch) * t;
+	result.fov = k1.fov + (k2.fov - k1.fov) * t;
+	return result;
+}
+
+CameraPath CameraPath::orbit(float radius, float duration) {
+	CameraPath path;
+	const int steps = 32;
+
+	for (int i = 0; i <= steps; ++i) {
+		float s = (float)i / steps;
+		float angle = 4.0f * (float)M_PI * s;
+		// Second orbit closes in from 2.2 to 1.3 radii
+		float distance = radius * (s < 0.5f ? 2.2f : 2.2f - 1.8f * (s - 0.5f));
+		float height = radius * 0.4f * sin(2.0f * (float)M_PI * s);
+
+		CameraKeyframe keyframe;
+		keyframe.time = duration * s;
+		keyframe.position = Vec3(distance * cos(angle), distance * sin(angle), height);
+
+		// Looks at the planet center
+		Vec3 front = -keyframe.position.normalized();
+		keyframe.pitch = asin(front[2]);
+		keyframe.yaw = atan2(front[0], front[1]);
+		keyframe.fov = s < 0.5f ? 80.0f : 80.0f - 30.0f * (s - 0.5f);
+		path.add(keyframe);
+	}
+	return path;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef EROSION_H_
+#define EROSION_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "VertexGraph.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+struct ErosionParams {
+	// Hydraulic erosion: droplets per vertex, spawned on random vertices
+	float droplets = 1.0f;
+	int maxSteps = 32;
+	// Droplets simulated against the same heights; their changes are applied
+	// in order once the whole batch is done. Results depend on it, not on
+	// the number of threads
+	int batchSize = 1024;
+	float capacity = 4.0f;
+	float erodeRate = 0.3f;
+	float depositRate = 0.3f;
+	float evaporation = 0.02f;
+	float gravity = 4.0f;
+	float minSlope = 0.01f;
+	// Droplets reaching this height drop their sediment and stop
+	float seaLevel = -std::numeric_limits<float>::infinity();
+	unsigned int seed = 0;
+
+	// Thermal erosion: material slides down slopes steeper than talus
+	int thermalIterations = 20;
+	float talus = 0.6f;
+	float thermalRate = 0.25f;
+};
+
+// Particle-based hydraulic erosion and thermal talus relaxation of heights
+// on the vertices of a mesh. Droplets walk from vertex to vertex down the
+// steepest edge, eroding or depositing at each vertex they leave.
+//
+// Both run on a thread pool and give the same heights whatever its size:
+// droplets of a batch only read the heights and record their changes in
+// their own slots, and thermal iterations compute every vertex from the
+// previous iteration's heights
+class Erosion {
+private:
+	const VertexGraph& graph;
+	ErosionParams params;
+	// Length of every edge, in the order of graph.neighbors
+	std::vector<float> edgeLengths;
+
+	int simulateDroplet(long long droplet, const std::vector<float>& heights, int* vertices, float* amounts) const;
+public:
+	// vertices are the undisplaced positions the slopes are measured on
+	Erosion(const VertexGraph& graph, const std::vector<Vec3>& vertices, const ErosionParams& params);
+
+	void hydraulic(std::vector<float>& heights, ThreadPool& pool);
+	void thermal(std::vector<float>& heights, ThreadPool& pool);
+
+	void erode(std::vector<float>& heights, ThreadPool& pool) {
+		hydraulic(heights, pool);
+		thermal(heights, pool);
+	}
+};
+
+// Spawn points come from a hash of the seed and droplet index, so droplets
+// can be simulated in any order
+inline uint32_t erosionHash(uint32_t seed, uint64_t index) {
+	uint64_t x = index * 0x9E3779B97F4A7C15ULL + seed;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return (uint32_t)(x ^ (x >> 31));
+}
+
+Erosion::Erosion(const VertexGraph& graph, const std::vector<Vec3>& vertices, const ErosionParams& params) : graph(graph), params(params) {
+	edgeLengths.resize(graph.neighbors.size());
+	for (int v = 0; v < graph.numVertices(); ++v) {
+		for (int k = graph.neighborOffsets[v]; k < graph.neighborOffsets[v + 1]; ++k) {
+			edgeLengths[k] = (vertices[v] - vertices[graph.neighbors[k]]).norm();
+		}
+	}
+}
+
+// Walks one droplet and writes the height changes it makes to vertices and
+// amounts, at most maxSteps + 1 of them; returns how many
+int Erosion::simulateDroplet(long long droplet, const std::vector<float>& heights, int* vertices, float* amounts) const {
+	int v = erosionHash(params.seed, droplet) % graph.numVertices();
+	float water = 1.0f;
+	float speed = 1.0f;
+	float sediment = 0.0f;
+	int changes = 0;
+
+	for (int step = 0; step < params.maxSteps; ++step) {
+		float height = heights[v];
+		if (height < params.seaLevel) break;
+
+		int lowest = -1;
+		float lowestHeight = height;
+		for (int k = graph.neighborOffsets[v]; k < graph.neighborOffsets[v + 1]; ++k) {
+			if (heights[graph.neighbors[k]] < lowestHeight) {
+				lowestHeight = heights[graph.neighbors[k]];
+				lowest = k;
+			}
+		}
+		// A pit: the sediment fills it
+		if (lowest < 0) break;
+
+		float drop = height - lowestHeight;
+		float slope = drop / edgeLengths[lowest];
+		float capacity = std::max(slope, params.minSlope) * speed * water * params.capacity;
+
+		float amount;
+		if (sediment > capacity) {
+			amount = std::min((sediment - capacity) * params.depositRate, drop);
+			sediment -= amount;
+		}
+		else {
+			// Never digs below the vertex it flows to
+			amount = -std::min((capacity - sediment) * params.erodeRate, drop);
+			sediment -= amount;
+		}
+		vertices[changes] = v;
+		amounts[changes] = amount;
+		changes++;
+
+		speed = sqrt(speed * speed + drop * params.gravity);
+		water *= 1.0f - params.evaporation;
+		v = graph.neighbors[lowest];
+	}
+
+	if (sediment > 0) {
+		vertices[changes] = v;
+		amounts[changes] = sediment;
+		changes++;
+	}
+	return changes;
+}
+
+void Erosion::hydraulic(std::vector<float>& heights, ThreadPool& pool) {
+	TRACE_SCOPE("hydraulic erosion");
+	if (graph.numVertices() == 0 || params.maxSteps <= 0 || params.batchSize <= 0) return;
+
+	long long droplets = (long long)(params.droplets * graph.numVertices());
+	int slots = params.maxSteps + 1;
+
+	std::vector<int> vertices((size_t)params.batchSize * slots);
+	std::vector<float> amounts((size_t)params.batchSize * slots);
+	std::vector<int> counts(params.batchSize);
+
+	for (long long first = 0; first < droplets; first += params.batchSize) {
+		int batch = (int)std::min<long long>(params.batchSize, droplets - first);
+		pool.parallelFor(0, batch, 16, [&](int d) {
+			counts[d] = simulateDroplet(first + d, heights, &vertices[(size_t)d * slots], &amounts[(size_t)d * slots]);
+		});
+
+		for (int d = 0; d < batch; ++d) {
+			for (int c = 0; c < counts[d]; ++c) {
+				heights[vertices[(size_t)d * slots + c]] += amounts[(size_t)d * slots + c];
+			}
+		}
+	}
+}
+
+void Erosion::thermal(std::vector<float>& heights, ThreadPool& pool) {
+	TRACE_SCOPE("thermal erosion");
+	int numVertices = graph.numVertices();
+	std::vector<float> next(numVertices);
+
+	for (int iteration = 0; iteration < params.thermalIterations; ++iteration) {
+		// What u sends to v only depends on u, v and their heights, so both
+		// ends compute the same amount and no material is lost
+		pool.parallelFor(0, numVertices, 1024, [&](int v) {
+			float height = heights[v];
+			float change = 0.0f;
+			for (int k = graph.neighborOffsets[v]; k < graph.neighborOffsets[v + 1]; ++k) {
+				int n = graph.neighbors[k];
+				float limit = params.talus * edgeLengths[k];
+				float difference = height - heights[n];
+				if (difference > limit) {
+					change -= params.thermalRate * (difference - limit) / graph.degree(v);
+				}
+				else if (-difference > limit) {
+					change += params.thermalRate * (-difference - limit) / graph.degree(n);
+				}
+			}
+			next[v] = height + change;
+		});
+		heights.swap(next);
+	}
+}
+
+#endif
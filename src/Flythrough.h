@@ -0,0 +1,125 @@
+#ifndef FLYTHROUGH_H_
+#define FLYTHROUGH_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include "CameraPath.h"
+#include "FrameProfiler.h"
+
+// What one frame of a flythrough cost
+struct FlythroughFrame {
+	int frame = 0;
+	float time = 0;
+	Vec3 position = Vec3(0, 0, 0);
+	// Time to issue the frame, and to issue it and wait for GL to finish it
+	float cpuMs = 0;
+	float frameMs = 0;
+	long long drawCalls = 0;
+	long long triangles = 0;
+	long long bytesUploaded = 0;
+};
+
+// Replays a camera path at a fixed timestep and collects per-frame stats.
+// Frame n always shows the camera at n * timestep, so two runs can be
+// compared frame by frame whatever their frame rate
+class Flythrough {
+private:
+	CameraPath path;
+	float timestep;
+	int frame = 0;
+	std::vector<FlythroughFrame> frames;
+public:
+	Flythrough(const CameraPath& path, float timestep) : path(path), timestep(timestep) {}
+
+	int getFrameCount() const { return (int)floor(path.getDuration() / timestep + 1e-3f) + 1; }
+	bool finished() const { return frame >= getFrameCount(); }
+
+	int getFrame() const { return frame; }
+	float getTime() const { return frame * timestep; }
+	CameraKeyframe getCamera() const { return path.sample(getTime()); }
+
+	// Stores the stats of the current frame and moves to the next one
+	void record(FlythroughFrame stats);
+
+	const std::vector<FlythroughFrame>& getFrames() const { return frames; }
+
+	void printSummary(std::ostream& out) const;
+	bool writeCSV(const std::string& path) const;
+	bool writeJSON(const std::string& path) const;
+};
+
+void Flythrough::record(FlythroughFrame stats) {
+	stats.frame = frame;
+	stats.time = getTime();
+	stats.position = getCamera().position;
+	frames.push_back(stats);
+	frame++;
+}
+
+void Flythrough::printSummary(std::ostream& out) const {
+	std::vector<float> cpu, total;
+	long long drawCalls = 0, triangles = 0, bytes = 0;
+	for (int i = 0; i < frames.size(); ++i) {
+		cpu.push_back(frames[i].cpuMs);
+		total.push_back(frames[i].frameMs);
+		drawCalls += frames[i].drawCalls;
+		triangles += frames[i].triangles;
+		bytes += frames[i].bytesUploaded;
+	}
+	FrameProfiler::Percentiles c = FrameProfiler::percentiles(cpu);
+	FrameProfiler::Percentiles f = FrameProfiler::percentiles(total);
+	float count = frames.empty() ? 1.0f : (float)frames.size();
+
+	out << std::fixed << std::setprecision(3)
+		<< "flythrough: " << frames.size() << " frames" << std::endl
+		<< "  cpu ms    p50 " << c.p50 << "  p95 " << c.p95 << "  p99 " << c.p99 << "  max " << c.max << std::endl
+		<< "  frame ms  p50 " << f.p50 << "  p95 " << f.p95 << "  p99 " << f.p99 << "  max " << f.max << std::endl
+		<< std::setprecision(1)
+		<< "  per frame: " << drawCalls / count << " draw calls, " << triangles / count << " triangles, "
+		<< bytes / count / 1024.0 << " KiB uploaded" << std::endl;
+}
+
+bool Flythrough::writeCSV(const std::string& path) const {
+	std::ofstream file(path.c_str());
+	file << "frame,time,x,y,z,cpu_ms,frame_ms,draw_calls,triangles,bytes_uploaded\n";
+	for (int i = 0; i < frames.size(); ++i) {
+		const FlythroughFrame& f = frames[i];
+		file << f.frame << "," << f.time << "," << f.position[0] << "," << f.position[1] << "," << f.position[2]
+			<< "," << f.cpuMs << "," << f.frameMs << "," << f.drawCalls << "," << f.triangles << "," << f.bytesUploaded << "\n";
+	}
+	return (bool)file;
+}
+
+bool Flythrough::writeJSON(const std::string& path) const {
+	std::vector<float> cpu, total, drawCalls, triangles, bytes;
+	for (int i = 0; i < frames.size(); ++i) {
+		cpu.push_back(frames[i].cpuMs);
+		total.push_back(frames[i].frameMs);
+		drawCalls.push_back((float)frames[i].drawCalls);
+		triangles.push_back((float)frames[i].triangles);
+		bytes.push_back((float)frames[i].bytesUploaded);
+	}
+
+	std::ofstream file(path.c_str());
+	auto writeStat = [&file](const char* name, const std::vector<float>& values, bool last) {
+		FrameProfiler::Percentiles p = FrameProfiler::percentiles(values);
+		file << "    \"" << name << "\": { \"mean\": " << p.mean << ", \"p50\": " << p.p50 << ", \"p95\": " << p.p95
+			<< ", \"p99\": " << p.p99 << ", \"max\": " << p.max << " }" << (last ? "" : ",") << "\n";
+	};
+
+	file << "{\n  \"frames\": " << frames.size() << ",\n  \"timestep\": " << timestep << ",\n  \"summary\": {\n";
+	writeStat("cpu_ms", cpu, false);
+	writeStat("frame_ms", total, false);
+	writeStat("draw_calls", drawCalls, false);
+	writeStat("triangles", triangles, false);
+	writeStat("bytes_uploaded", bytes, true);
+	file << "  }\n}\n";
+	return (bool)file;
+}
+
+#endif
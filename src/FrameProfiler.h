@@ -0,0 +1,394 @@
+#ifndef FRAMEPROFILER_H_
+#define FRAMEPROFILER_H_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#ifndef TERRAIN_HEADLESS
+#include <OpenGP/GL/gl.h>
+#endif
+
+// Per-frame timings of named scopes, kept in a fixed-size ring buffer of the
+// most recent frames. CPU time is measured with steady_clock; when
+// ARB_timer_query is available each scope is also bracketed with GL timestamp
+// queries, which are read back a few frames later so the CPU never waits.
+//
+// Not thread safe: frames and scopes belong to the render thread.
+class FrameProfiler {
+public:
+	static const int MAX_SCOPES = 16;
+	// Frames between issuing GL queries and reading them back
+	static const int GPU_LATENCY = 4;
+	// Timed scope entries per frame, counting the frame itself
+	static const int MAX_QUERIES = 64;
+
+	struct FrameSample {
+		uint64_t frame = 0;
+		float cpu = 0;
+		float gpu = -1;
+		float scopeCpu[MAX_SCOPES];
+		// -1 when the GPU time is not known (yet)
+		float scopeGpu[MAX_SCOPES];
+	};
+
+	struct Percentiles {
+		int count = 0;
+		float mean = 0;
+		float p50 = 0;
+		float p95 = 0;
+		float p99 = 0;
+		float max = 0;
+	};
+
+	FrameProfiler(int capacity = 1024);
+
+	// Turns on GL timer queries if the context supports them. Needs a current
+	// context, which owns the queries until it is destroyed; without this
+	// call only CPU times are recorded
+	void enableGpuTiming();
+	bool hasGpuTiming() const { return gpuTiming; }
+
+	void beginFrame();
+	void endFrame();
+
+	// Scopes may nest; a scope entered several times in a frame accumulates
+	int beginScope(const char* name);
+	void endScope(int scope);
+
+	int getScopeCount() const { return (int)scopeNames.size(); }
+	const std::string& getScopeName(int scope) const { return scopeNames[scope]; }
+	int getFrameCount() const { return count; }
+
+	// Samples from oldest to newest
+	std::vector<FrameSample> getSamples() const;
+
+	// Times in ms; scope -1 is the whole frame
+	Percentiles cpuPercentiles(int scope = -1) const;
+	Percentiles gpuPercentiles(int scope = -1) const;
+
+	// Nearest rank percentiles of any set of values
+	static Percentiles percentiles(std::vector<float> values);
+
+	void printSummary(std::ostream& out) const;
+	bool writeCSV(const std::string& path) const;
+	bool writeJSON(const std::string& path) const;
+
+private:
+	std::vector<FrameSample> frames;
+	int head = 0;
+	int count = 0;
+	uint64_t frameNumber = 0;
+	bool inFrame = false;
+
+	std::vector<std::string> scopeNames;
+
+	struct OpenScope {
+		int scope;
+		std::chrono::steady_clock::time_point start;
+		int query;
+	};
+	std::vector<OpenScope> openScopes;
+	std::chrono::steady_clock::time_point frameStart;
+
+	FrameSample& current() { return frames[head]; }
+	double since(std::chrono::steady_clock::time_point start) const;
+	bool gpuTiming = false;
+
+#ifndef TERRAIN_HEADLESS
+	// Timestamp queries of one frame: pairs of (begin, end) per scope use,
+	// the frame itself uses the first pair
+	struct GpuFrame {
+		uint64_t frame = 0;
+		bool pending = false;
+		GLuint queries[2 * MAX_QUERIES];
+		int scopeOf[MAX_QUERIES];
+		int used = 0;
+	};
+	GpuFrame gpuFrames[GPU_LATENCY];
+
+	int beginQuery(int scope);
+	void endQuery(int query);
+	void resolve(GpuFrame& gpuFrame);
+#endif
+};
+
+// The profiler used by the application
+FrameProfiler& frameProfiler() {
+	static FrameProfiler profiler;
+	return profiler;
+}
+
+// Times the enclosing block on the application's profiler
+class ProfileScope {
+private:
+	int scope;
+public:
+	ProfileScope(const char* name) { scope = frameProfiler().beginScope(name); }
+	~ProfileScope() { frameProfiler().endScope(scope); }
+};
+
+FrameProfiler::FrameProfiler(int capacity) {
+	frames.resize(capacity > 0 ? capacity : 1);
+}
+
+void FrameProfiler::enableGpuTiming() {
+#ifndef TERRAIN_HEADLESS
+	if (gpuTiming || !GLEW_ARB_timer_query) return;
+	for (int i = 0; i < GPU_LATENCY; ++i) {
+		glGenQueries(2 * MAX_QUERIES, gpuFrames[i].queries);
+	}
+	gpuTiming = true;
+#endif
+}
+
+double FrameProfiler::since(std::chrono::steady_clock::time_point start) const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void FrameProfiler::beginFrame() {
+	if (inFrame) endFrame();
+	inFrame = true;
+
+	head = (head + 1) % frames.size();
+	if (count < frames.size()) count++;
+
+	FrameSample& sample = current();
+	sample = FrameSample();
+	sample.frame = frameNumber;
+	std::fill(sample.scopeCpu, sample.scopeCpu + MAX_SCOPES, 0.0f);
+	std::fill(sample.scopeGpu, sample.scopeGpu + MAX_SCOPES, -1.0f);
+
+	openScopes.clear();
+	frameStart = std::chrono::steady_clock::now();
+
+#ifndef TERRAIN_HEADLESS
+	if (gpuTiming) {
+		GpuFrame& gpuFrame = gpuFrames[frameNumber % GPU_LATENCY];
+		if (gpuFrame.pending) resolve(gpuFrame);
+		gpuFrame.frame = frameNumber;
+		gpuFrame.used = 0;
+		beginQuery(-1);
+	}
+#endif
+}
+
+void FrameProfiler::endFrame() {
+	if (!inFrame) return;
+	inFrame = false;
+
+	while (!openScopes.empty()) endScope(openScopes.back().scope);
+	current().cpu = (float)since(frameStart);
+
+#ifndef TERRAIN_HEADLESS
+	if (gpuTiming) {
+		GpuFrame& gpuFrame = gpuFrames[frameNumber % GPU_LATENCY];
+		endQuery(0);
+		gpuFrame.pending = true;
+	}
+#endif
+
+	frameNumber++;
+}
+
+int FrameProfiler::beginScope(const char* name) {
+	int scope = (int)(std::find(scopeNames.begin(), scopeNames.end(), name) - scopeNames.begin());
+	if (scope == scopeNames.size()) {
+		if (scope == MAX_SCOPES) return -1;
+		scopeNames.push_back(name);
+	}
+	if (!inFrame) return scope;
+
+	OpenScope open;
+	open.scope = scope;
+	open.query = -1;
+#ifndef TERRAIN_HEADLESS
+	if (gpuTiming) open.query = beginQuery(scope);
+#endif
+	open.start = std::chrono::steady_clock::now();
+	openScopes.push_back(open);
+	return scope;
+}
+
+void FrameProfiler::endScope(int scope) {
+	if (scope < 0 || openScopes.empty() || openScopes.back().scope != scope) return;
+
+	OpenScope open = openScopes.back();
+	openScopes.pop_back();
+	current().scopeCpu[scope] += (float)since(open.start);
+
+#ifndef TERRAIN_HEADLESS
+	if (open.query >= 0) endQuery(open.query);
+#endif
+}
+
+#ifndef TERRAIN_HEADLESS
+int FrameProfiler::beginQuery(int scope) {
+	GpuFrame& gpuFrame = gpuFrames[frameNumber % GPU_LATENCY];
+	if (gpuFrame.used == MAX_QUERIES) return -1;
+
+	int query = gpuFrame.used++;
+	gpuFrame.scopeOf[query] = scope;
+	glQueryCounter(gpuFrame.queries[2 * query], GL_TIMESTAMP);
+	return query;
+}
+
+void FrameProfiler::endQuery(int query) {
+	GpuFrame& gpuFrame = gpuFrames[frameNumber % GPU_LATENCY];
+	glQueryCounter(gpuFrame.queries[2 * query + 1], GL_TIMESTAMP);
+}
+
+// Stores the GPU times of an earlier frame, if it is still in the buffer
+void FrameProfiler::resolve(GpuFrame& gpuFrame) {
+	gpuFrame.pending = false;
+
+	int age = (int)(frameNumber - gpuFrame.frame);
+	if (age > count - 1) return;
+	FrameSample& sample = frames[(head + frames.size() - age) % frames.size()];
+	if (sample.frame != gpuFrame.frame) return;
+
+	for (int q = 0; q < gpuFrame.used; ++q) {
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(gpuFrame.queries[2 * q], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(gpuFrame.queries[2 * q + 1], GL_QUERY_RESULT, &end);
+		float ms = (float)((end - begin) / 1.0e6);
+
+		int scope = gpuFrame.scopeOf[q];
+		if (scope < 0) sample.gpu = ms;
+		else sample.scopeGpu[scope] = std::max(sample.scopeGpu[scope], 0.0f) + ms;
+	}
+}
+#endif
+
+std::vector<FrameProfiler::FrameSample> FrameProfiler::getSamples() const {
+	std::vector<FrameSample> samples;
+	for (int i = count - 1; i >= 0; --i) {
+		samples.push_back(frames[(head + frames.size() - i) % frames.size()]);
+	}
+	// The frame being recorded is not complete yet
+	if (inFrame && !samples.empty()) samples.pop_back();
+	return samples;
+}
+
+FrameProfiler::Percentiles FrameProfiler::percentiles(std::vector<float> values) {
+	Percentiles result;
+	if (values.empty()) return result;
+
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (int i = 0; i < values.size(); ++i) sum += values[i];
+
+	// Nearest rank
+	auto rank = [&values](float p) {
+		int i = (int)std::ceil(p * values.size()) - 1;
+		return values[std::max(0, std::min(i, (int)values.size() - 1))];
+	};
+
+	result.count = (int)values.size();
+	result.mean = (float)(sum / values.size());
+	result.p50 = rank(0.50f);
+	result.p95 = rank(0.95f);
+	result.p99 = rank(0.99f);
+	result.max = values.back();
+	return result;
+}
+
+FrameProfiler::Percentiles FrameProfiler::cpuPercentiles(int scope) const {
+	std::vector<FrameSample> samples = getSamples();
+	std::vector<float> values;
+	for (int i = 0; i < samples.size(); ++i) {
+		values.push_back(scope < 0 ? samples[i].cpu : samples[i].scopeCpu[scope]);
+	}
+	return percentiles(values);
+}
+
+FrameProfiler::Percentiles FrameProfiler::gpuPercentiles(int scope) const {
+	std::vector<FrameSample> samples = getSamples();
+	std::vector<float> values;
+	for (int i = 0; i < samples.size(); ++i) {
+		float value = scope < 0 ? samples[i].gpu : samples[i].scopeGpu[scope];
+		if (value >= 0) values.push_back(value);
+	}
+	return percentiles(values);
+}
+
+void FrameProfiler::printSummary(std::ostream& out) const {
+	out << std::left << std::setw(16) << "scope (ms)"
+		<< std::right << std::setw(9) << "p50" << std::setw(9) << "p95" << std::setw(9) << "p99"
+		<< std::setw(9) << "gpu p50" << std::setw(9) << "gpu p99" << std::endl;
+
+	for (int scope = -1; scope < getScopeCount(); ++scope) {
+		Percentiles cpu = cpuPercentiles(scope);
+		Percentiles gpu = gpuPercentiles(scope);
+		out << std::left << std::setw(16) << (scope < 0 ? "frame" : scopeNames[scope])
+			<< std::right << std::fixed << std::setprecision(3)
+			<< std::setw(9) << cpu.p50 << std::setw(9) << cpu.p95 << std::setw(9) << cpu.p99;
+		if (gpu.count > 0) out << std::setw(9) << gpu.p50 << std::setw(9) << gpu.p99;
+		out << std::endl;
+	}
+	out << getSamples().size() << " frames" << std::endl;
+}
+
+bool FrameProfiler::writeCSV(const std::string& path) const {
+	std::ofstream file(path.c_str());
+	file << "frame,cpu_ms,gpu_ms";
+	for (int s = 0; s < getScopeCount(); ++s) {
+		file << "," << scopeNames[s] << "_cpu_ms," << scopeNames[s] << "_gpu_ms";
+	}
+	file << "\n";
+
+	std::vector<FrameSample> samples = getSamples();
+	for (int i = 0; i < samples.size(); ++i) {
+		const FrameSample& sample = samples[i];
+		file << sample.frame << "," << sample.cpu << "," << sample.gpu;
+		for (int s = 0; s < getScopeCount(); ++s) {
+			file << "," << sample.scopeCpu[s] << "," << sample.scopeGpu[s];
+		}
+		file << "\n";
+	}
+	return (bool)file;
+}
+
+bool FrameProfiler::writeJSON(const std::string& path) const {
+	std::ofstream file(path.c_str());
+
+	auto writePercentiles = [&file](const Percentiles& p) {
+		file << "{ \"count\": " << p.count << ", \"mean\": " << p.mean << ", \"p50\": " << p.p50
+			<< ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << " }";
+	};
+
+	file << "{\n  \"summary\": {\n";
+	for (int scope = -1; scope < getScopeCount(); ++scope) {
+		file << "    \"" << (scope < 0 ? "frame" : scopeNames[scope]) << "\": { \"cpu_ms\": ";
+		writePercentiles(cpuPercentiles(scope));
+		file << ", \"gpu_ms\": ";
+		writePercentiles(gpuPercentiles(scope));
+		file << " }" << (scope + 1 < getScopeCount() ? "," : "") << "\n";
+	}
+	file << "  },\n  \"scopes\": [";
+	for (int s = 0; s < getScopeCount(); ++s) {
+		file << (s ? ", " : " ") << "\"" << scopeNames[s] << "\"";
+	}
+	file << " ],\n  \"frames\": [\n";
+
+	// One row per frame: frame, cpu, gpu, then cpu and gpu of every scope
+	std::vector<FrameSample> samples = getSamples();
+	for (int i = 0; i < samples.size(); ++i) {
+		const FrameSample& sample = samples[i];
+		file << "    [ " << sample.frame << ", " << sample.cpu << ", " << sample.gpu;
+		for (int s = 0; s < getScopeCount(); ++s) {
+			file << ", " << sample.scopeCpu[s] << ", " << sample.scopeGpu[s];
+		}
+		file << " ]" << (i + 1 < samples.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n}\n";
+	return (bool)file;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef FRUSTUM_H_
+#define FRUSTUM_H_
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// The six planes of a view frustum, taken from the rows of P * V and
+// pointing inwards, for culling bounding spheres
+struct Frustum {
+	Vec4 planes[6];
+
+	Frustum(const Mat4x4& PV) {
+		for (int i = 0; i < 3; ++i) {
+			planes[2 * i] = (PV.row(3) + PV.row(i)).transpose();
+			planes[2 * i + 1] = (PV.row(3) - PV.row(i)).transpose();
+		}
+		for (int i = 0; i < 6; ++i) planes[i] /= planes[i].head<3>().norm();
+	}
+
+	// False only if the sphere is entirely outside
+	bool intersectsSphere(const Vec3& center, float radius) const {
+		for (int i = 0; i < 6; ++i) {
+			if (planes[i].head<3>().dot(center) + planes[i][3] < -radius) return false;
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef HEIGHTFIELDCODEC_H_
+#define HEIGHTFIELDCODEC_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "Icosphere.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Rice codes, LSB first: a value u is u >> k in unary (ones ended by a
+// zero) then its k low bits. Quotients from escape on are written as the
+// escape's ones and the whole value in 32 bits
+class RiceWriter {
+private:
+	std::vector<unsigned char>& bytes;
+	uint64_t buffer = 0;
+	int count = 0;
+
+	void put(uint64_t bits, int n) {
+		buffer |= bits << count;
+		count += n;
+		while (count >= 8) {
+			bytes.push_back((unsigned char)buffer);
+			buffer >>= 8;
+			count -= 8;
+		}
+	}
+public:
+	static const int ESCAPE = 24;
+
+	RiceWriter(std::vector<unsigned char>& bytes) : bytes(bytes) {}
+
+	void write(uint32_t u, int k) {
+		uint32_t q = u >> k;
+		if (q < ESCAPE) {
+			put((1ULL << q) - 1, q + 1);
+			if (k > 0) put(u & ((1u << k) - 1), k);
+		}
+		else {
+			put((1ULL << ESCAPE) - 1, ESCAPE);
+			put(u, 32);
+		}
+	}
+	void flush() {
+		if (count > 0) bytes.push_back((unsigned char)buffer);
+		buffer = 0;
+		count = 0;
+	}
+
+	// Bits u takes with parameter k
+	static uint64_t cost(uint32_t u, int k) {
+		uint32_t q = u >> k;
+		return q < ESCAPE ? q + 1 + k : ESCAPE + 32;
+	}
+};
+
+class RiceReader {
+private:
+	const unsigned char* data;
+	const unsigned char* end;
+	uint64_t buffer = 0;
+	int count = 0;
+
+	void refill() {
+		while (count <= 56) {
+			uint64_t byte = data < end ? *data++ : 0;
+			buffer |= byte << count;
+			count += 8;
+		}
+	}
+	uint32_t take(int n) {
+		refill();
+		uint32_t bits = (uint32_t)(buffer & ((1ULL << n) - 1));
+		buffer >>= n;
+		count -= n;
+		return bits;
+	}
+public:
+	RiceReader(const unsigned char* data, size_t size) : data(data), end(data + size) {}
+
+	uint32_t read(int k) {
+		refill();
+		uint32_t q = 0;
+		while ((buffer & 1) && q < RiceWriter::ESCAPE) {
+			buffer >>= 1;
+			q++;
+		}
+		count -= q;
+		if (q == RiceWriter::ESCAPE) return take(32);
+		buffer >>= 1;
+		count--;
+		return k > 0 ? (q << k) | take(k) : q;
+	}
+};
+
+// Compressed storage of an icosphere's height map. Heights are quantized to
+// steps of twice errorBound, so each is within errorBound of the original
+// up to float rounding, and every vertex after the 12 of the icosahedron is
+// predicted from the previous level: the two ends of the edge it splits and
+// the far corners of the two faces along it, weighted 3/8 and 1/8 as in
+// Loop subdivision. The prediction is made on the quantized values, so the
+// decoder repeats it exactly, and the residuals are Rice coded.
+//
+// Vertices are grouped by level and by the base face that first splits
+// their edge, each group a chunk coded on its own with its own Rice
+// parameter: encoding and decoding run a level at a time, the 20 chunks of
+// a level in parallel, as a level only depends on the ones before it.
+// Normals are not stored; calcSurfaceNormals() recomputes them
+class HeightfieldCodec {
+private:
+	int recursions;
+	int numVertices;
+	// Ends of the edge each vertex splits, then the far corners of the faces
+	// along it; -1 for the icosahedron's vertices
+	std::vector<int> parents;
+	// Vertices of chunk (level - 1) * 20 + base face, from offsets[chunk]
+	std::vector<int> offsets;
+	std::vector<int> order;
+
+	static const uint32_t MAGIC = 0x315A4648; // "HFZ1"
+	static const int BASE_FACES = 20;
+	static const int HEADER_BYTES = 24;
+
+	int predict(const std::vector<int32_t>& quantized, int v) const {
+		const int* p = &parents[4 * v];
+		int64_t sum = 3LL * (quantized[p[0]] + quantized[p[1]]) + quantized[p[2]] + quantized[p[3]];
+		// sum / 8 rounded half up, the same way for negative sums
+		int64_t s = sum + 4;
+		return (int)(s >= 0 ? s / 8 : -((-s + 7) / 8));
+	}
+public:
+	HeightfieldCodec(Icosphere* mesh);
+
+	int getNumVertices() const { return numVertices; }
+
+	// The height map of the mesh, within errorBound of heights; empty if
+	// errorBound is not positive, as nothing quantizes to an exact bound
+	std::vector<unsigned char> encode(const std::vector<float>& heights, float errorBound, ThreadPool& pool) const;
+	// False, leaving heights untouched, if data is not a height map of this
+	// mesh's level or is damaged: a Rice parameter out of range or chunks
+	// running past its end
+	bool decode(const std::vector<unsigned char>& data, std::vector<float>& heights, ThreadPool& pool) const;
+};
+
+// The faces of every level are rebuilt from the last one: children 4p to
+// 4p + 3 of face p are (a, ab, ca), (b, bc, ab), (c, ca, bc) and
+// (ab, bc, ca), see Icosphere::subdivide()
+HeightfieldCodec::HeightfieldCodec(Icosphere* mesh) {
+	TRACE_SCOPE("heightfield hierarchy");
+	recursions = mesh->getRecursions();
+	numVertices = mesh->getVertices().size();
+	parents.assign(4 * numVertices, -1);
+
+	std::vector<Face> faces = mesh->getFaces();
+	std::vector<int> level(numVertices, 0), owner(numVertices, -1);
+	std::vector<int> corners(3 * faces.size());
+	for (int j = 0; j < faces.size(); ++j) {
+		for (int i = 0; i < 3; ++i) corners[3 * j + i] = faces[j].vertices[i];
+	}
+
+	for (int L = recursions; L >= 1; --L) {
+		int numParents = (int)(corners.size() / 12);
+		std::vector<int> parentCorners(3 * numParents);
+		for (int p = 0; p < numParents; ++p) {
+			const int* child = &corners[12 * p];
+			int a = child[0], b = child[3], c = child[6];
+			int ab = child[1], bc = child[4], ca = child[2];
+			parentCorners[3 * p] = a;
+			parentCorners[3 * p + 1] = b;
+			parentCorners[3 * p + 2] = c;
+
+			int split[3][4] = { { ab, a, b, c }, { bc, b, c, a }, { ca, c, a, b } };
+			for (int e = 0; e < 3; ++e) {
+				int v = split[e][0];
+				int* p4 = &parents[4 * v];
+				if (p4[0] < 0) {
+					p4[0] = split[e][1];
+					p4[1] = split[e][2];
+					p4[2] = split[e][3];
+					p4[3] = split[e][3];
+					level[v] = L;
+					owner[v] = p >> (2 * (L - 1));
+				}
+				// The second face along the edge
+				else p4[3] = split[e][3];
+			}
+		}
+		corners.swap(parentCorners);
+	}
+
+	int numChunks = BASE_FACES * recursions;
+	offsets.assign(numChunks + 1, 0);
+	for (int v = 12; v < numVertices; ++v) offsets[(level[v] - 1) * BASE_FACES + owner[v] + 1]++;
+	for (int c = 0; c < numChunks; ++c) offsets[c + 1] += offsets[c];
+	order.resize(offsets[numChunks]);
+	std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+	for (int v = 12; v < numVertices; ++v) order[fill[(level[v] - 1) * BASE_FACES + owner[v]]++] = v;
+}
+
+std::vector<unsigned char> HeightfieldCodec::encode(const std::vector<float>& heights, float errorBound, ThreadPool& pool) const {
+	TRACE_SCOPE("heightfield encode");
+	if (!(errorBound > 0)) return std::vector<unsigned char>();
+	float step = 2.0f * errorBound;
+	std::vector<int32_t> quantized(numVertices);
+	for (int v = 0; v < numVertices; ++v) quantized[v] = (int32_t)std::lround(heights[v] / step);
+
+	int numChunks = BASE_FACES * recursions;
+	std::vector<std::vector<unsigned char>> chunks(numChunks);
+	pool.parallelFor(0, numChunks, 1, [&](int c) {
+		int first = offsets[c], last = offsets[c + 1];
+		std::vector<uint32_t> residuals(last - first);
+		for (int i = first; i < last; ++i) {
+			int32_t r = quantized[order[i]] - predict(quantized, order[i]);
+			residuals[i - first] = ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+		}
+
+		int bestK = 0;
+		uint64_t bestCost = ~0ULL;
+		for (int k = 0; k < RiceWriter::ESCAPE; ++k) {
+			uint64_t cost = 0;
+			for (uint32_t u : residuals) cost += RiceWriter::cost(u, k);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestK = k;
+			}
+		}
+
+		std::vector<unsigned char>& bytes = chunks[c];
+		bytes.push_back((unsigned char)bestK);
+		RiceWriter writer(bytes);
+		for (uint32_t u : residuals) writer.write(u, bestK);
+		writer.flush();
+	});
+
+	// Header, the icosahedron's heights, the size of every chunk, the chunks
+	std::vector<unsigned char> data(HEADER_BYTES + 4 * 12 + 4 * numChunks);
+	auto put32 = [&](size_t at, uint32_t value) {
+		for (int i = 0; i < 4; ++i) data[at + i] = (unsigned char)(value >> (8 * i));
+	};
+	uint32_t stepBits;
+	memcpy(&stepBits, &step, sizeof(stepBits));
+	put32(0, MAGIC);
+	put32(4, 1);
+	put32(8, recursions);
+	put32(12, numVertices);
+	put32(16, stepBits);
+	put32(20, numChunks);
+	for (int v = 0; v < 12; ++v) put32(HEADER_BYTES + 4 * v, (uint32_t)quantized[v]);
+	for (int c = 0; c < numChunks; ++c) {
+		put32(HEADER_BYTES + 48 + 4 * c, (uint32_t)chunks[c].size());
+		data.insert(data.end(), chunks[c].begin(), chunks[c].end());
+	}
+	return data;
+}
+
+bool HeightfieldCodec::decode(const std::vector<unsigned char>& data, std::vector<float>& heights, ThreadPool& pool) const {
+	TRACE_SCOPE("heightfield decode");
+	int numChunks = BASE_FACES * recursions;
+	size_t tableEnd = HEADER_BYTES + 48 + 4 * (size_t)numChunks;
+	if (data.size() < tableEnd) return false;
+	auto get32 = [&](size_t at) {
+		uint32_t value = 0;
+		for (int i = 0; i < 4; ++i) value |= (uint32_t)data[at + i] << (8 * i);
+		return value;
+	};
+	if (get32(0) != MAGIC || get32(4) != 1 || get32(8) != (uint32_t)recursions
+		|| get32(12) != (uint32_t)numVertices || get32(20) != (uint32_t)numChunks) return false;
+
+	float step;
+	uint32_t stepBits = get32(16);
+	memcpy(&step, &stepBits, sizeof(step));
+	if (!(step > 0) || std::isinf(step)) return false;
+
+	// Every chunk with vertices starts with its Rice parameter, which the
+	// encoder keeps below the escape
+	std::vector<size_t> chunkOffsets(numChunks + 1, tableEnd);
+	for (int c = 0; c < numChunks; ++c) {
+		chunkOffsets[c + 1] = chunkOffsets[c] + get32(HEADER_BYTES + 48 + 4 * c);
+		if (chunkOffsets[c + 1] > data.size()) return false;
+		if (offsets[c + 1] > offsets[c] && (chunkOffsets[c + 1] == chunkOffsets[c] || data[chunkOffsets[c]] >= RiceWriter::ESCAPE)) return false;
+	}
+
+	std::vector<int32_t> quantized(numVertices);
+	for (int v = 0; v < 12; ++v) quantized[v] = (int32_t)get32(HEADER_BYTES + 4 * v);
+
+	for (int L = 1; L <= recursions; ++L) {
+		pool.parallelFor(0, BASE_FACES, 1, [&](int face) {
+			int c = (L - 1) * BASE_FACES + face;
+			size_t size = chunkOffsets[c + 1] - chunkOffsets[c];
+			if (offsets[c + 1] == offsets[c]) return;
+			int k = data[chunkOffsets[c]];
+			RiceReader reader(&data[chunkOffsets[c]] + 1, size - 1);
+			for (int i = offsets[c]; i < offsets[c + 1]; ++i) {
+				uint32_t u = reader.read(k);
+				int32_t r = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+				quantized[order[i]] = predict(quantized, order[i]) + r;
+			}
+		});
+	}
+
+	heights.resize(numVertices);
+	for (int v = 0; v < numVertices; ++v) heights[v] = quantized[v] * step;
+	return true;
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef HYDROLOGY_H_
+#define HYDROLOGY_H_
+
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "VertexGraph.h"
+#include "Trace.h"
+
+struct HydrologyParams {
+	// Height of the water sphere above the planet's radius; vertices below
+	// it are ocean, where all water ends up
+	float seaLevel = 0.0f;
+	// A vertex is on a river once this fraction of all vertices drains
+	// through it
+	float riverThreshold = 0.002f;
+	// Filled depth from which a vertex counts as part of a lake
+	float minLakeDepth = 1e-3f;
+};
+
+// A river from its source down to where it reaches the ocean, a lake or a
+// larger river
+struct River {
+	std::vector<int> vertices;
+};
+
+struct Lake {
+	// Height of the lake surface, and of it above the water sphere
+	float level;
+	float aboveSea;
+	float maxDepth;
+	int numVertices;
+	// Vertex the lake drains through
+	int outlet;
+};
+
+// Drainage of a height field on a sphere mesh. Priority-flood fills every
+// depression up to its spill height, starting from the ocean (or the lowest
+// vertex if there is none); the vertex each vertex was reached from is where
+// it drains to, which also routes water across lakes and flats. Flow
+// accumulation then sums drained vertices in reverse flood order.
+//
+// O(V log V) with the heap and the pit queue in flat arrays
+class Hydrology {
+private:
+	std::vector<float> filled;
+	std::vector<int> receivers;
+	std::vector<float> accumulation;
+	std::vector<float> lakeDepth;
+	std::vector<float> riverFlow;
+	std::vector<River> rivers;
+	std::vector<Lake> lakes;
+
+	void extractRivers(const VertexGraph& graph, const HydrologyParams& params);
+	void extractLakes(const VertexGraph& graph, const HydrologyParams& params);
+public:
+	void compute(const VertexGraph& graph, const std::vector<float>& heights, const HydrologyParams& params);
+	bool empty() const { return filled.empty(); }
+	size_t getMemoryBytes() const;
+
+	// Heights with every depression filled to its spill height
+	const std::vector<float>& getFilledHeights() const { return filled; }
+	// Vertex each vertex drains to, -1 in the ocean
+	const std::vector<int>& getReceivers() const { return receivers; }
+	// Vertices draining through each vertex, itself included
+	const std::vector<float>& getAccumulation() const { return accumulation; }
+
+	// Per-vertex attributes for the terrain shader: depth of the lake over
+	// the vertex, and on rivers the log of the flow scaled to (0, 1]
+	const std::vector<float>& getLakeDepth() const { return lakeDepth; }
+	const std::vector<float>& getRiverFlow() const { return riverFlow; }
+
+	const std::vector<River>& getRivers() const { return rivers; }
+	const std::vector<Lake>& getLakes() const { return lakes; }
+};
+
+size_t Hydrology::getMemoryBytes() const {
+	size_t bytes = (filled.capacity() + accumulation.capacity() + lakeDepth.capacity() + riverFlow.capacity()) * sizeof(float)
+		+ receivers.capacity() * sizeof(int) + rivers.capacity() * sizeof(River) + lakes.capacity() * sizeof(Lake);
+	for (const River& river : rivers) bytes += river.vertices.capacity() * sizeof(int);
+	return bytes;
+}
+
+void Hydrology::compute(const VertexGraph& graph, const std::vector<float>& heights, const HydrologyParams& params) {
+	TRACE_SCOPE("hydrology");
+	int numVertices = graph.numVertices();
+	filled.assign(heights.begin(), heights.end());
+	receivers.assign(numVertices, -1);
+
+	typedef std::pair<float, int> Entry;
+	std::vector<Entry> heap;
+	std::vector<int> pit;
+	std::vector<int> order;
+	std::vector<char> closed(numVertices, 0);
+	heap.reserve(numVertices);
+	order.reserve(numVertices);
+
+	for (int v = 0; v < numVertices; ++v) {
+		if (heights[v] < params.seaLevel) {
+			closed[v] = 1;
+			heap.push_back(Entry(heights[v], v));
+		}
+	}
+	if (heap.empty() && numVertices > 0) {
+		int lowest = (int)(std::min_element(heights.begin(), heights.end()) - heights.begin());
+		closed[lowest] = 1;
+		heap.push_back(Entry(heights[lowest], lowest));
+	}
+	std::make_heap(heap.begin(), heap.end(), std::greater<Entry>());
+
+	// Vertices reached below the current water level are in a depression;
+	// they fill to that level and are expanded first, in FIFO order
+	size_t pitHead = 0;
+	while (!heap.empty() || pitHead < pit.size()) {
+		int current;
+		if (pitHead < pit.size()) {
+			current = pit[pitHead++];
+			if (pitHead == pit.size()) {
+				pit.clear();
+				pitHead = 0;
+			}
+		}
+		else {
+			std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+			current = heap.back().second;
+			heap.pop_back();
+		}
+		order.push_back(current);
+
+		for (int k = graph.neighborOffsets[current]; k < graph.neighborOffsets[current + 1]; ++k) {
+			int n = graph.neighbors[k];
+			if (closed[n]) continue;
+			closed[n] = 1;
+			receivers[n] = current;
+
+			if (heights[n] <= filled[current]) {
+				filled[n] = filled[current];
+				pit.push_back(n);
+			}
+			else {
+				heap.push_back(Entry(heights[n], n));
+				std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+			}
+		}
+	}
+
+	// Every vertex was reached after the one it drains to
+	accumulation.assign(numVertices, 1.0f);
+	for (int i = (int)order.size() - 1; i >= 0; --i) {
+		int v = order[i];
+		if (receivers[v] >= 0) accumulation[receivers[v]] += accumulation[v];
+	}
+
+	lakeDepth.assign(numVertices, 0.0f);
+	for (int v = 0; v < numVertices; ++v) {
+		float depth = filled[v] - heights[v];
+		if (depth > params.minLakeDepth && filled[v] >= params.seaLevel) lakeDepth[v] = depth;
+	}
+
+	extractRivers(graph, params);
+	extractLakes(graph, params);
+}
+
+void Hydrology::extractRivers(const VertexGraph& graph, const HydrologyParams& params) {
+	int numVertices = graph.numVertices();
+	float threshold = std::max(2.0f, params.riverThreshold * numVertices);
+	float maxLog = std::log((float)std::max(numVertices, 2));
+
+	// River vertices flow on land, not across lakes or the ocean
+	std::vector<char> river(numVertices, 0);
+	riverFlow.assign(numVertices, 0.0f);
+	for (int v = 0; v < numVertices; ++v) {
+		if (accumulation[v] >= threshold && receivers[v] >= 0 && lakeDepth[v] == 0.0f) {
+			river[v] = 1;
+			riverFlow[v] = std::log(accumulation[v]) / maxLog;
+		}
+	}
+
+	std::vector<int> upstream(numVertices, 0);
+	for (int v = 0; v < numVertices; ++v) {
+		if (river[v] && river[receivers[v]]) upstream[receivers[v]]++;
+	}
+
+	// Sources have no river flowing into them; each river ends at the first
+	// vertex that is not a river or where it joins one already traced
+	rivers.clear();
+	std::vector<char> traced(numVertices, 0);
+	for (int v = 0; v < numVertices; ++v) {
+		if (!river[v] || upstream[v] > 0) continue;
+
+		River path;
+		int current = v;
+		while (true) {
+			path.vertices.push_back(current);
+			if (!river[current] || traced[current]) break;
+			traced[current] = 1;
+			if (receivers[current] < 0) break;
+			current = receivers[current];
+		}
+		rivers.push_back(path);
+	}
+}
+
+void Hydrology::extractLakes(const VertexGraph& graph, const HydrologyParams& params) {
+	int numVertices = graph.numVertices();
+	lakes.clear();
+
+	std::vector<int> component(numVertices, -1);
+	std::vector<int> queue;
+	for (int v = 0; v < numVertices; ++v) {
+		if (lakeDepth[v] == 0.0f || component[v] >= 0) continue;
+
+		Lake lake;
+		lake.level = filled[v];
+		lake.aboveSea = lake.level - params.seaLevel;
+		lake.maxDepth = 0.0f;
+		lake.numVertices = 0;
+		lake.outlet = -1;
+
+		int id = lakes.size();
+		queue.assign(1, v);
+		component[v] = id;
+		for (size_t q = 0; q < queue.size(); ++q) {
+			int current = queue[q];
+			lake.numVertices++;
+			lake.maxDepth = std::max(lake.maxDepth, lakeDepth[current]);
+
+			int receiver = receivers[current];
+			if (lake.outlet < 0 && receiver >= 0 && lakeDepth[receiver] == 0.0f) lake.outlet = receiver;
+
+			for (int k = graph.neighborOffsets[current]; k < graph.neighborOffsets[current + 1]; ++k) {
+				int n = graph.neighbors[k];
+				if (lakeDepth[n] > 0.0f && component[n] < 0 && filled[n] == lake.level) {
+					component[n] = id;
+					queue.push_back(n);
+				}
+			}
+		}
+		lakes.push_back(lake);
+	}
+}
+
+#endif
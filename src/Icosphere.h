@@ -3,12 +3,17 @@
 
 #include <vector>
 #include <map>
+#include <limits>
+#include <algorithm>
 #include <math.h>
 #include <iostream>
 
-#include <OpenGP/GL/Application.h>
 #include <OpenGP/GL/Eigen.h>
 
+#include "Arena.h"
+#include "MemoryReport.h"
+#include "Trace.h"
+
 using namespace OpenGP;
 
 #define SCREEN_WIDTH 640
@@ -16,11 +21,13 @@ using namespace OpenGP;
 float t = 0.0f;
 
 struct Face {
-	std::vector<int> vertices;
+	int vertices[3];
 
 public:
 	Face(int a, int b, int c) {
-		vertices = std::vector<int> { a, b, c };
+		vertices[0] = a;
+		vertices[1] = b;
+		vertices[2] = c;
 	}
 };
 
@@ -29,11 +36,17 @@ private:
 	std::vector<Vec3> points;
 	int index;
 	std::vector<Face> faces;
+	// The 20 faces of the icosahedron, which the faces of every level
+	// subdivide
+	std::vector<Face> baseFaces;
+	// Positions around the origin while subdividing, released afterwards
+	// but for the icosahedron's, which locateFace() starts from
 	std::vector<Vec3> vertices;
 	std::vector<Vec3> verticesTranslated;
+	// Empty once compact()
 	std::vector<Vec2> uvs;
-	std::map<long, int> middlePointIndices;
 	std::vector<int> wrapped;
+	bool compacted = false;
 
 	const float goldenRatio = (1.0f + sqrt(5.0f)) / 2.0f;
 	int recursions;
@@ -42,31 +55,54 @@ private:
 
 	int addVertex(Vec3 point);
 	int getMiddlePoint(Vec3 point1, Vec3 point2);
-	int getMidPointIndex(int indexA, int indexB);
-	Vec3 lerp(Vec3 a, Vec3 b, float t);
-	void subdivide(int recursions);
+	// Index of the midpoint of each edge, by its end indices; lives in the
+	// arena of subdivide()
+	typedef std::map<long long, int, std::less<long long>, ArenaAllocator<std::pair<const long long, int>>> MidPointMap;
+	int getMidPointIndex(int indexA, int indexB, MidPointMap& midPoints);
+	Vec3 lerp(Vec3 a, Vec3 b, float t) const;
+	void subdivide(int recursions, Arena& arena);
 	void translate();
 	std::vector<int> findWrappedUvcoords();
 	void fixWrapedUvs();
 public:
-	Icosphere(Vec3 pos, float radius, int recursions);
+	// Scratch memory of the subdivision comes from arena if given, else from
+	// an arena of its own
+	Icosphere(Vec3 pos, float radius, int recursions, Arena* arena = nullptr);
 
 	std::vector<unsigned int> genMesh();
-	std::vector<Vec3> getVertices();
+	const std::vector<Vec3>& getVertices() const { return verticesTranslated; }
 	void calcUvs();
-	std::vector<Vec2> getUvs();
+	// Empty when the sphere is compact, see deriveUvs()
+	const std::vector<Vec2>& getUvs() const { return uvs; }
+	// The UVs computed from the positions, for compact spheres
+	std::vector<Vec2> deriveUvs() const;
+	Vec2 getUv(int vertex) const;
 	std::vector<Vec3> getVertexNormals();
+	Vec3 getVertexNormal(int vertex) const { return (verticesTranslated[vertex] - pos).normalized(); }
 	std::vector<Face> getFaces() { return faces; }
+	const Face& getFace(int face) const { return faces[face]; }
+	const Vec3& getVertex(int vertex) const { return verticesTranslated[vertex]; }
+	int getRecursions() const { return recursions; }
 	float getRadius() { return radius; }
 	Vec3 getCenter() { return pos; }
+
+	// Drops the UVs, which deriveUvs() then computes on each call: for meshes
+	// that are uploaded once, or never drawn
+	void compact();
+	bool isCompact() const { return compacted; }
+	void reportMemory(MemoryReport& report, const std::string& name) const;
+
+	// The face of the last level that direction, from the center, points
+	// through. Descends from the base face containing it, one level at a
+	// time: O(recursions)
+	int locateFace(Vec3 direction) const;
 };
 
-Icosphere::Icosphere(Vec3 pos, float radius, int recursions) {
+Icosphere::Icosphere(Vec3 pos, float radius, int recursions, Arena* arena) {
 	this->recursions = recursions;
 	this->radius = radius;
 	this->pos = pos;
 
-	middlePointIndices = std::map<long, int>();
 	faces = std::vector<Face>();
 	vertices = std::vector<Vec3>();
 
@@ -114,26 +150,35 @@ Icosphere::Icosphere(Vec3 pos, float radius, int recursions) {
 	faces.push_back(Face(6, 2, 10));
 	faces.push_back(Face(8, 6, 7));
 	faces.push_back(Face(9, 8, 1));
-
-	subdivide(recursions);
-	calcUvs();
+	baseFaces = faces;
+
+	Arena local;
+	subdivide(recursions, arena != nullptr ? *arena : local);
+	vertices.resize(12);
+	vertices.shrink_to_fit();
+	{
+		TRACE_SCOPE("icosphere uvs");
+		calcUvs();
+	}
 	//fixWrapedUvs();
 }
 
-Vec3 Icosphere::lerp(Vec3 a, Vec3 b, float t) {
+Vec3 Icosphere::lerp(Vec3 a, Vec3 b, float t) const {
 	return a * t - (t - 1.0) * b;
 }
 
-int Icosphere::getMidPointIndex(int indexA, int indexB) {
+int Icosphere::getMidPointIndex(int indexA, int indexB, MidPointMap& midPoints) {
 	int smallIndex = std::min(indexA, indexB);
 	int largeIndex = std::max(indexA, indexB);
 
-	long key = (smallIndex << 16) + largeIndex;
+	// Indices pass 16 bits from level 8 on
+	long long key = ((long long)smallIndex << 32) + largeIndex;
 
 	int ret;
 
-	if (middlePointIndices.count(key)) {
-		ret =  middlePointIndices.at(key);
+	MidPointMap::iterator found = midPoints.find(key);
+	if (found != midPoints.end()) {
+		ret = found->second;
 	}
 	else {
 		Vec3 p1 = vertices[indexA];
@@ -146,38 +191,114 @@ int Icosphere::getMidPointIndex(int indexA, int indexB) {
 		ret = vertices.size();
 		vertices.push_back(middle);
 
-		middlePointIndices.insert(std::pair<long, int>(key, ret));
+		midPoints.insert(found, std::pair<const long long, int>(key, ret));
 	}
 
 	return ret;
 }
 
-void Icosphere::subdivide(int recursions) {
+// Subdivides the faces in place. The midpoints of every face are found in
+// face order first, which numbers the new vertices, then the children are
+// written from the last face back, each over faces already subdivided
+void Icosphere::subdivide(int recursions, Arena& arena) {
+	TRACE_SCOPE_ARG("icosphere subdivide", "level", recursions);
+	ArenaScope scope(arena);
+	MidPointMap midPoints((ArenaAllocator<std::pair<const long long, int>>(arena)));
+
+	// 20 * 4^recursions faces around 10 * 4^recursions + 2 vertices
+	size_t numFaces = faces.size() << (2 * recursions);
+	faces.reserve(numFaces);
+	vertices.reserve(numFaces / 2 + 2);
+	int* midpoints = arena.allocate<int>(std::max<size_t>(3 * numFaces / 4, 1));
+
 	for (int i = 0; i < recursions; ++i) {
-		std::vector<Face> facesNew;
-		for (int j = 0; j < faces.size(); ++j) {
+		int n = (int)faces.size();
+		for (int j = 0; j < n; ++j) {
+			const int* corners = faces[j].vertices;
+			midpoints[3 * j] = getMidPointIndex(corners[0], corners[1], midPoints);
+			midpoints[3 * j + 1] = getMidPointIndex(corners[1], corners[2], midPoints);
+			midpoints[3 * j + 2] = getMidPointIndex(corners[2], corners[0], midPoints);
+		}
+
+		faces.resize(4 * n, Face(0, 0, 0));
+		for (int j = n - 1; j >= 0; --j) {
 			int a = faces[j].vertices[0];
 			int b = faces[j].vertices[1];
 			int c = faces[j].vertices[2];
 
-			int ab = getMidPointIndex(a, b);
-			int bc = getMidPointIndex(b, c);
-			int ca = getMidPointIndex(c, a);
+			int ab = midpoints[3 * j];
+			int bc = midpoints[3 * j + 1];
+			int ca = midpoints[3 * j + 2];
 
-			facesNew.push_back(Face(a, ab, ca));
-			facesNew.push_back(Face(b, bc, ab));
-			facesNew.push_back(Face(c, ca, bc));
-			facesNew.push_back(Face(ab, bc, ca));
+			faces[4 * j] = Face(a, ab, ca);
+			faces[4 * j + 1] = Face(b, bc, ab);
+			faces[4 * j + 2] = Face(c, ca, bc);
+			faces[4 * j + 3] = Face(ab, bc, ca);
 		}
-
-		if (facesNew.size() != 0) faces = facesNew;
 	}
 	translate();
 }
 
+// Children of face j are faces 4j to 4j + 3 of the next level, in the order
+// subdivide() adds them, so a face of the last level is found by picking the
+// child containing direction at every level. The midpoints are recomputed
+// the way getMidPointIndex() computes them
+int Icosphere::locateFace(Vec3 direction) const {
+	// direction is inside a face when it is on the inner side of the plane
+	// through the center and each edge; the base face it is furthest inside
+	int face = 0;
+	float best = -std::numeric_limits<float>::infinity();
+	for (int j = 0; j < baseFaces.size(); ++j) {
+		Vec3 a = vertices[baseFaces[j].vertices[0]];
+		Vec3 b = vertices[baseFaces[j].vertices[1]];
+		Vec3 c = vertices[baseFaces[j].vertices[2]];
+		float inside = std::min(direction.dot(a.cross(b)), std::min(direction.dot(b.cross(c)), direction.dot(c.cross(a))));
+		if (inside > best) {
+			best = inside;
+			face = j;
+		}
+	}
+
+	Vec3 a = vertices[baseFaces[face].vertices[0]];
+	Vec3 b = vertices[baseFaces[face].vertices[1]];
+	Vec3 c = vertices[baseFaces[face].vertices[2]];
+	for (int i = 0; i < recursions; ++i) {
+		Vec3 ab = lerp(a, b, 0.5f).normalized() * radius;
+		Vec3 bc = lerp(b, c, 0.5f).normalized() * radius;
+		Vec3 ca = lerp(c, a, 0.5f).normalized() * radius;
+
+		// Outside an edge of the middle face is the corner face beyond it
+		if (direction.dot(ca.cross(ab)) < 0) {
+			face = 4 * face;
+			b = ab;
+			c = ca;
+		}
+		else if (direction.dot(ab.cross(bc)) < 0) {
+			face = 4 * face + 1;
+			a = b;
+			b = bc;
+			c = ab;
+		}
+		else if (direction.dot(bc.cross(ca)) < 0) {
+			face = 4 * face + 2;
+			a = c;
+			b = ca;
+			c = bc;
+		}
+		else {
+			face = 4 * face + 3;
+			a = ab;
+			b = bc;
+			c = ca;
+		}
+	}
+	return face;
+}
+
 std::vector<unsigned int> Icosphere::genMesh() {
 
 	std::vector<unsigned int> indices;
+	indices.reserve(3 * faces.size());
 
 	for (int i = 0; i < faces.size() * 3; i = i + 3) {
 		int indexA = faces[i / 3].vertices[0];
@@ -194,26 +315,10 @@ std::vector<unsigned int> Icosphere::genMesh() {
 }
 
 void Icosphere::translate() {
-	std::vector<Vec3> verticesTranslated;
-
-	Mat4x4 affineTransform = Mat4x4::Identity();
-	affineTransform(0, 3) = pos[0];
-	affineTransform(1, 3) = pos[1];
-	affineTransform(2, 3) = pos[2];
-
+	verticesTranslated.resize(vertices.size());
 	for (int i = 0; i < vertices.size(); ++i) {
-		Vec4 tempV(vertices[i][0], vertices[i][1], vertices[i][2], 1.0);
-		tempV = affineTransform * tempV;
-
-		verticesTranslated.push_back(Vec3(tempV[0], tempV[1], tempV[2]));
+		verticesTranslated[i] = vertices[i] + pos;
 	}
-
-	this->verticesTranslated = verticesTranslated;
-
-}
-
-std::vector<Vec3> Icosphere::getVertices() {
-	return this->verticesTranslated;
 }
 
 std::vector<int> Icosphere::findWrappedUvcoords() {
@@ -326,26 +431,44 @@ void Icosphere::fixWrapedUvs() {
 }
 
 void Icosphere::calcUvs() {
+	uvs.reserve(uvs.size() + verticesTranslated.size());
 	for (int i = 0; i < verticesTranslated.size(); ++i) {
-		Vec2 temp;
-		Vec3 v = (-verticesTranslated[i]).normalized();
-		temp[0] = .5f - atan2(v[2], v[0]) / (2 * M_PI);
-		temp[1] = .5f - asin(v[1]) / M_PI;
-		//std::cout << "u: " << temp[0] << " v: " << temp[1] << std::endl;
-		
-		uvs.push_back(temp);
+		uvs.push_back(getUv(i));
 	}
 }
 
-std::vector<Vec2> Icosphere::getUvs() {
-	return this->uvs;
+Vec2 Icosphere::getUv(int vertex) const {
+	Vec2 temp;
+	Vec3 v = (-verticesTranslated[vertex]).normalized();
+	temp[0] = .5f - atan2(v[2], v[0]) / (2 * M_PI);
+	temp[1] = .5f - asin(v[1]) / M_PI;
+	return temp;
+}
+
+std::vector<Vec2> Icosphere::deriveUvs() const {
+	std::vector<Vec2> derived(verticesTranslated.size());
+	for (int i = 0; i < verticesTranslated.size(); ++i) {
+		derived[i] = getUv(i);
+	}
+	return derived;
+}
+
+void Icosphere::compact() {
+	std::vector<Vec2>().swap(uvs);
+	compacted = true;
+}
+
+void Icosphere::reportMemory(MemoryReport& report, const std::string& name) const {
+	report.add(name + "/faces", vectorBytes(faces) + vectorBytes(baseFaces));
+	report.add(name + "/vertices", vectorBytes(vertices) + vectorBytes(verticesTranslated));
+	report.add(name + "/uvs", vectorBytes(uvs));
 }
 
 std::vector<Vec3> Icosphere::getVertexNormals() {
-	std::vector<Vec3> vnormals;
+	std::vector<Vec3> vnormals(verticesTranslated.size());
 
 	for (int i = 0; i < verticesTranslated.size(); ++i) {
-		vnormals.push_back((verticesTranslated[i] - pos).normalized());
+		vnormals[i] = (verticesTranslated[i] - pos).normalized();
 	}
 
 	return vnormals;
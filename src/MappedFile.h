@@ -0,0 +1,195 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <atomic>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Memory mapping of a whole file, for data larger than memory: pages are
+// read in when touched, written back by the OS under memory pressure or by
+// flush(), and release() gives the ones of a range back once they are no
+// longer needed, so what stays resident is what is being worked on.
+// Concurrent writes to disjoint ranges are safe. Files opened read-only
+// may be mapped by other processes too, and must not be written
+class MappedFile {
+private:
+	unsigned char* data = nullptr;
+	size_t size = 0;
+	bool writable = false;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	std::atomic<bool> trimPending{ false };
+#endif
+
+	bool map(const char* filename, size_t newSize, bool create, bool writable);
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// A new file of size bytes, zeroed, replacing any file of that name
+	bool create(const char* filename, size_t size) { return map(filename, size, true, true); }
+	// An existing file, the whole of it
+	bool open(const char* filename) { return map(filename, 0, false, true); }
+	bool openReadOnly(const char* filename) { return map(filename, 0, false, false); }
+	void close();
+	bool isOpen() const { return data != nullptr; }
+
+	unsigned char* getData() { return data; }
+	const unsigned char* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+	// Drops the pages of the range from the working set, starting their
+	// write back; the data stays readable, from the page cache or the file.
+	// Pages partly outside the range are left alone. Windows only drops the
+	// pages of a file view by unmapping it, so there the range is written
+	// back and its pages go at the next trim()
+	void release(size_t offset, size_t bytes);
+	// Maps the file again if a release() is pending, so getData() may
+	// change, and no other thread may use the mapping meanwhile. Only does
+	// anything on Windows; false, closing the file, if it cannot be mapped
+	bool trim();
+	// Writes every changed page back; false on an I/O error
+	bool flush();
+
+	static size_t pageSize();
+};
+
+bool MappedFile::map(const char* filename, size_t newSize, bool create, bool writable) {
+	close();
+	this->writable = writable;
+
+#ifdef _WIN32
+	file = writable
+		? CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)
+		: CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	if (create) size = newSize;
+	else {
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+	}
+
+	// A mapping larger than the file extends it
+	if (size > 0) {
+		mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+		if (mapping != NULL) data = (unsigned char*)MapViewOfFile(mapping, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = ::open(filename, !writable ? O_RDONLY : create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+	if (fd < 0) return false;
+
+	bool sized = true;
+	if (create) {
+		size = newSize;
+		// Sparse where the file system allows it; zeroes until written
+		sized = ftruncate(fd, (off_t)size) == 0;
+	}
+	else {
+		struct stat st;
+		sized = fstat(fd, &st) == 0;
+		size = sized ? (size_t)st.st_size : 0;
+	}
+	if (sized && size > 0) {
+		void* ptr = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr != MAP_FAILED) data = (unsigned char*)ptr;
+	}
+	::close(fd);
+#endif
+
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mapping != NULL) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+	trimPending = false;
+#else
+	if (data != nullptr) munmap(data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+size_t MappedFile::pageSize() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (size_t)info.dwAllocationGranularity;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void MappedFile::release(size_t offset, size_t bytes) {
+	size_t page = pageSize();
+	size_t begin = (offset + page - 1) / page * page;
+	size_t end = std::min(offset + bytes, size) / page * page;
+	if (data == nullptr || begin >= end) return;
+#ifdef _WIN32
+	// Clean pages leave the working set with the view for the standby
+	// list, where they stay until the memory is wanted elsewhere
+	FlushViewOfFile(data + begin, end - begin);
+	trimPending = true;
+#else
+	// Dirty pages of a shared mapping stay in the page cache
+	msync(data + begin, end - begin, MS_ASYNC);
+	madvise(data + begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+bool MappedFile::trim() {
+#ifdef _WIN32
+	if (data == nullptr || !trimPending.exchange(false)) return data != nullptr;
+	// Changes not written back yet stay in the mapping's pages. The view
+	// usually gets the same address back, as nothing else took it
+	UnmapViewOfFile(data);
+	DWORD access = writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ;
+	void* ptr = MapViewOfFileEx(mapping, access, 0, 0, 0, data);
+	if (ptr == NULL) ptr = MapViewOfFile(mapping, access, 0, 0, 0);
+	data = (unsigned char*)ptr;
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+#endif
+	return data != nullptr;
+}
+
+bool MappedFile::flush() {
+	if (data == nullptr) return false;
+#ifdef _WIN32
+	return FlushViewOfFile(data, 0) && FlushFileBuffers(file);
+#else
+	return msync(data, size, MS_SYNC) == 0;
+#endif
+}
+
+#endif
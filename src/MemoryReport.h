@@ -0,0 +1,115 @@
+#ifndef MEMORYREPORT_H_
+#define MEMORYREPORT_H_
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+// Bytes a vector holds on the heap, spare capacity included
+template <typename T>
+size_t vectorBytes(const std::vector<T>& v) {
+	return v.capacity() * sizeof(T);
+}
+
+struct MemoryEntry {
+	std::string name;
+	size_t bytes;
+	// Most bytes the subsystem held at once, where it keeps track (arenas);
+	// bytes otherwise
+	size_t peakBytes;
+};
+
+// Where the heap goes: bytes per subsystem, named "owner/part", e.g.
+// "terrain/heights", as each class adds its own in reportMemory(). The
+// process' resident set and its peak come from the OS and also count what
+// no entry knows about: code, GL drivers, allocator slack
+class MemoryReport {
+private:
+	std::vector<MemoryEntry> entries;
+public:
+	void add(const std::string& name, size_t bytes) { add(name, bytes, bytes); }
+	void add(const std::string& name, size_t bytes, size_t peakBytes) {
+		MemoryEntry entry = { name, bytes, std::max(bytes, peakBytes) };
+		entries.push_back(entry);
+	}
+
+	const std::vector<MemoryEntry>& getEntries() const { return entries; }
+	size_t totalBytes() const;
+
+	// 0 where the platform does not tell
+	static size_t residentBytes();
+	static size_t peakResidentBytes();
+
+	void print(std::ostream& out) const;
+};
+
+size_t MemoryReport::totalBytes() const {
+	size_t total = 0;
+	for (const MemoryEntry& entry : entries) total += entry.bytes;
+	return total;
+}
+
+size_t MemoryReport::residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	// Linux only; elsewhere there is no /proc
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == nullptr) return 0;
+	long pages = 0, resident = 0;
+	int read = fscanf(statm, "%ld %ld", &pages, &resident);
+	fclose(statm);
+	return read == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+size_t MemoryReport::peakResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	// Kilobytes on Linux
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+void MemoryReport::print(std::ostream& out) const {
+	out << std::left << std::setw(32) << "memory" << std::right << std::setw(12) << "MB" << std::setw(12) << "peak MB" << std::endl;
+	out << std::fixed << std::setprecision(2);
+	for (const MemoryEntry& entry : entries) {
+		out << std::left << std::setw(32) << entry.name << std::right << std::setw(12) << entry.bytes / 1e6
+			<< std::setw(12) << entry.peakBytes / 1e6 << std::endl;
+	}
+	out << std::left << std::setw(32) << "total" << std::right << std::setw(12) << totalBytes() / 1e6 << std::endl;
+	out << std::left << std::setw(32) << "process resident" << std::right << std::setw(12) << residentBytes() / 1e6
+		<< std::setw(12) << peakResidentBytes() / 1e6 << std::endl;
+	out.unsetf(std::ios::fixed);
+	out << std::setprecision(6);
+}
+
+#endif
@@ -3,15 +3,21 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <vector>
+
+#include <cmath>
 
 #include <OpenGP/GL/Eigen.h>
-#include "OpenGP/GL/Application.h"
 
 using namespace OpenGP;
 
 class Noise {
 private:
-    float* exponent_array = nullptr;
+    // Amplitude of each octave, recomputed whenever H, lacunarity or
+    // octaves change
+    std::vector<float> exponent_array;
+public:
+    static const int MAX_OCTAVES = 16;
 protected:
     const int DEFAULT_WIDTH = 2048;
     const int DEFAULT_HEIGHT = 2048;
@@ -35,13 +41,21 @@ protected:
     void computeExponentArray();
     virtual float eval(const Vec3& point) const = 0;
 public:
-    /* Getters and Setters */
-    void setH(float H);
-    void setLacunarity(float lacunarity);
-    void setOffset(float offset);
-    void setOctaves(int octaves);
-    void setWidth(int width);
-    void setHeight(int height);
+    virtual ~Noise() {}
+
+    /* Getters and Setters. An invalid value is rejected: the setter returns
+       false and the noise keeps its previous parameters */
+    bool setH(float H);
+    bool setLacunarity(float lacunarity);
+    bool setOffset(float offset);
+    bool setOctaves(int octaves);
+    bool setWidth(int width);
+    bool setHeight(int height);
+
+    static bool validH(float H) { return std::isfinite(H); }
+    static bool validLacunarity(float lacunarity) { return std::isfinite(lacunarity) && lacunarity >= 1.0f; }
+    static bool validOffset(float offset) { return std::isfinite(offset); }
+    static bool validOctaves(int octaves) { return octaves >= 1 && octaves <= MAX_OCTAVES; }
 
     float getH();
     float getLacunarity();
@@ -56,11 +70,7 @@ public:
 
 
 void Noise::computeExponentArray() {
-    if (exponent_array != nullptr) {
-        delete[] exponent_array;
-    }
-
-    exponent_array = new float[octaves];
+    exponent_array.resize(octaves);
     float f = 1.0f;
 
     for (int i = 0; i < octaves; ++i) {
@@ -69,6 +79,52 @@ void Noise::computeExponentArray() {
     }
 }
 
+bool Noise::setH(float H) {
+    if (!validH(H)) return false;
+    this->H = H;
+    computeExponentArray();
+    return true;
+}
+
+bool Noise::setLacunarity(float lacunarity) {
+    if (!validLacunarity(lacunarity)) return false;
+    this->lacunarity = lacunarity;
+    computeExponentArray();
+    return true;
+}
+
+bool Noise::setOffset(float offset) {
+    if (!validOffset(offset)) return false;
+    this->offset = offset;
+    return true;
+}
+
+bool Noise::setOctaves(int octaves) {
+    if (!validOctaves(octaves)) return false;
+    this->octaves = octaves;
+    computeExponentArray();
+    return true;
+}
+
+bool Noise::setWidth(int width) {
+    if (width <= 0) return false;
+    this->width = width;
+    return true;
+}
+
+bool Noise::setHeight(int height) {
+    if (height <= 0) return false;
+    this->height = height;
+    return true;
+}
+
+float Noise::getH() { return H; }
+float Noise::getLacunarity() { return lacunarity; }
+float Noise::getOffset() { return offset; }
+int Noise::getOctaves() { return octaves; }
+int Noise::getWidth() { return width; }
+int Noise::getHeight() { return height; }
+
 float Noise::fBm(Vec3 point) const {
     float val = 0.0f;
     for (int i = 0; i < octaves; ++i) {
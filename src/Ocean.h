@@ -0,0 +1,460 @@
+#ifndef OCEAN_H_
+#define OCEAN_H_
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "ThreadPool.h"
+#include "Trace.h"
+
+struct OceanParams {
+	// Grid resolution, a power of two
+	int size = 128;
+	// Side of the simulated patch in meters; the field repeats every patch,
+	// so it tiles without seams
+	float patchSize = 64.0f;
+	float windSpeed = 10.0f;
+	// Direction the wind blows to, in radians from the x axis
+	float windAngle = 0.6f;
+	// Phillips spectrum constant
+	float amplitude = 1.5e-5f;
+	// How far the choppy displacement moves points toward the crests
+	float choppiness = 1.2f;
+	float gravity = 9.81f;
+	// The waves loop with this period, so time never loses precision
+	float period = 200.0f;
+	unsigned int seed = 2021;
+
+	bool valid() const { return size >= 2 && (size & (size - 1)) == 0 && patchSize > 0 && period > 0; }
+};
+
+// One simulated instant of the ocean surface
+struct OceanField {
+	int size = 0;
+	float time = 0;
+	// size * size RGBA texels, in rows along z: the slopes of the height
+	// along x and z, the height, and the Jacobian of the choppy
+	// displacement, which drops below 1 where the surface compresses and
+	// below 0 where it folds over, drawn as foam
+	std::vector<float> texels;
+};
+
+// Tessendorf's statistical ocean: a Phillips spectrum of random wave
+// amplitudes, each advanced in time by the deep water dispersion relation
+// and summed by an inverse FFT.
+//
+// The six real fields (height, its two slopes and three derivatives of the
+// choppy displacement) are packed two by two into three complex transforms.
+// The FFT works on split real and imaginary arrays a block of columns at a
+// time, so every butterfly runs over contiguous floats and vectorizes; the
+// columns are transposed in between to transform the other axis the same
+// way. Blocks and transforms are spread over a thread pool
+class Ocean {
+private:
+	static const int TRANSFORMS = 3;
+	// Columns per block, two cache lines of floats per row, so blocks on
+	// different threads share at most the line across their boundary. The
+	// arrays only have the allocator's alignment, so that line may be there
+	static const int BLOCK = 32;
+
+	OceanParams params;
+	int size;
+	// Floats between rows of the transforms. Rows a power of two apart
+	// would share cache sets, so they are padded by a cache line
+	int pitch;
+
+	// Per wave vector, in rows along x: h0(k), conj(h0(-k)) and the wave
+	// vector. The transform of the rows comes first and the one of the
+	// columns after the transpose, which leaves the fields in rows along z
+	std::vector<float> h0Re, h0Im, h0ConjRe, h0ConjIm;
+	std::vector<float> kx, kz, kLength;
+	// Angular frequencies are whole multiples of 2 pi / period, so every
+	// step only needs e^(i w t) for each multiple
+	std::vector<int> harmonic;
+	std::vector<float> phaseRe, phaseIm;
+
+	// exp(2 pi i j / size) for j < size / 2
+	std::vector<float> twiddleRe, twiddleIm;
+	std::vector<int> bitReverse;
+
+	std::vector<float> re[TRANSFORMS], im[TRANSFORMS];
+	std::vector<float> scratchRe[TRANSFORMS], scratchIm[TRANSFORMS];
+
+	float phillips(float x, float z) const;
+	void evolve(int row);
+	void inverseColumns(float* re, float* im, int begin, int end) const;
+	void transpose(int transform, int begin, int end);
+	void pack(OceanField& field, int row) const;
+public:
+	explicit Ocean(const OceanParams& params);
+
+	// Computes the surface at time seconds into field
+	void simulate(float time, OceanField& field, ThreadPool& pool);
+
+	const OceanParams& getParams() const { return params; }
+	int getSize() const { return size; }
+};
+
+Ocean::Ocean(const OceanParams& params) : params(params) {
+	size = params.size;
+	pitch = size + 16;
+	int count = size * size;
+	h0Re.resize(count);
+	h0Im.resize(count);
+	h0ConjRe.resize(count);
+	h0ConjIm.resize(count);
+	harmonic.resize(count);
+	kx.resize(count);
+	kz.resize(count);
+	kLength.resize(count);
+
+	float baseOmega = 2.0f * (float)M_PI / params.period;
+
+	// Complex gaussians for every wave vector, drawn in a fixed order so a
+	// seed always gives the same sea
+	std::mt19937 generator(params.seed);
+	std::normal_distribution<float> gaussian(0.0f, 1.0f);
+	std::vector<float> xiRe(count), xiIm(count);
+	for (int i = 0; i < count; ++i) {
+		xiRe[i] = gaussian(generator);
+		xiIm[i] = gaussian(generator);
+	}
+
+	// Index m stands for the wave number m - size / 2
+	int maxHarmonic = 0;
+	for (int x = 0; x < size; ++x) {
+		for (int z = 0; z < size; ++z) {
+			int i = x * size + z;
+			kx[i] = 2.0f * (float)M_PI * (x - size / 2) / params.patchSize;
+			kz[i] = 2.0f * (float)M_PI * (z - size / 2) / params.patchSize;
+			kLength[i] = std::sqrt(kx[i] * kx[i] + kz[i] * kz[i]);
+			harmonic[i] = (int)std::floor(std::sqrt(params.gravity * kLength[i]) / baseOmega);
+			maxHarmonic = std::max(maxHarmonic, harmonic[i]);
+
+			// Index 0 is the Nyquist frequency, whose -k is not on the grid
+			float amplitude = x > 0 && z > 0 ? std::sqrt(phillips(kx[i], kz[i]) * 0.5f) : 0.0f;
+			h0Re[i] = xiRe[i] * amplitude;
+			h0Im[i] = xiIm[i] * amplitude;
+		}
+	}
+
+	phaseRe.resize(maxHarmonic + 1);
+	phaseIm.resize(maxHarmonic + 1);
+
+	// -k of index m is index size - m; pairing every wave with it keeps
+	// h(-k) = conj(h(k)), so the fields are real
+	for (int x = 0; x < size; ++x) {
+		for (int z = 0; z < size; ++z) {
+			int i = x * size + z;
+			int j = ((size - x) % size) * size + (size - z) % size;
+			h0ConjRe[i] = h0Re[j];
+			h0ConjIm[i] = -h0Im[j];
+		}
+	}
+
+	twiddleRe.resize(size / 2);
+	twiddleIm.resize(size / 2);
+	for (int j = 0; j < size / 2; ++j) {
+		twiddleRe[j] = (float)std::cos(2.0 * M_PI * j / size);
+		twiddleIm[j] = (float)std::sin(2.0 * M_PI * j / size);
+	}
+
+	int bits = 0;
+	while ((1 << bits) < size) bits++;
+	bitReverse.resize(size);
+	for (int i = 0; i < size; ++i) {
+		int reversed = 0;
+		for (int b = 0; b < bits; ++b) {
+			if (i & (1 << b)) reversed |= 1 << (bits - 1 - b);
+		}
+		bitReverse[i] = reversed;
+	}
+
+	for (int t = 0; t < TRANSFORMS; ++t) {
+		re[t].resize(size * pitch);
+		im[t].resize(size * pitch);
+		scratchRe[t].resize(size * pitch);
+		scratchIm[t].resize(size * pitch);
+	}
+}
+
+// Phillips spectrum: waves much longer than the largest the wind raises are
+// cut off, as are the ones across the wind and, to keep the high
+// frequencies from aliasing, the ones shorter than a thousandth of it
+float Ocean::phillips(float x, float z) const {
+	float k2 = x * x + z * z;
+	if (k2 == 0.0f) return 0.0f;
+	float largest = params.windSpeed * params.windSpeed / params.gravity;
+	float smallest = largest * 1e-3f;
+	float along = (x * std::cos(params.windAngle) + z * std::sin(params.windAngle)) / std::sqrt(k2);
+	return params.amplitude * std::exp(-1.0f / (k2 * largest * largest)) / (k2 * k2)
+		* along * along * std::exp(-k2 * smallest * smallest);
+}
+
+// The spectra of one row at the time of the phases: h(k, t) = h0(k)
+// e^(i w t) + conj(h0(-k)) e^(-i w t), and the ones of its slopes i k h and
+// of the derivatives of the choppy displacement i k / |k| h, which moves
+// points toward the crests. Transform t packs a + i b
+void Ocean::evolve(int row) {
+	for (int z = 0; z < size; ++z) {
+		int i = row * size + z;
+		float c = phaseRe[harmonic[i]], s = phaseIm[harmonic[i]];
+		float hRe = (h0Re[i] + h0ConjRe[i]) * c + (h0ConjIm[i] - h0Im[i]) * s;
+		float hIm = (h0Im[i] + h0ConjIm[i]) * c + (h0Re[i] - h0ConjRe[i]) * s;
+
+		float inverse = kLength[i] > 0 ? 1.0f / kLength[i] : 0.0f;
+		float xx = -kx[i] * kx[i] * inverse, zz = -kz[i] * kz[i] * inverse, xz = -kx[i] * kz[i] * inverse;
+		int o = row * pitch + z;
+
+		// h + i (i kx h)
+		re[0][o] = hRe - kx[i] * hRe;
+		im[0][o] = hIm - kx[i] * hIm;
+		// i kz h + i Dxx
+		re[1][o] = -kz[i] * hIm - xx * hIm;
+		im[1][o] = kz[i] * hRe + xx * hRe;
+		// Dzz + i Dxz
+		re[2][o] = zz * hRe - xz * hIm;
+		im[2][o] = zz * hIm + xz * hRe;
+	}
+}
+
+// Unnormalized inverse DFT along the rows of columns [begin, end):
+// iterative radix 2, each butterfly combining two rows of the block
+void Ocean::inverseColumns(float* re, float* im, int begin, int end) const {
+	int width = end - begin;
+	for (int r = 0; r < size; ++r) {
+		int s = bitReverse[r];
+		if (r < s) {
+			std::swap_ranges(re + r * pitch + begin, re + r * pitch + end, re + s * pitch + begin);
+			std::swap_ranges(im + r * pitch + begin, im + r * pitch + end, im + s * pitch + begin);
+		}
+	}
+
+	for (int length = 2; length <= size; length <<= 1) {
+		int half = length / 2;
+		int stride = size / length;
+		for (int start = 0; start < size; start += length) {
+			for (int j = 0; j < half; ++j) {
+				float wRe = twiddleRe[j * stride], wIm = twiddleIm[j * stride];
+				float* __restrict aRe = re + (start + j) * pitch + begin;
+				float* __restrict aIm = im + (start + j) * pitch + begin;
+				float* __restrict bRe = re + (start + j + half) * pitch + begin;
+				float* __restrict bIm = im + (start + j + half) * pitch + begin;
+				for (int x = 0; x < width; ++x) {
+					float tRe = wRe * bRe[x] - wIm * bIm[x];
+					float tIm = wRe * bIm[x] + wIm * bRe[x];
+					bRe[x] = aRe[x] - tRe;
+					bIm[x] = aIm[x] - tIm;
+					aRe[x] += tRe;
+					aIm[x] += tIm;
+				}
+			}
+		}
+	}
+}
+
+// Transposes rows [begin, end) of a transform into its scratch arrays, in
+// square tiles so both sides are read and written a cache line at a time
+void Ocean::transpose(int transform, int begin, int end) {
+	const float* inRe = &re[transform][0];
+	const float* inIm = &im[transform][0];
+	float* outRe = &scratchRe[transform][0];
+	float* outIm = &scratchIm[transform][0];
+	for (int column = 0; column < size; column += BLOCK) {
+		int columnEnd = std::min(column + BLOCK, size);
+		for (int r = begin; r < end; ++r) {
+			for (int c = column; c < columnEnd; ++c) {
+				outRe[c * pitch + r] = inRe[r * pitch + c];
+				outIm[c * pitch + r] = inIm[r * pitch + c];
+			}
+		}
+	}
+}
+
+// Wave numbers start at -size / 2, which flips the sign of every other
+// sample
+void Ocean::pack(OceanField& field, int row) const {
+	float lambda = params.choppiness;
+	for (int x = 0; x < size; ++x) {
+		int i = row * pitch + x;
+		float sign = ((x + row) & 1) ? -1.0f : 1.0f;
+		float height = re[0][i] * sign;
+		float slopeX = im[0][i] * sign;
+		float slopeZ = re[1][i] * sign;
+		float dxx = im[1][i] * sign, dzz = re[2][i] * sign, dxz = im[2][i] * sign;
+
+		float* texel = &field.texels[4 * (row * size + x)];
+		texel[0] = slopeX;
+		texel[1] = slopeZ;
+		texel[2] = height;
+		texel[3] = (1.0f + lambda * dxx) * (1.0f + lambda * dzz) - lambda * lambda * dxz * dxz;
+	}
+}
+
+void Ocean::simulate(float time, OceanField& field, ThreadPool& pool) {
+	TRACE_SCOPE_ARG("ocean step", "size", size);
+	time = std::fmod(time, params.period);
+	field.size = size;
+	field.time = time;
+	field.texels.resize(4 * size * size);
+
+	for (int h = 0; h < phaseRe.size(); ++h) {
+		double angle = 2.0 * M_PI / params.period * h * time;
+		phaseRe[h] = (float)std::cos(angle);
+		phaseIm[h] = (float)std::sin(angle);
+	}
+	pool.parallelFor(0, size, 16, [&](int row) { evolve(row); });
+
+	int blocks = (size + BLOCK - 1) / BLOCK;
+	for (int pass = 0; pass < 2; ++pass) {
+		pool.parallelFor(0, TRANSFORMS * blocks, 1, [&](int task) {
+			int t = task / blocks, begin = (task % blocks) * BLOCK;
+			inverseColumns(&re[t][0], &im[t][0], begin, std::min(begin + BLOCK, size));
+		});
+		if (pass > 0) break;
+
+		pool.parallelFor(0, TRANSFORMS * blocks, 1, [&](int task) {
+			int t = task / blocks, begin = (task % blocks) * BLOCK;
+			transpose(t, begin, std::min(begin + BLOCK, size));
+		});
+		for (int t = 0; t < TRANSFORMS; ++t) {
+			re[t].swap(scratchRe[t]);
+			im[t].swap(scratchIm[t]);
+		}
+	}
+
+	pool.parallelFor(0, size, 16, [&](int row) { pack(field, row); });
+}
+
+// Runs the ocean on a worker at a fixed rate. Every frame the renderer
+// calls update(), which only starts the step for the current time if the
+// previous one is done, and takes the newest finished field with
+// takeResult(). Fields go back with recycle(), so steps do not allocate:
+// one is written by the worker while the renderer uploads another
+class OceanSimulator {
+private:
+	ThreadPool& pool;
+	// Only the step job touches it, and there is one job at a time
+	Ocean ocean;
+	float stepSeconds;
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	bool running = false;
+	long long lastStep = -1;
+	std::unique_ptr<OceanField> ready;
+	std::vector<std::unique_ptr<OceanField>> spare;
+	double lastMs = 0;
+
+	void run(long long step, std::unique_ptr<OceanField> field);
+public:
+	OceanSimulator(ThreadPool& pool, const OceanParams& params, float stepsPerSecond = 30.0f);
+	// Waits for the running step, which uses this object
+	~OceanSimulator();
+
+	OceanSimulator(const OceanSimulator&) = delete;
+	OceanSimulator& operator=(const OceanSimulator&) = delete;
+
+	// Starts the step seconds falls in, unless it is already done or
+	// another step still runs
+	void update(double seconds);
+	// Computes the step seconds falls in, after the running one, before
+	// returning, unless it is already done: what is drawn at a time then
+	// does not depend on how long the frames took, as flythroughs need
+	void step(double seconds);
+
+	// The newest finished field, or null if none finished since the last call
+	std::unique_ptr<OceanField> takeResult();
+	// Hands back a field the caller is done with
+	void recycle(std::unique_ptr<OceanField> field);
+
+	const OceanParams& getParams() const { return ocean.getParams(); }
+	// Wall time of the last finished step
+	double getLastMs();
+};
+
+OceanSimulator::OceanSimulator(ThreadPool& pool, const OceanParams& params, float stepsPerSecond) : pool(pool), ocean(params) {
+	this->stepSeconds = 1.0f / stepsPerSecond;
+}
+
+OceanSimulator::~OceanSimulator() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return !running; });
+}
+
+void OceanSimulator::update(double seconds) {
+	long long step = (long long)std::floor(seconds / stepSeconds);
+	std::unique_ptr<OceanField> field;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running || step == lastStep) return;
+		running = true;
+		lastStep = step;
+		if (!spare.empty()) {
+			field = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	if (!field) field = std::unique_ptr<OceanField>(new OceanField());
+
+	// std::function needs a copyable job, so the field travels as a pointer
+	OceanField* raw = field.release();
+	pool.submit([this, step, raw]() { run(step, std::unique_ptr<OceanField>(raw)); });
+}
+
+void OceanSimulator::step(double seconds) {
+	long long index = (long long)std::floor(seconds / stepSeconds);
+	std::unique_ptr<OceanField> field;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return !running; });
+		if (index == lastStep) return;
+		running = true;
+		lastStep = index;
+		if (!spare.empty()) {
+			field = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	if (!field) field = std::unique_ptr<OceanField>(new OceanField());
+	run(index, std::move(field));
+}
+
+void OceanSimulator::run(long long step, std::unique_ptr<OceanField> field) {
+	auto begin = std::chrono::steady_clock::now();
+	ocean.simulate((float)(step * (double)stepSeconds), *field, pool);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+	// Notified under the lock: the destructor may run as soon as it is
+	// released
+	std::lock_guard<std::mutex> lock(mutex);
+	// A field the renderer has not taken yet is replaced by this newer one
+	if (ready) spare.push_back(std::move(ready));
+	ready = std::move(field);
+	lastMs = ms;
+	running = false;
+	idle.notify_all();
+}
+
+std::unique_ptr<OceanField> OceanSimulator::takeResult() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return std::move(ready);
+}
+
+void OceanSimulator::recycle(std::unique_ptr<OceanField> field) {
+	std::lock_guard<std::mutex> lock(mutex);
+	spare.push_back(std::move(field));
+}
+
+double OceanSimulator::getLastMs() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return lastMs;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef OCTAVECACHE_H_
+#define OCTAVECACHE_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "Noise.h"
+#include "PerlinNoise.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// Memory/speed trade-off of an OctaveCache
+struct OctaveCacheSettings {
+	// Octaves past this one are evaluated on every update instead of cached
+	int maxOctaves = Noise::MAX_OCTAVES;
+	// Upper bound on the cache size in bytes, 0 for none; lowers the number
+	// of cached octaves to fit
+	size_t maxBytes = 0;
+	// Stores values in 16 bits instead of 32: half the memory, but noise
+	// values are off by up to 1.5e-5 per octave, which can flip the
+	// continent threshold of vertices right at it
+	bool quantize = false;
+};
+
+// The noise value of every octave at a fixed set of points, so re-tuning
+// the noise only evaluates the octaves a change affects:
+//  - H, offset and fewer octaves reuse every cached octave
+//  - more octaves evaluate only the new ones
+//  - lacunarity moves every octave but the first
+//  - another seed or other points start over
+// fBm and the hybrid multifractal are then summed from the cached values in
+// the same order as Noise does, so unquantized results are bit-identical
+class OctaveCache {
+private:
+	OctaveCacheSettings settings;
+
+	// What the cached values were evaluated for
+	const void* owner = nullptr;
+	int numPoints = 0;
+	unsigned int seed = 0;
+	float period = 0;
+	float lacunarity = 0;
+
+	int cachedOctaves = 0;
+	// Octave-major: value of octave o at point i is at o * numPoints + i
+	std::vector<float> values;
+	std::vector<int16_t> quantized;
+
+	long long evaluated = 0;
+	long long reused = 0;
+
+	int capacity() const;
+	float value(int octave, int point) const;
+	void store(int octave, int point, float value);
+public:
+	OctaveCache(const OctaveCacheSettings& settings = OctaveCacheSettings()) : settings(settings) {}
+
+	void setSettings(const OctaveCacheSettings& settings);
+	const OctaveCacheSettings& getSettings() const { return settings; }
+	void clear();
+
+	// Computes fBm and hybridMultifractal of noise with the given octaves,
+	// lacunarity, H and offset at points, which owner, seed and period
+	// identify: the same key must always mean the same points
+	void evaluate(const PerlinNoise& noise, const void* owner, unsigned int seed, float period, const std::vector<Vec3>& points,
+		int octaves, float lacunarity, float H, float offset, std::vector<float>& fBm, std::vector<float>& hybrid);
+
+	int getCachedOctaves() const { return cachedOctaves; }
+	size_t getMemoryBytes() const { return values.capacity() * sizeof(float) + quantized.capacity() * sizeof(int16_t); }
+	// Octave evaluations of the last evaluate() call, and cached ones it used
+	long long getEvaluated() const { return evaluated; }
+	long long getReused() const { return reused; }
+};
+
+void OctaveCache::setSettings(const OctaveCacheSettings& settings) {
+	this->settings = settings;
+	clear();
+}
+
+void OctaveCache::clear() {
+	cachedOctaves = 0;
+	values = std::vector<float>();
+	quantized = std::vector<int16_t>();
+}
+
+// How many octaves fit the settings for the current points
+int OctaveCache::capacity() const {
+	int octaves = std::min(settings.maxOctaves, (int)Noise::MAX_OCTAVES);
+	if (settings.maxBytes > 0 && numPoints > 0) {
+		size_t perOctave = (size_t)numPoints * (settings.quantize ? sizeof(int16_t) : sizeof(float));
+		octaves = std::min(octaves, (int)(settings.maxBytes / perOctave));
+	}
+	return std::max(octaves, 0);
+}
+
+float OctaveCache::value(int octave, int point) const {
+	size_t index = (size_t)octave * numPoints + point;
+	if (settings.quantize) return quantized[index] / 32767.0f;
+	return values[index];
+}
+
+void OctaveCache::store(int octave, int point, float value) {
+	size_t index = (size_t)octave * numPoints + point;
+	if (settings.quantize) {
+		float clamped = std::max(-1.0f, std::min(1.0f, value));
+		quantized[index] = (int16_t)lrintf(clamped * 32767.0f);
+	}
+	else {
+		values[index] = value;
+	}
+}
+
+void OctaveCache::evaluate(const PerlinNoise& noise, const void* owner, unsigned int seed, float period, const std::vector<Vec3>& points,
+	int octaves, float lacunarity, float H, float offset, std::vector<float>& fBm, std::vector<float>& hybrid) {
+	TRACE_SCOPE_ARG("octave cache", "octaves", octaves);
+
+	// Keep what is still valid for the new parameters
+	if (owner != this->owner || (int)points.size() != numPoints || seed != this->seed || period != this->period) {
+		clear();
+		this->owner = owner;
+		this->numPoints = points.size();
+		this->seed = seed;
+		this->period = period;
+	}
+	else if (lacunarity != this->lacunarity) {
+		// The first octave is evaluated at the points themselves
+		cachedOctaves = std::min(cachedOctaves, 1);
+	}
+	this->lacunarity = lacunarity;
+
+	int keep = std::min(cachedOctaves, octaves);
+	int cache = std::min(octaves, capacity());
+	if (cache > cachedOctaves) {
+		size_t size = (size_t)cache * numPoints;
+		// reserve() first so growing by a few octaves does not double the
+		// allocation
+		if (settings.quantize) {
+			quantized.reserve(size);
+			quantized.resize(size);
+		}
+		else {
+			values.reserve(size);
+			values.resize(size);
+		}
+	}
+
+	// Amplitudes as Noise::computeExponentArray() computes them
+	std::vector<float> amplitudes(octaves);
+	float f = 1.0f;
+	for (int o = 0; o < octaves; ++o) {
+		amplitudes[o] = std::pow(f, -H);
+		f *= lacunarity;
+	}
+
+	fBm.resize(numPoints);
+	hybrid.resize(numPoints);
+	std::vector<float> octaveValues(octaves);
+	for (int i = 0; i < numPoints; ++i) {
+		Vec3 point = points[i];
+		for (int o = 0; o < octaves; ++o) {
+			if (o < keep) {
+				octaveValues[o] = value(o, i);
+			}
+			else {
+				float v = noise.eval(point);
+				if (o < cache) {
+					store(o, i, v);
+					v = value(o, i);
+				}
+				octaveValues[o] = v;
+			}
+			point *= lacunarity;
+		}
+
+		float sum = 0.0f;
+		for (int o = 0; o < octaves; ++o) sum += octaveValues[o] * amplitudes[o];
+		fBm[i] = sum;
+
+		float val = ((1 - std::abs(octaveValues[0])) + offset) * amplitudes[0];
+		float weight = val;
+		for (int o = 1; o < octaves; ++o) {
+			if (weight > 1.0f) weight = 1.0f;
+			float signal = ((1 - std::abs(octaveValues[o])) + offset) * amplitudes[o];
+			val += signal * weight;
+			weight *= signal;
+		}
+		hybrid[i] = val;
+	}
+
+	evaluated = (long long)(octaves - keep) * numPoints;
+	reused = (long long)keep * numPoints;
+	// Octaves past the ones used this time stay valid
+	cachedOctaves = std::max(cachedOctaves, cache);
+}
+
+#endif
@@ -0,0 +1,490 @@
+#ifndef OUTOFCOREPLANET_H_
+#define OUTOFCOREPLANET_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "Icosphere.h"
+#include "Terrain.h"
+#include "MappedFile.h"
+#include "MemoryReport.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+struct PlanetBorderVertex {
+	Vec3 position;
+	float height;
+	Vec3 normal;
+};
+
+// One block of an out-of-core planet, pointing into its backing file:
+// undisplaced positions, heights and surface normals of the vertices of a
+// patch, by OutOfCorePlanet::latticeIndex(), and a copy of its border side
+// by side, each side from its first corner (see sideIndex()). The borders
+// of all blocks are stored together, after the blocks, so the passes over
+// seams touch them and not pages all over the blocks
+struct PlanetBlock {
+	Vec3* positions;
+	float* heights;
+	Vec3* normals;
+	PlanetBorderVertex* border;
+};
+
+// A planet too large for memory, generated a patch at a time into a memory
+// mapped file. The patches are the faces of a coarse icosphere of
+// patchLevel; each is subdivided level - patchLevel more times into a
+// triangular lattice of vertices, the same positions the full icosphere
+// has. Generation and every later pass touch one block at a time per
+// thread and give its pages back when done, so the working set is a few
+// blocks whatever the level.
+//
+// The vertices on the edges and corners of a patch are stored once in each
+// block sharing them. Generation sums the normals of a block's own faces
+// there, then a stitching pass adds the sums of the blocks across each
+// edge and around each corner, on the compact borders, and writes them
+// back to the blocks, so seam normals are those of the whole surface and
+// equal in every copy. Welded ids, by vertexId(), number the corners
+// first, then the edges, then the insides of the blocks; in total the
+// vertex count of the full icosphere. Only the height function runs out of
+// core: erosion and the other whole-planet passes need Terrain
+class OutOfCorePlanet {
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t level;
+		uint32_t patchLevel;
+		uint32_t seed;
+		float radius;
+		uint32_t numBlocks;
+		uint32_t blockVertices;
+		uint64_t blockStride;
+		uint64_t dataOffset;
+	};
+	static const uint32_t MAGIC = 0x31424C50; // "PLB1"
+
+	int level;
+	int patchLevel;
+	// Lattice segments along a patch edge
+	int segments;
+	float radius;
+	unsigned int seed = 0;
+	std::unique_ptr<Icosphere> coarse;
+
+	// Ends of each coarse edge, smaller index first, and the two sides
+	// (3 * block + side) along it. Sides 0, 1 and 2 of a block go from
+	// corner a to b, b to c and c to a
+	std::vector<int> edgeVertices;
+	std::vector<int> edgeSides;
+	// 2 * edge, plus 1 if the side runs from the larger end
+	std::vector<int> blockEdges;
+	// Corners (3 * block + corner) around each coarse vertex, from
+	// cornerOffsets[vertex]
+	std::vector<int> cornerOffsets;
+	std::vector<int> corners;
+
+	int blockVertices;
+	size_t blockStride;
+	size_t dataOffset;
+	size_t bordersOffset;
+	MappedFile file;
+
+	size_t borderBytes() const { return 3 * (size_t)segments * sizeof(PlanetBorderVertex); }
+	void releaseBorders() { file.release(bordersOffset, (size_t)getNumBlocks() * borderBytes()); }
+
+	void buildTables();
+	// f(block) for every block over the pool, a batch at a time with the
+	// file trimmed in between (see MappedFile::trim()); false if it cannot
+	// be mapped again
+	template <typename Func>
+	bool forBlocks(ThreadPool& pool, Func f);
+	void generateBlock(int block, const Terrain& terrain, const PerlinNoise& noise, std::vector<Vec3>& displaced);
+	bool stitch(ThreadPool& pool);
+public:
+	// patchLevel -1 picks defaultPatchLevel(level); either is lowered to
+	// maxPatchLevel(level)
+	OutOfCorePlanet(float radius, int level, int patchLevel = -1);
+
+	// Patches of 256 segments a side, about 33000 vertices and 1 MB
+	static int defaultPatchLevel(int level) { return std::max(0, level - 8); }
+	// The finest patches with at least a page's count of vertices. Blocks
+	// are rounded up to pages, which smaller ones would mostly waste
+	static int maxPatchLevel(int level);
+
+	// Generates the planet into a new file at path with the height function
+	// of terrain, which must be made on getCoarseMesh(). False if the file
+	// cannot be made
+	bool generate(const std::string& path, const Terrain& terrain, ThreadPool& pool);
+	// A file generate() wrote for this level, patch level and radius
+	bool open(const std::string& path);
+	void close() { file.close(); }
+	bool isOpen() const { return file.isOpen(); }
+	// Writes the file out; false on an I/O error
+	bool flush() { return file.flush(); }
+
+	int getLevel() const { return level; }
+	int getPatchLevel() const { return patchLevel; }
+	int getSegments() const { return segments; }
+	unsigned int getSeed() const { return seed; }
+	Icosphere* getCoarseMesh() { return coarse.get(); }
+	int getNumBlocks() const { return (int)blockEdges.size() / 3; }
+	int getBlockVertices() const { return blockVertices; }
+	// Welded, as the full icosphere
+	long long getNumVertices() const;
+	long long getNumFaces() const { return (long long)getNumBlocks() * segments * segments; }
+	size_t getFileBytes() const { return file.getSize(); }
+
+	// Lattice point i segments from corner a towards b and j towards c
+	int latticeIndex(int i, int j) const { return i * (segments + 1) - i * (i - 1) / 2 + j; }
+	// Lattice point t segments along side 0 (a to b), 1 (b to c) or 2 (c to
+	// a) of a block; PlanetBlock::border[side * segments + t] is its copy
+	int sideIndex(int side, int t) const;
+	long long vertexId(int block, int i, int j) const;
+
+	PlanetBlock getBlock(int block);
+	// Gives the memory of a block back once a pass is done with it
+	void releaseBlock(int block) { file.release(dataOffset + (size_t)block * blockStride, blockStride); }
+
+	// Every welded vertex in id order, as f(position, height, normal),
+	// releasing the blocks as their insides are done. Stops early, closing
+	// the file, if it cannot be mapped again (see MappedFile::trim())
+	template <typename Func>
+	void forEachVertex(Func f);
+	// Every triangle, by welded id, a block at a time
+	template <typename Func>
+	void forEachTriangle(Func f);
+
+	void reportMemory(MemoryReport& report, const std::string& name) const;
+};
+
+OutOfCorePlanet::OutOfCorePlanet(float radius, int level, int patchLevel) {
+	this->level = level;
+	this->patchLevel = std::min(patchLevel < 0 ? defaultPatchLevel(level) : patchLevel, maxPatchLevel(level));
+	this->segments = 1 << (level - this->patchLevel);
+	this->radius = radius;
+	coarse = std::unique_ptr<Icosphere>(new Icosphere(Vec3(0, 0, 0), radius, this->patchLevel));
+	blockVertices = (segments + 1) * (segments + 2) / 2;
+
+	// Blocks start on a page, for releaseBlock()
+	size_t page = MappedFile::pageSize();
+	size_t bytes = (size_t)blockVertices * (2 * sizeof(Vec3) + sizeof(float));
+	blockStride = (bytes + page - 1) / page * page;
+	dataOffset = (sizeof(Header) + page - 1) / page * page;
+	buildTables();
+	bordersOffset = dataOffset + (size_t)getNumBlocks() * blockStride;
+}
+
+int OutOfCorePlanet::maxPatchLevel(int level) {
+	size_t page = MappedFile::pageSize();
+	int patchLevel = level;
+	while (patchLevel > 0) {
+		size_t segments = (size_t)1 << (level - patchLevel);
+		if ((segments + 1) * (segments + 2) / 2 >= page) break;
+		patchLevel--;
+	}
+	return patchLevel;
+}
+
+void OutOfCorePlanet::buildTables() {
+	int numBlocks = 20 << (2 * patchLevel);
+	int numVertices = (int)coarse->getVertices().size();
+	blockEdges.resize(3 * numBlocks);
+	cornerOffsets.assign(numVertices + 1, 0);
+	corners.resize(3 * numBlocks);
+
+	// Each edge is found from the side running from its smaller end; the
+	// edge's other side, in the neighbor, runs the other way
+	std::vector<std::pair<long long, int>> sides;
+	sides.reserve(3 * numBlocks);
+	for (int b = 0; b < numBlocks; ++b) {
+		const Face& face = coarse->getFace(b);
+		for (int s = 0; s < 3; ++s) {
+			int from = face.vertices[s], to = face.vertices[(s + 1) % 3];
+			long long key = ((long long)std::min(from, to) << 32) + std::max(from, to);
+			sides.push_back(std::make_pair(key, 3 * b + s));
+			cornerOffsets[from + 1]++;
+		}
+	}
+	std::sort(sides.begin(), sides.end());
+	for (int e = 0; e < sides.size() / 2; ++e) {
+		long long key = sides[2 * e].first;
+		edgeVertices.push_back((int)(key >> 32));
+		edgeVertices.push_back((int)(key & 0xFFFFFFFF));
+		for (int k = 0; k < 2; ++k) {
+			int side = sides[2 * e + k].second;
+			int from = coarse->getFace(side / 3).vertices[side % 3];
+			edgeSides.push_back(side);
+			blockEdges[side] = 2 * e + (from == edgeVertices[2 * e] ? 0 : 1);
+		}
+	}
+
+	for (int v = 0; v < numVertices; ++v) cornerOffsets[v + 1] += cornerOffsets[v];
+	std::vector<int> fill(cornerOffsets.begin(), cornerOffsets.end() - 1);
+	for (int b = 0; b < numBlocks; ++b) {
+		for (int c = 0; c < 3; ++c) corners[fill[coarse->getFace(b).vertices[c]]++] = 3 * b + c;
+	}
+}
+
+// Lattice point t segments along a side from its first corner
+int OutOfCorePlanet::sideIndex(int side, int t) const {
+	switch (side) {
+	case 0: return latticeIndex(t, 0);
+	case 1: return latticeIndex(segments - t, t);
+	default: return latticeIndex(0, segments - t);
+	}
+}
+
+long long OutOfCorePlanet::getNumVertices() const {
+	long long inside = (long long)(segments - 1) * (segments - 2) / 2;
+	return (long long)coarse->getVertices().size() + (long long)(edgeVertices.size() / 2) * (segments - 1) + getNumBlocks() * inside;
+}
+
+long long OutOfCorePlanet::vertexId(int block, int i, int j) const {
+	int m = segments;
+	const Face& face = coarse->getFace(block);
+	if (j == 0 && i == 0) return face.vertices[0];
+	if (j == 0 && i == m) return face.vertices[1];
+	if (i == 0 && j == m) return face.vertices[2];
+
+	long long edgeStart = (long long)coarse->getVertices().size();
+	int side = -1, t = 0;
+	if (j == 0) side = 0, t = i;
+	else if (i + j == m) side = 1, t = j;
+	else if (i == 0) side = 2, t = m - j;
+	if (side >= 0) {
+		int edge = blockEdges[3 * block + side];
+		if (edge & 1) t = m - t;
+		return edgeStart + (long long)(edge >> 1) * (m - 1) + t - 1;
+	}
+
+	// Row i of the inside holds j = 1 to m - 1 - i
+	long long insideStart = edgeStart + (long long)(edgeVertices.size() / 2) * (m - 1);
+	long long inside = (long long)(m - 1) * (m - 2) / 2;
+	long long row = (long long)(i - 1) * (m - 1) - (long long)(i - 1) * i / 2;
+	return insideStart + block * inside + row + j - 1;
+}
+
+PlanetBlock OutOfCorePlanet::getBlock(int block) {
+	unsigned char* data = file.getData() + dataOffset + (size_t)block * blockStride;
+	PlanetBlock view;
+	view.positions = (Vec3*)data;
+	view.heights = (float*)(data + blockVertices * sizeof(Vec3));
+	view.normals = (Vec3*)(data + blockVertices * (sizeof(Vec3) + sizeof(float)));
+	view.border = (PlanetBorderVertex*)(file.getData() + bordersOffset + (size_t)block * borderBytes());
+	return view;
+}
+
+template <typename Func>
+bool OutOfCorePlanet::forBlocks(ThreadPool& pool, Func f) {
+	int batch = 16 * (pool.getThreadCount() + 1);
+	for (int first = 0; first < getNumBlocks(); first += batch) {
+		pool.parallelFor(first, std::min(first + batch, getNumBlocks()), 1, f);
+		if (!file.trim()) return false;
+	}
+	return true;
+}
+
+bool OutOfCorePlanet::generate(const std::string& path, const Terrain& terrain, ThreadPool& pool) {
+	TRACE_SCOPE_ARG("out-of-core planet", "level", level);
+	int numBlocks = getNumBlocks();
+	if (!file.create(path.c_str(), bordersOffset + (size_t)numBlocks * borderBytes())) return false;
+
+	seed = terrain.getSeed();
+	Header header = { MAGIC, 1, (uint32_t)level, (uint32_t)patchLevel, seed, radius, (uint32_t)numBlocks, (uint32_t)blockVertices, blockStride, dataOffset };
+	memcpy(file.getData(), &header, sizeof(header));
+
+	PerlinNoise noise = terrain.noise();
+	bool mapped = forBlocks(pool, [&](int block) {
+		std::vector<Vec3> displaced;
+		generateBlock(block, terrain, noise, displaced);
+		releaseBlock(block);
+	});
+	return mapped && stitch(pool) && file.flush();
+}
+
+// Midpoints are made level by level from the corners, as
+// Icosphere::subdivide() does, so the positions match the full icosphere
+// to the bit and both blocks along an edge make the same ones
+void OutOfCorePlanet::generateBlock(int block, const Terrain& terrain, const PerlinNoise& noise, std::vector<Vec3>& displaced) {
+	TRACE_SCOPE_ARG("planet block", "block", block);
+	int m = segments;
+	PlanetBlock view = getBlock(block);
+	Vec3* positions = view.positions;
+	const Face& face = coarse->getFace(block);
+	positions[latticeIndex(0, 0)] = coarse->getVertex(face.vertices[0]);
+	positions[latticeIndex(m, 0)] = coarse->getVertex(face.vertices[1]);
+	positions[latticeIndex(0, m)] = coarse->getVertex(face.vertices[2]);
+
+	auto midpoint = [&](int p, int q) {
+		Vec3 middle = (positions[p] * 0.5f + positions[q] * 0.5f).normalized();
+		return Vec3(middle * radius);
+	};
+	for (int s = m; s >= 2; s /= 2) {
+		int h = s / 2;
+		for (int i = 0; i + s <= m; i += s) {
+			for (int j = 0; i + j + s <= m; j += s) {
+				int a = latticeIndex(i, j), b = latticeIndex(i + s, j), c = latticeIndex(i, j + s);
+				positions[latticeIndex(i + h, j)] = midpoint(a, b);
+				positions[latticeIndex(i + h, j + h)] = midpoint(b, c);
+				positions[latticeIndex(i, j + h)] = midpoint(c, a);
+			}
+		}
+	}
+
+	displaced.resize(blockVertices);
+	for (int k = 0; k < blockVertices; ++k) {
+		view.heights[k] = terrain.height(noise, positions[k]);
+		displaced[k] = positions[k] + positions[k].normalized() * view.heights[k];
+		view.normals[k] = Vec3(0, 0, 0);
+	}
+
+	// Up triangles (i, j), (i + 1, j), (i, j + 1) and the down ones between
+	// them, both wound as the patch
+	auto addFace = [&](int a, int b, int c) {
+		Vec3 normal = (displaced[b] - displaced[a]).cross(displaced[c] - displaced[a]);
+		view.normals[a] += normal;
+		view.normals[b] += normal;
+		view.normals[c] += normal;
+	};
+	for (int i = 0; i < m; ++i) {
+		for (int j = 0; i + j < m; ++j) {
+			addFace(latticeIndex(i, j), latticeIndex(i + 1, j), latticeIndex(i, j + 1));
+			if (i + j + 1 < m) addFace(latticeIndex(i + 1, j), latticeIndex(i + 1, j + 1), latticeIndex(i, j + 1));
+		}
+	}
+
+	for (int i = 1; i < m; ++i) {
+		for (int j = 1; i + j < m; ++j) {
+			Vec3& normal = view.normals[latticeIndex(i, j)];
+			normal = normal.normalized();
+		}
+	}
+	// The border keeps its sums for stitch()
+	for (int side = 0; side < 3; ++side) {
+		for (int t = 0; t < m; ++t) {
+			int k = sideIndex(side, t);
+			PlanetBorderVertex vertex = { positions[k], view.heights[k], view.normals[k] };
+			view.border[side * m + t] = vertex;
+		}
+	}
+}
+
+bool OutOfCorePlanet::stitch(ThreadPool& pool) {
+	TRACE_SCOPE("stitch seams");
+	int m = segments;
+	int numEdges = (int)edgeVertices.size() / 2;
+	pool.parallelFor(0, numEdges, 64, [&](int e) {
+		int sides[2] = { edgeSides[2 * e], edgeSides[2 * e + 1] };
+		PlanetBorderVertex* border[2] = { getBlock(sides[0] / 3).border, getBlock(sides[1] / 3).border };
+		for (int t = 1; t < m; ++t) {
+			int at[2];
+			for (int k = 0; k < 2; ++k) {
+				bool reversed = blockEdges[sides[k]] & 1;
+				at[k] = (sides[k] % 3) * m + (reversed ? m - t : t);
+			}
+			Vec3 normal = (border[0][at[0]].normal + border[1][at[1]].normal).normalized();
+			border[0][at[0]].normal = normal;
+			border[1][at[1]].normal = normal;
+		}
+	});
+
+	int numCorners = (int)cornerOffsets.size() - 1;
+	pool.parallelFor(0, numCorners, 64, [&](int v) {
+		Vec3 sum(0, 0, 0);
+		for (int k = cornerOffsets[v]; k < cornerOffsets[v + 1]; ++k) {
+			sum += getBlock(corners[k] / 3).border[(corners[k] % 3) * m].normal;
+		}
+		Vec3 normal = sum.normalized();
+		for (int k = cornerOffsets[v]; k < cornerOffsets[v + 1]; ++k) {
+			getBlock(corners[k] / 3).border[(corners[k] % 3) * m].normal = normal;
+		}
+	});
+
+	bool mapped = forBlocks(pool, [&](int block) {
+		PlanetBlock view = getBlock(block);
+		for (int side = 0; side < 3; ++side) {
+			for (int t = 0; t < m; ++t) view.normals[sideIndex(side, t)] = view.border[side * m + t].normal;
+		}
+		releaseBlock(block);
+	});
+	releaseBorders();
+	return mapped && file.trim();
+}
+
+bool OutOfCorePlanet::open(const std::string& path) {
+	if (!file.open(path.c_str())) return false;
+	Header header;
+	bool valid = file.getSize() >= sizeof(header);
+	if (valid) memcpy(&header, file.getData(), sizeof(header));
+	valid = valid && header.magic == MAGIC && header.version == 1
+		&& header.level == (uint32_t)level && header.patchLevel == (uint32_t)patchLevel && header.radius == radius
+		&& header.blockVertices == (uint32_t)blockVertices && header.blockStride == blockStride
+		&& header.dataOffset == dataOffset && file.getSize() >= bordersOffset + (size_t)getNumBlocks() * borderBytes();
+	if (!valid) {
+		file.close();
+		return false;
+	}
+	seed = header.seed;
+	return true;
+}
+
+template <typename Func>
+void OutOfCorePlanet::forEachVertex(Func f) {
+	int m = segments;
+	int numVertices = (int)cornerOffsets.size() - 1;
+	for (int v = 0; v < numVertices; ++v) {
+		int corner = corners[cornerOffsets[v]];
+		const PlanetBorderVertex& vertex = getBlock(corner / 3).border[(corner % 3) * m];
+		f(vertex.position, vertex.height, vertex.normal);
+	}
+
+	int numEdges = (int)edgeVertices.size() / 2;
+	for (int e = 0; e < numEdges; ++e) {
+		int side = edgeSides[2 * e];
+		bool reversed = blockEdges[side] & 1;
+		const PlanetBorderVertex* border = getBlock(side / 3).border + (side % 3) * m;
+		for (int t = 1; t < m; ++t) {
+			const PlanetBorderVertex& vertex = border[reversed ? m - t : t];
+			f(vertex.position, vertex.height, vertex.normal);
+		}
+	}
+	releaseBorders();
+	if (!file.trim()) return;
+
+	for (int b = 0; b < getNumBlocks(); ++b) {
+		PlanetBlock view = getBlock(b);
+		for (int i = 1; i < m; ++i) {
+			for (int j = 1; i + j < m; ++j) {
+				int k = latticeIndex(i, j);
+				f(view.positions[k], view.heights[k], view.normals[k]);
+			}
+		}
+		releaseBlock(b);
+		if (!file.trim()) return;
+	}
+}
+
+template <typename Func>
+void OutOfCorePlanet::forEachTriangle(Func f) {
+	int m = segments;
+	for (int b = 0; b < getNumBlocks(); ++b) {
+		for (int i = 0; i < m; ++i) {
+			for (int j = 0; i + j < m; ++j) {
+				f(vertexId(b, i, j), vertexId(b, i + 1, j), vertexId(b, i, j + 1));
+				if (i + j + 1 < m) f(vertexId(b, i + 1, j), vertexId(b, i + 1, j + 1), vertexId(b, i, j + 1));
+			}
+		}
+	}
+}
+
+void OutOfCorePlanet::reportMemory(MemoryReport& report, const std::string& name) const {
+	coarse->reportMemory(report, name + "/patches");
+	report.add(name + "/seams", vectorBytes(edgeVertices) + vectorBytes(edgeSides) + vectorBytes(blockEdges)
+		+ vectorBytes(cornerOffsets) + vectorBytes(corners));
+}
+
+#endif
@@ -7,8 +7,12 @@
 #include <math.h> 
 #include "Noise.h"
 
+#include <functional>
+
 #include <OpenGP/GL/Eigen.h>
+#ifndef TERRAIN_HEADLESS
 #include "OpenGP/GL/Application.h"
+#endif
 
 using namespace OpenGP;
 
@@ -41,8 +45,10 @@ public:
 
     float eval(const Vec3& point) const override;
     float* perlin2D(int noiseType);
+#ifndef TERRAIN_HEADLESS
     R32FTexture* getNoiseTexture(int noiseType = 0);
     R32FTexture* convertNoiseToTexture(float* noise);
+#endif
 
 };
 
@@ -171,6 +177,7 @@ float* PerlinNoise::perlin2D(int noiseType) {
     return perlin_noise;
 }
 
+#ifndef TERRAIN_HEADLESS
 R32FTexture* PerlinNoise::getNoiseTexture(int noiseType) {
     R32FTexture* _tex = new R32FTexture();
 
@@ -189,5 +196,6 @@ R32FTexture* PerlinNoise::convertNoiseToTexture(float* noise) {
 
     return _tex;
 }
+#endif
 
 #endif
\ No newline at end of file
@@ -3,153 +3,140 @@
 
 #include "PerlinNoise.h"
 #include "Icosphere.h"
+#include "Terrain.h"
 #include "Water.h"
+#include "ScatterRenderer.h"
 #include "loadTexture.h"
+#include "ShaderSource.h"
+#include "FrameProfiler.h"
+#include "RenderStats.h"
 
 #include <OpenGP/GL/Eigen.h>
 #include "OpenGP/GL/Application.h"
 
 using namespace OpenGP;
 
-// This class defines a planet
+// This class defines a planet: the terrain generated on its icosphere plus
+// everything needed to draw it
 class Planet {
 private:
 	Icosphere* mesh = nullptr;
 	Water* water = nullptr;
+	Terrain terrain;
+	// Scratch of the terrain's generation passes, which run one at a time
+	Arena arena;
 
 	std::unique_ptr <RGBA8Texture> sandTexture;
 	std::unique_ptr <RGBA8Texture> grassTexture;
 	std::unique_ptr <RGBA8Texture> rockTexture;
 	std::unique_ptr <RGBA8Texture> snowTexture;
 
-	std::vector<Vec3> planetSurfaceNormals;
-	std::vector<float> heightMap;
-
 	std::unique_ptr<Shader> shader;
 	std::unique_ptr<GPUMesh> glMesh;
+	ScatterRenderer scatterRenderer;
+
+	// Buffers only change when the planet is regenerated or edited, so they
+	// are uploaded on the first draw after a regeneration, and edits update
+	// the ranges they touched
+	bool uploaded = false;
+	int numIndices = 0;
 
-	float smax(float a, float b, float t);
-	float lerp(float a, float b, float t);
+	void upload();
 
 public:
-	Planet(Icosphere* mesh);
+	// Generation is explicit (see generate()) so callers can schedule the
+	// height and normal passes themselves, e.g. on worker threads
+	Planet(Icosphere* mesh) : Planet(mesh, randomTerrainSeed()) {}
+	Planet(Icosphere* mesh, unsigned int seed);
 
 	void setMesh(Icosphere* mesh) { 
 		this->mesh = mesh; 
-		calcHeightMap();
-		calcSurfaceNormals();
+		terrain.setMesh(mesh);
+		generate();
 	}
 
 	Icosphere* getMesh() { return this->mesh;  }
-
-	void calcHeightMap();
-	std::vector<float> getHeightMap() { return this->heightMap; };
-
-	void calcSurfaceNormals();
-	std::vector<Vec3> getSurfaceNormals() { return this->planetSurfaceNormals; }
-
-	void init();
-	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp);
-
-	std::string load_source(const char* fname) {
-		std::ifstream f(fname);
-		std::stringstream buffer;
-		buffer << f.rdbuf();
-		return buffer.str();
+	Terrain& getTerrain() { return this->terrain; }
+	// Swaps in a mesh and the terrain generated for it elsewhere, e.g. by a
+	// PlanetRefiner. The planet does not own the mesh
+	void setSurface(Icosphere* mesh, Terrain terrain) {
+		this->mesh = mesh;
+		this->terrain = std::move(terrain);
+		this->terrain.setArena(&arena);
+		uploaded = false;
 	}
-};
-
-Planet::Planet(Icosphere* mesh) {
-	this->mesh = mesh;
-	water = new Water(mesh->getRadius() * 1.02, mesh->getCenter(), 5);
-
-	sandTexture = std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
-	grassTexture = std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
-	rockTexture = std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
-	snowTexture =std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
 
-	calcHeightMap();
-	calcSurfaceNormals();
-}
+	// Swaps in a terrain generated elsewhere, e.g. by a TerrainTuner; it is
+	// uploaded on the next draw
+	void setTerrain(Terrain terrain) {
+		this->terrain = std::move(terrain);
+		this->terrain.setArena(&arena);
+		uploaded = false;
+	}
 
-float Planet::smax(float a, float b, float t) {
-	return log(exp(a * t) + exp(a * t) - 1.0f) / t;
-}
+	// The planet's ocean; optional, drawn after the terrain
+	void setWater(Water* water) { this->water = water; }
+	Water* getWater() { return this->water; }
 
-float Planet::lerp(float a, float b, float t) {
-	return a * t + (1 - t) * b;
-}
+	// Keeps a single copy of what the planet needs once uploaded: the mesh
+	// derives its UVs again if they are needed, and the terrain rebuilds
+	// its vertex graph on the next edit
+	void compact() {
+		mesh->compact();
+		terrain.compact();
+	}
+	// The mesh, the terrain and its generation scratch, and the water
+	void reportMemory(MemoryReport& report) const;
 
-void Planet::calcHeightMap() {
-	std::random_device rd;
-	std::default_random_engine e1(rd());
-	std::uniform_int_distribution<int> seed(0, 100000);
-	PerlinNoise noise = PerlinNoise(2048, 2048, 8, 2, 0.9, 0.0, 512, seed(rd));
-	float period = 20.0f;
+	void generate() {
+		terrain.generate();
+		uploaded = false;
+	}
 
-	std::vector<Vec3> vertices = mesh->getVertices();
+	void calcHeightMap() {
+		terrain.calcHeightMap();
+		uploaded = false;
+	}
+	const std::vector<float>& getHeightMap() const { return terrain.getHeightMap(); }
 
+	void calcSurfaceNormals() {
+		terrain.calcSurfaceNormals();
+		uploaded = false;
+	}
+	const std::vector<Vec3>& getSurfaceNormals() const { return terrain.getSurfaceNormals(); }
 
-	for (int i = 0; i < vertices.size(); ++i) {
-		Vec3 coord = vertices[i];
-		float perlin_noise = noise.fBm(coord / period);
-		float continent = noise.hybridMultifractal(coord / period) * 0.2;
+	// The terrain under a direction from the planet center or a latitude and
+	// longitude, e.g. for collisions and placing objects; see Terrain::sample()
+	TerrainSample sampleSurface(Vec3 direction) const { return terrain.sample(direction); }
+	TerrainSample sampleSurface(float latitude, float longitude) const {
+		return terrain.sample(directionFromLatLong(latitude, longitude));
+	}
+	void sampleSurface(const std::vector<Vec3>& directions, std::vector<TerrainSample>& samples, ThreadPool& pool) const {
+		terrain.sample(directions, samples, pool);
+	}
 
-		if (perlin_noise > -0.1f) {
-			perlin_noise += lerp(0, continent, perlin_noise);
-		}
+	// Sculpts the terrain and uploads only the heights and normals that
+	// changed. Before the first draw this only edits the terrain
+	TerrainEdit applyBrush(const Brush& brush);
 
-		if (perlin_noise > 0.4) {
-			perlin_noise += lerp(0.0, 0.3, (perlin_noise - 0.4));
-		}
+	void init();
+	// seconds is the scene time, which moves the water's waves
+	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds);
 
-		heightMap.push_back(perlin_noise * powf(mesh->getRadius(), 0.5));
+	std::string load_source(const char* fname) {
+		return loadShaderSource(fname);
 	}
-}
+};
 
-void Planet::calcSurfaceNormals() {
-	std::vector<Face> faces = mesh->getFaces();
-	std::vector<Vec3> vertices = mesh->getVertices();
-	std::vector<Vec3> vnormals = mesh->getVertexNormals();
+Planet::Planet(Icosphere* mesh, unsigned int seed) : terrain(mesh, seed) {
+	this->mesh = mesh;
+	terrain.setArena(&arena);
+}
 
-	for (int i = 0; i < vertices.size(); ++i) {
-		Vec3 avg = Vec3(0, 0, 0);
-		int num = 0;
-		for (int j = 0; j < faces.size(); ++j) {
-			int a = faces[j].vertices[0];
-			int b = faces[j].vertices[1];
-			int c = faces[j].vertices[2];
-
-			if (a == i) {
-				Vec3 tempA = vertices[a] + vnormals[a] * heightMap[a];
-				Vec3 tempB = (vertices[b] + vnormals[b] * heightMap[b]);
-				Vec3 tempC = (vertices[c] + vnormals[c] * heightMap[c]);
-				avg += (tempB - tempA).cross(tempC - tempA);
-				num++;
-			}
-
-			if (b == i) {
-				Vec3 tempA = vertices[a] + vnormals[a] * heightMap[a];
-				Vec3 tempB = (vertices[b] + vnormals[b] * heightMap[b]);
-				Vec3 tempC = (vertices[c] + vnormals[c] * heightMap[c]);
-				avg += (tempB - tempA).cross(tempC - tempA);
-				num++;
-			}
-
-			if (c == i) {
-				Vec3 tempA = vertices[a] + vnormals[a] * heightMap[a];
-				Vec3 tempB = (vertices[b] + vnormals[b] * heightMap[b]);
-				Vec3 tempC = (vertices[c] + vnormals[c] * heightMap[c]);
-				avg += (tempB - tempA).cross(tempC - tempA);
-				num++;
-			}
-		}
-
-		avg /= (float)num;
-		avg = avg.normalized();
-
-		planetSurfaceNormals.push_back(avg);
-	}
+void Planet::reportMemory(MemoryReport& report) const {
+	mesh->reportMemory(report, "planet/mesh");
+	terrain.reportMemory(report, "planet/terrain");
+	if (water != nullptr) water->reportMemory(report, "water");
 }
 
 void Planet::init() {
@@ -161,55 +148,65 @@ void Planet::init() {
 	shader->add_fshader_from_source(load_source("Shaders/terrain_fshader.glsl").c_str());
 	shader->link();
 
-	water->init();
+	if (water != nullptr) water->init();
+	scatterRenderer.init();
 
-	loadTexture(sandTexture, "sand.png");
-	sandTexture->bind();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	loadMipmappedTexture(sandTexture, "sand.png");
+	loadMipmappedTexture(grassTexture, "grass.png");
+	loadMipmappedTexture(rockTexture, "rock.png");
+	loadMipmappedTexture(snowTexture, "snow.png");
+}
 
-	loadTexture(grassTexture, "grass.png");
-	grassTexture->bind();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+void Planet::upload() {
+	ProfileScope scope("planet upload");
+	std::vector<unsigned int> triangle_indices = mesh->genMesh();
+	const std::vector<Vec3>& vertices = mesh->getVertices();
+	std::vector<Vec3> vnormals = mesh->getVertexNormals();
 
+	uploadVbo<Vec3>(*glMesh, "vposition", vertices);
+	uploadVbo<Vec3>(*glMesh, "vnormal", vnormals);
+	if (mesh->isCompact()) uploadTexcoords(*glMesh, mesh->deriveUvs());
+	else uploadTexcoords(*glMesh, mesh->getUvs());
+	uploadTriangles(*glMesh, triangle_indices);
+	uploadVbo<float>(*glMesh, "vheight", terrain.getHeightMap());
+	uploadVbo<Vec3>(*glMesh, "vsurfacenormal", terrain.getSurfaceNormals());
+	numIndices = triangle_indices.size();
+
+	// Without a hydrology pass there are no rivers or lakes to draw
+	const Hydrology& hydrology = terrain.getHydrology();
+	bool wet = !hydrology.empty() && hydrology.getRiverFlow().size() == vertices.size();
+	std::vector<float> dry(wet ? 0 : vertices.size(), 0.0f);
+	uploadVbo<float>(*glMesh, "vriver", wet ? hydrology.getRiverFlow() : dry);
+	uploadVbo<float>(*glMesh, "vlake", wet ? hydrology.getLakeDepth() : dry);
+
+	scatterRenderer.setScatters(terrain.getScatters(), mesh->getCenter(), mesh->getRadius());
+	if (water != nullptr) water->setSeabed(terrain);
+	uploaded = true;
+}
 
-	loadTexture(rockTexture, "rock.png");
-	rockTexture->bind();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+TerrainEdit Planet::applyBrush(const Brush& brush) {
+	TerrainEdit edit = terrain.applyBrush(brush);
+	if (!uploaded) return edit;
 
-	loadTexture(snowTexture, "snow.png");
-	snowTexture->bind();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	ProfileScope scope("planet upload");
+	std::vector<VertexRange> heights = vertexRanges(edit.heights);
+	for (int i = 0; i < heights.size(); ++i) {
+		updateVbo<float>(*glMesh, "vheight", terrain.getHeightMap(), heights[i].first, heights[i].count);
+	}
+	std::vector<VertexRange> normals = vertexRanges(edit.normals);
+	for (int i = 0; i < normals.size(); ++i) {
+		updateVbo<Vec3>(*glMesh, "vsurfacenormal", terrain.getSurfaceNormals(), normals[i].first, normals[i].count);
+	}
+
+	if (water != nullptr) water->updateSeabed(terrain, edit);
+	return edit;
 }
 
-void Planet::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
-	std::vector<unsigned int> triangle_indices = mesh->genMesh();
-	std::vector<Vec3> vertices = mesh->getVertices();
-	std::vector<Vec3> vnormals = mesh->getVertexNormals();
-	std::vector<Vec2> uvs = mesh->getUvs();
+void Planet::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds) {
+	if (!uploaded) upload();
 
 	float radius = mesh->getRadius();
 
-	glMesh->set_vbo<Vec3>("vposition", vertices);
-	glMesh->set_vbo<Vec3>("vnormal", vnormals);
-	glMesh->set_vtexcoord(uvs);
-	glMesh->set_triangles(triangle_indices);
-
 	shader->bind();
 
 	shader->set_uniform("radius", radius);
@@ -227,9 +224,6 @@ void Planet::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
 	Mat4x4 P = perspective(fov, SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.01f, 100.0f);
 	shader->set_uniform("P", P);
 
-	glMesh->set_vbo<float>("vheight", heightMap);
-	glMesh->set_vbo<Vec3>("vsurfacenormal", planetSurfaceNormals);
-
 	glActiveTexture(GL_TEXTURE0);
 	sandTexture->bind();
 	shader->set_uniform("snad", 0);
@@ -258,11 +252,17 @@ void Planet::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); 
 
 	glMesh->set_attributes(*shader);
-	glMesh->draw();
+	drawMesh(*glMesh, numIndices);
 
 	shader->unbind();
 
-	water->draw(fov, cameraPos, cameraFront, cameraUp, heightMap, vertices, vnormals);
+	{
+		ProfileScope scope("scatter");
+		scatterRenderer.draw(fov, cameraPos, cameraFront, cameraUp);
+	}
+
+	ProfileScope scope("water");
+	if (water != nullptr) water->draw(fov, cameraPos, cameraFront, cameraUp, seconds);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#ifndef PLANETREFINER_H_
+#define PLANETREFINER_H_
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+
+#include "Icosphere.h"
+#include "Terrain.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// One resolution of a planet: its mesh and the terrain generated on it
+struct PlanetRefinement {
+	int level;
+	int octaves;
+	std::unique_ptr<Icosphere> mesh;
+	std::unique_ptr<Terrain> terrain;
+};
+
+// Progressive generation: the planet is shown right away at a coarse level
+// with few octaves, and refined level by level on a worker, each level with
+// more octaves, until it reaches the full level and octave count. Every
+// step is a complete planet the renderer swaps in with takeResult()
+class PlanetRefiner {
+private:
+	ThreadPool& pool;
+	Vec3 center;
+	float radius;
+	unsigned int seed;
+	TerrainParams params;
+	TerrainStages stages;
+
+	// (level, octaves) of the steps still to generate
+	std::vector<std::pair<int, int>> steps;
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	bool running = false;
+	std::atomic<bool> cancelled;
+	std::unique_ptr<PlanetRefinement> ready;
+	int remaining;
+
+	void run();
+public:
+	PlanetRefiner(ThreadPool& pool, Vec3 center, float radius, unsigned int seed, const TerrainParams& params);
+	// Stops after the step being generated
+	~PlanetRefiner();
+
+	PlanetRefiner(const PlanetRefiner&) = delete;
+	PlanetRefiner& operator=(const PlanetRefiner&) = delete;
+
+	// The first step, coarse enough to generate within a frame at startup
+	static int coarseLevel(int level) { return std::min(level, 2); }
+	static int coarseOctaves(int octaves) { return std::min(octaves, 3); }
+
+	// Passes run on every step; call before start()
+	void setStages(const TerrainStages& stages) { this->stages = stages; }
+
+	// Generates the steps from coarseLevel(level) + 1 up to level in the
+	// background; octaves grow with the level and reach params.octaves at
+	// the last one
+	void start(int level);
+
+	// The newest finished step, or null if none finished since the last call
+	std::unique_ptr<PlanetRefinement> takeResult();
+	// Whether every step has been generated and taken
+	bool finished();
+};
+
+PlanetRefiner::PlanetRefiner(ThreadPool& pool, Vec3 center, float radius, unsigned int seed, const TerrainParams& params) : pool(pool) {
+	this->center = center;
+	this->radius = radius;
+	this->seed = seed;
+	this->params = params;
+	this->cancelled = false;
+	this->remaining = 0;
+}
+
+PlanetRefiner::~PlanetRefiner() {
+	cancelled = true;
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return !running; });
+}
+
+void PlanetRefiner::start(int level) {
+	int first = coarseLevel(level);
+	int octaves = coarseOctaves(params.octaves);
+	for (int l = first + 1; l <= level; ++l) {
+		int stepOctaves = octaves + (params.octaves - octaves) * (l - first) / (level - first);
+		steps.push_back(std::make_pair(l, stepOctaves));
+	}
+	// Already at the full level, but with few octaves
+	if (steps.empty() && octaves < params.octaves) steps.push_back(std::make_pair(level, params.octaves));
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		remaining = steps.size();
+		if (steps.empty()) return;
+		running = true;
+	}
+	pool.submit([this]() { run(); });
+}
+
+void PlanetRefiner::run() {
+	// Scratch of every step's subdivision and generation, reused by the next
+	Arena arena;
+	for (int i = 0; i < steps.size() && !cancelled; ++i) {
+		TRACE_SCOPE_ARG("refine planet", "level", steps[i].first);
+		std::unique_ptr<PlanetRefinement> step(new PlanetRefinement());
+		step->level = steps[i].first;
+		step->octaves = steps[i].second;
+		step->mesh = std::unique_ptr<Icosphere>(new Icosphere(center, radius, step->level, &arena));
+
+		TerrainParams stepParams = params;
+		stepParams.octaves = step->octaves;
+		step->terrain = std::unique_ptr<Terrain>(new Terrain(step->mesh.get(), seed));
+		step->terrain->setParams(stepParams);
+		step->terrain->setArena(&arena);
+		step->terrain->generate(stages, pool);
+		step->terrain->setArena(nullptr);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		// A newer step replaces one the renderer has not taken yet
+		ready = std::move(step);
+		remaining = steps.size() - i - 1;
+	}
+
+	// Notified under the lock: the destructor may run as soon as it is
+	// released
+	std::lock_guard<std::mutex> lock(mutex);
+	running = false;
+	idle.notify_all();
+}
+
+std::unique_ptr<PlanetRefinement> PlanetRefiner::takeResult() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return std::move(ready);
+}
+
+bool PlanetRefiner::finished() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return remaining == 0 && !ready;
+}
+
+#endif
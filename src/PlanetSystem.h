@@ -0,0 +1,386 @@
+#ifndef PLANETSYSTEM_H_
+#define PLANETSYSTEM_H_
+
+#include <map>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Icosphere.h"
+#include "Terrain.h"
+#include "MemoryReport.h"
+#include "ThreadPool.h"
+#include "loadTexture.h"
+#include "ShaderSource.h"
+#include "RenderStats.h"
+#include "FrameProfiler.h"
+#include "Frustum.h"
+
+#include <OpenGP/GL/Eigen.h>
+#include "OpenGP/GL/Application.h"
+
+using namespace OpenGP;
+
+// A planet or moon on a circular orbit around the origin
+struct SystemBody {
+	// Subdivision level of its mesh; bodies of a level share one
+	int level = 4;
+	float radius = 10.0f;
+	unsigned int seed = 0;
+	float orbitRadius = 200.0f;
+	// Seconds per revolution, and the angle the body starts at
+	float orbitPeriod = 300.0f;
+	float orbitPhase = 0.0f;
+	// Normal of the orbit's plane
+	Vec3 orbitAxis = Vec3(0, 0, 1);
+};
+
+// Planets and moons around the main planet, drawn as a layer behind it.
+// Terrains are generated at one radius on one icosphere per level, and
+// drawn scaled to their body's radius, so bodies of a level share the
+// vertices, normals, texture coordinates and indices on the GPU; a body only
+// adds its height and surface normal streams, bound with the shared ones in
+// a vertex array object of its own. The CPU terrains are dropped once
+// uploaded.
+//
+// Close bodies are drawn in one pass with the terrain shader and textures
+// bound once. Bodies smaller than impostorPixels on screen are drawn as lit
+// discs, all in one instanced draw
+class PlanetSystem {
+private:
+	// Geometry shared by the bodies of a level
+	struct SharedSphere {
+		std::unique_ptr<Icosphere> mesh;
+		std::unique_ptr<ArrayBuffer<Vec3>> positions;
+		std::unique_ptr<ArrayBuffer<Vec3>> normals;
+		std::unique_ptr<ArrayBuffer<Vec2>> uvs;
+		std::unique_ptr<ElementArrayBuffer<unsigned int>> indices;
+		int numIndices = 0;
+	};
+
+	struct Body {
+		SystemBody orbit;
+		std::unique_ptr<Terrain> terrain;
+		// Surface extent relative to the radius, for culling, and the mean
+		// color the impostor is drawn with
+		float extent = 1.0f;
+		Vec3 albedo = Vec3(0.5f, 0.5f, 0.5f);
+
+		std::unique_ptr<VertexArrayObject> vao;
+		std::unique_ptr<ArrayBuffer<float>> heights;
+		std::unique_ptr<ArrayBuffer<Vec3>> surfaceNormals;
+		Vec3 position = Vec3(0, 0, 0);
+	};
+
+	// Instance data of an impostor, as the shader reads it
+	struct Impostor {
+		float x, y, z;
+		float radius;
+	};
+
+	float generationRadius;
+	std::map<int, SharedSphere> spheres;
+	std::vector<Body> bodies;
+	// Uploaded by init()
+	long long sharedBytes = 0;
+	long long bodyBytes = 0;
+
+	std::unique_ptr<Shader> shader;
+	std::unique_ptr<Shader> impostorShader;
+	std::unique_ptr<GPUMesh> impostorMesh;
+	std::vector<Impostor> impostors;
+	std::vector<Vec3> impostorAlbedos;
+
+	std::unique_ptr<RGBA8Texture> sandTexture;
+	std::unique_ptr<RGBA8Texture> grassTexture;
+	std::unique_ptr<RGBA8Texture> rockTexture;
+	std::unique_ptr<RGBA8Texture> snowTexture;
+
+	static Vec3 materialColor(TerrainMaterial material);
+	Vec3 orbitPosition(const SystemBody& orbit, float time) const;
+	void drawBodies(const std::vector<int>& visible, const Mat4x4& V, const Mat4x4& P, Vec3 cameraPos);
+	void drawImpostors(const std::vector<int>& visible, const Mat4x4& V, const Mat4x4& P);
+public:
+	// Bodies smaller than this on screen, in pixels, are drawn as impostors
+	float impostorPixels = 24.0f;
+
+	// generationRadius is the radius the terrains are generated at, which
+	// sets how rugged they are
+	PlanetSystem(const std::vector<SystemBody>& bodies, float generationRadius);
+
+	// count bodies on orbits from innerOrbit outwards, with sizes, levels
+	// and seeds drawn from seed
+	static std::vector<SystemBody> randomSystem(int count, unsigned int seed, float innerOrbit);
+
+	// Builds the shared meshes and generates every terrain, split over the
+	// pool; safe to run on a worker
+	void generate(ThreadPool& pool);
+	// Uploads the shared and per-body buffers, then frees the CPU terrains
+	void init();
+
+	int numBodies() const { return bodies.size(); }
+	// The GPU buffers of the shared meshes and of the bodies; the CPU
+	// copies are gone after init()
+	void reportMemory(MemoryReport& report) const {
+		report.add("system/shared meshes", (size_t)sharedBytes);
+		report.add("system/bodies", (size_t)bodyBytes);
+	}
+
+	// seconds is the scene time, which moves the bodies along their orbits
+	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds);
+};
+
+PlanetSystem::PlanetSystem(const std::vector<SystemBody>& bodies, float generationRadius) {
+	this->generationRadius = generationRadius;
+	this->bodies.resize(bodies.size());
+	for (int i = 0; i < bodies.size(); ++i) this->bodies[i].orbit = bodies[i];
+}
+
+std::vector<SystemBody> PlanetSystem::randomSystem(int count, unsigned int seed, float innerOrbit) {
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<SystemBody> bodies(count);
+	float orbit = innerOrbit;
+	for (int i = 0; i < count; ++i) {
+		SystemBody& body = bodies[i];
+		body.radius = 4.0f + 26.0f * unit(generator) * unit(generator);
+		// Small bodies rarely cover enough of the screen to need the detail
+		body.level = body.radius > 15.0f ? 5 : 4;
+		body.seed = generator();
+		orbit += 2.0f * body.radius + 20.0f + 40.0f * unit(generator);
+		body.orbitRadius = orbit;
+		body.orbitPeriod = 60.0f * std::pow(orbit / innerOrbit, 1.5f);
+		body.orbitPhase = 2.0f * (float)M_PI * unit(generator);
+		float tilt = 0.15f * (unit(generator) - 0.5f);
+		body.orbitAxis = Vec3(std::sin(tilt), 0, std::cos(tilt));
+		orbit += 2.0f * body.radius;
+	}
+	return bodies;
+}
+
+void PlanetSystem::generate(ThreadPool& pool) {
+	TRACE_SCOPE("planet system");
+	for (const Body& body : bodies) {
+		SharedSphere& sphere = spheres[body.orbit.level];
+		if (!sphere.mesh) sphere.mesh = std::unique_ptr<Icosphere>(new Icosphere(Vec3(0, 0, 0), generationRadius, body.orbit.level));
+	}
+
+	pool.parallelFor(0, (int)bodies.size(), 1, [&](int i) {
+		Body& body = bodies[i];
+		Icosphere* mesh = spheres.at(body.orbit.level).mesh.get();
+		body.terrain = std::unique_ptr<Terrain>(new Terrain(mesh, body.orbit.seed));
+		Arena arena;
+		body.terrain->setArena(&arena);
+		body.terrain->generate();
+		body.terrain->setArena(nullptr);
+
+		// The share of each material, as terrain_fshader picks them
+		const std::vector<float>& heights = body.terrain->getHeightMap();
+		const std::vector<Vec3>& normals = body.terrain->getSurfaceNormals();
+		std::vector<Vec3> directions = mesh->getVertexNormals();
+		Vec3 sum(0, 0, 0);
+		float highest = 0;
+		for (int v = 0; v < heights.size(); ++v) {
+			float slope = normals[v].dot(directions[v]);
+			sum += materialColor(terrainMaterial(heights[v], slope, generationRadius));
+			highest = std::max(highest, heights[v]);
+		}
+		body.albedo = sum / (float)std::max((int)heights.size(), 1);
+		body.extent = 1.0f + highest / generationRadius;
+	});
+}
+
+// Mean colors of the terrain textures
+Vec3 PlanetSystem::materialColor(TerrainMaterial material) {
+	switch (material) {
+	case MATERIAL_SAND: return Vec3(0.76f, 0.7f, 0.5f);
+	case MATERIAL_GRASS: return Vec3(0.3f, 0.45f, 0.2f);
+	case MATERIAL_ROCK: return Vec3(0.45f, 0.42f, 0.4f);
+	default: return Vec3(0.92f, 0.93f, 0.95f);
+	}
+}
+
+void PlanetSystem::init() {
+	ProfileScope scope("planet system upload");
+	shader = std::unique_ptr<Shader>(new Shader());
+	shader->verbose = true;
+	shader->add_vshader_from_source(loadShaderSource("Shaders/terrain_vshader.glsl").c_str());
+	shader->add_fshader_from_source(loadShaderSource("Shaders/terrain_fshader.glsl").c_str());
+	shader->link();
+
+	impostorShader = std::unique_ptr<Shader>(new Shader());
+	impostorShader->verbose = true;
+	impostorShader->add_vshader_from_source(loadShaderSource("Shaders/impostor_vshader.glsl").c_str());
+	impostorShader->add_fshader_from_source(loadShaderSource("Shaders/impostor_fshader.glsl").c_str());
+	impostorShader->link();
+
+	loadMipmappedTexture(sandTexture, "sand.png");
+	loadMipmappedTexture(grassTexture, "grass.png");
+	loadMipmappedTexture(rockTexture, "rock.png");
+	loadMipmappedTexture(snowTexture, "snow.png");
+
+	sharedBytes = 0;
+	bodyBytes = 0;
+	for (auto& pair : spheres) {
+		SharedSphere& sphere = pair.second;
+		std::vector<Vec3> vertices = sphere.mesh->getVertices();
+		std::vector<Vec3> normals = sphere.mesh->getVertexNormals();
+		const std::vector<Vec2>& uvs = sphere.mesh->getUvs();
+		std::vector<unsigned int> indices = sphere.mesh->genMesh();
+
+		sphere.positions = std::unique_ptr<ArrayBuffer<Vec3>>(new ArrayBuffer<Vec3>());
+		sphere.normals = std::unique_ptr<ArrayBuffer<Vec3>>(new ArrayBuffer<Vec3>());
+		sphere.uvs = std::unique_ptr<ArrayBuffer<Vec2>>(new ArrayBuffer<Vec2>());
+		sphere.indices = std::unique_ptr<ElementArrayBuffer<unsigned int>>(new ElementArrayBuffer<unsigned int>());
+		sphere.positions->upload(vertices);
+		sphere.normals->upload(normals);
+		sphere.uvs->upload(uvs);
+		sphere.indices->upload(indices);
+		sphere.numIndices = indices.size();
+		sharedBytes += vertices.size() * (2 * sizeof(Vec3) + sizeof(Vec2)) + indices.size() * sizeof(unsigned int);
+	}
+
+	shader->bind();
+	for (Body& body : bodies) {
+		SharedSphere& sphere = spheres[body.orbit.level];
+		body.heights = std::unique_ptr<ArrayBuffer<float>>(new ArrayBuffer<float>());
+		body.surfaceNormals = std::unique_ptr<ArrayBuffer<Vec3>>(new ArrayBuffer<Vec3>());
+		body.heights->upload(body.terrain->getHeightMap());
+		body.surfaceNormals->upload(body.terrain->getSurfaceNormals());
+		bodyBytes += body.heights->size() * (sizeof(float) + sizeof(Vec3));
+
+		// Rivers and lakes are not drawn on bodies: their attributes stay
+		// disabled and read as 0
+		body.vao = std::unique_ptr<VertexArrayObject>(new VertexArrayObject());
+		body.vao->bind();
+		shader->set_attribute("vposition", *sphere.positions);
+		shader->set_attribute("vnormal", *sphere.normals);
+		shader->set_attribute("vtexcoord", *sphere.uvs);
+		shader->set_attribute("vheight", *body.heights);
+		shader->set_attribute("vsurfacenormal", *body.surfaceNormals);
+		sphere.indices->bind();
+		body.vao->unbind();
+		body.terrain.reset();
+	}
+	shader->unbind();
+	renderStats().bytesUploaded += sharedBytes + bodyBytes;
+
+	// A quad the impostor shader turns into a disc facing the camera
+	impostorMesh = std::unique_ptr<GPUMesh>(new GPUMesh());
+	std::vector<Vec2> corners = { Vec2(-1, -1), Vec2(1, -1), Vec2(1, 1), Vec2(-1, 1) };
+	uploadVbo<Vec2>(*impostorMesh, "vcorner", corners);
+	uploadTriangles(*impostorMesh, { 0, 1, 2, 0, 2, 3 });
+	impostorMesh->set_vbo_raw<Vec4>("vbody", nullptr, 0, 1);
+	impostorMesh->set_vbo_raw<Vec3>("valbedo", nullptr, 0, 1);
+	impostorMesh->set_attributes(*impostorShader);
+
+	for (auto& pair : spheres) pair.second.mesh.reset();
+}
+
+Vec3 PlanetSystem::orbitPosition(const SystemBody& orbit, float time) const {
+	Vec3 axis = orbit.orbitAxis.normalized();
+	Vec3 side = std::abs(axis[0]) < 0.9f ? Vec3(1, 0, 0) : Vec3(0, 1, 0);
+	Vec3 u = axis.cross(side).normalized();
+	Vec3 v = axis.cross(u);
+	float angle = orbit.orbitPhase + 2.0f * (float)M_PI * time / orbit.orbitPeriod;
+	return orbit.orbitRadius * (std::cos(angle) * u + std::sin(angle) * v);
+}
+
+void PlanetSystem::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds) {
+	if (bodies.empty()) return;
+	float time = (float)seconds;
+
+	// The bodies are far, so the near plane can be too
+	Vec3 target = cameraPos + cameraFront;
+	Mat4x4 V = lookAt(cameraPos, target, cameraUp);
+	Mat4x4 P = perspective(fov, SCREEN_WIDTH / (float)SCREEN_HEIGHT, 1.0f, 5000.0f);
+	Frustum frustum(P * V);
+	float pixelsPerUnit = 0.5f * SCREEN_HEIGHT / std::tan(0.5f * fov * (float)M_PI / 180.0f);
+
+	std::vector<int> detailed, distant;
+	for (int i = 0; i < bodies.size(); ++i) {
+		Body& body = bodies[i];
+		body.position = orbitPosition(body.orbit, time);
+		float bound = body.orbit.radius * body.extent;
+		if (!frustum.intersectsSphere(body.position, bound)) continue;
+
+		float distance = (body.position - cameraPos).norm();
+		if (distance > bound && body.orbit.radius / distance * pixelsPerUnit < impostorPixels) distant.push_back(i);
+		else detailed.push_back(i);
+	}
+
+	drawBodies(detailed, V, P, cameraPos);
+	drawImpostors(distant, V, P);
+}
+
+void PlanetSystem::drawBodies(const std::vector<int>& visible, const Mat4x4& V, const Mat4x4& P, Vec3 cameraPos) {
+	if (visible.empty()) return;
+
+	shader->bind();
+	shader->set_uniform("radius", generationRadius);
+	shader->set_uniform("viewer", cameraPos);
+	shader->set_uniform("V", V);
+	shader->set_uniform("P", P);
+
+	glActiveTexture(GL_TEXTURE0);
+	sandTexture->bind();
+	shader->set_uniform("sand", 0);
+	glActiveTexture(GL_TEXTURE1);
+	grassTexture->bind();
+	shader->set_uniform("grass", 1);
+	glActiveTexture(GL_TEXTURE2);
+	rockTexture->bind();
+	shader->set_uniform("rock", 2);
+	glActiveTexture(GL_TEXTURE3);
+	snowTexture->bind();
+	shader->set_uniform("snow", 3);
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+
+	for (int i : visible) {
+		Body& body = bodies[i];
+		float scale = body.orbit.radius / generationRadius;
+		Mat4x4 M = Mat4x4::Identity();
+		M.block<3, 3>(0, 0) *= scale;
+		M.block<3, 1>(0, 3) = body.position;
+		shader->set_uniform("M", M);
+		shader->set_uniform("center", body.position);
+
+		body.vao->bind();
+		drawTriangles(spheres.at(body.orbit.level).numIndices);
+	}
+	glBindVertexArray(0);
+	shader->unbind();
+}
+
+void PlanetSystem::drawImpostors(const std::vector<int>& visible, const Mat4x4& V, const Mat4x4& P) {
+	if (visible.empty()) return;
+
+	impostors.resize(visible.size());
+	impostorAlbedos.resize(visible.size());
+	for (int k = 0; k < visible.size(); ++k) {
+		const Body& body = bodies[visible[k]];
+		impostors[k] = { body.position[0], body.position[1], body.position[2], body.orbit.radius };
+		impostorAlbedos[k] = body.albedo;
+	}
+	impostorMesh->set_vbo_raw<Vec4>("vbody", impostors.data(), impostors.size(), 1);
+	impostorMesh->set_vbo_raw<Vec3>("valbedo", impostorAlbedos.data(), impostorAlbedos.size(), 1);
+	renderStats().bytesUploaded += (long long)(visible.size() * (sizeof(Impostor) + sizeof(Vec3)));
+
+	impostorShader->bind();
+	impostorShader->set_uniform("V", V);
+	impostorShader->set_uniform("P", P);
+	Vec4 light = V * Vec4(50.0f, -50.0f, 200.0f, 1.0f);
+	impostorShader->set_uniform("lightPos", Vec3(light.head<3>()));
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	drawMeshInstanced(*impostorMesh, 6, visible.size());
+	impostorShader->unbind();
+}
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef RASTEREXPORT_H_
+#define RASTEREXPORT_H_
+
+#include <cmath>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "Terrain.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+enum RasterFormat {
+	// Heights scaled to [0, 65535] between minHeight and maxHeight, normal
+	// components from [-1, 1]
+	RASTER_UINT16,
+	RASTER_FLOAT32
+};
+
+// Cube faces in the order and orientation of GL cube maps
+enum RasterCubeFace {
+	RASTER_POSITIVE_X = 0,
+	RASTER_NEGATIVE_X,
+	RASTER_POSITIVE_Y,
+	RASTER_NEGATIVE_Y,
+	RASTER_POSITIVE_Z,
+	RASTER_NEGATIVE_Z,
+	RASTER_CUBE_FACES
+};
+
+struct RasterExportParams {
+	RasterFormat format = RASTER_UINT16;
+	int tileSize = 256;
+	// Range of 16-bit height maps; when empty, +-2 sqrt(radius), which holds
+	// every height calcHeightMap() makes
+	float minHeight = 0.0f;
+	float maxHeight = 0.0f;
+};
+
+// Which image a tile belongs to: an equirectangular map, width = 2 height,
+// or a face of a cube map
+struct RasterView {
+	bool cube;
+	int face;
+	int width;
+	int height;
+};
+
+// A classic tiled TIFF, uncompressed and little endian, one sample format
+// for all channels. Tiles are all the same size, so the offset of each is
+// known up front and they can be written in any order into the same bytes
+class TiffTileWriter {
+private:
+	std::ofstream file;
+	std::mutex mutex;
+	int tilesAcross = 0;
+	long long tileBytes = 0;
+	long long firstTile = 0;
+	bool failed = false;
+public:
+	// False if the file cannot be created, or is too large for the 32-bit
+	// offsets of a classic TIFF
+	bool open(const std::string& path, int width, int height, int tileSize, int channels, RasterFormat format);
+	// The tile at (tx, ty), tileSize^2 texels; safe to call from any thread
+	void writeTile(int tx, int ty, const std::vector<unsigned char>& bytes);
+	bool close();
+};
+
+// Writes height and normal maps of a terrain at any resolution by
+// evaluating its height function per texel, independently of the mesh. The
+// image is cut into tiles computed on the pool and written to disk as soon
+// as they are done, so memory stays at a few tiles per thread whatever the
+// size. Each tile is computed from the texels it covers alone, with a
+// one-texel border for the normals, so the files are the same bytes on any
+// run and any number of threads
+class RasterExporter {
+private:
+	const Terrain& terrain;
+	RasterExportParams params;
+	PerlinNoise noise;
+	Vec3 center;
+	float radius;
+
+	Vec3 direction(const RasterView& view, float x, float y) const;
+	// Heights and outward normals of w x h texels from (x0, y0) on
+	void renderTile(const RasterView& view, int x0, int y0, int w, int h, std::vector<float>& heights, std::vector<Vec3>& normals) const;
+	void encodeHeights(const std::vector<float>& heights, std::vector<unsigned char>& bytes) const;
+	void encodeNormals(const std::vector<Vec3>& normals, std::vector<unsigned char>& bytes) const;
+	bool writeTiffs(const RasterView& view, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool);
+public:
+	RasterExporter(const Terrain& terrain, const RasterExportParams& params);
+
+	// width x width / 2 maps; an empty path skips that map
+	bool writeEquirect(int width, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool);
+	// size x size maps of every face, at path + "_" + face name + ".tif"
+	bool writeCube(int size, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool);
+	// Equirectangular tiles by zoom level, as map viewers load them: zoom z
+	// is 2^(z+1) x 2^z tiles, written to dir/height/z/x/y.raw and
+	// dir/normal/z/x/y.raw in the texel format of the TIFFs. Coarser levels
+	// are evaluated, not downsampled. False, before anything is written, if
+	// maxZoom is above MAX_PYRAMID_ZOOM or the widest level's texels do
+	// not fit an int
+	bool writePyramid(int maxZoom, const std::string& dir, bool heights, bool normals, ThreadPool& pool);
+
+	static const char* faceName(int face);
+
+	// 2^25 tiles at the finest level, already 8 TB of 256^2 float tiles
+	static const int MAX_PYRAMID_ZOOM = 12;
+};
+
+// Little endian stores into a byte buffer, whatever the host is
+void rasterPut16(std::vector<unsigned char>& bytes, size_t at, uint16_t v) {
+	bytes[at] = (unsigned char)v;
+	bytes[at + 1] = (unsigned char)(v >> 8);
+}
+
+void rasterPut32(std::vector<unsigned char>& bytes, size_t at, uint32_t v) {
+	for (int i = 0; i < 4; ++i) bytes[at + i] = (unsigned char)(v >> (8 * i));
+}
+
+void rasterPutFloat(std::vector<unsigned char>& bytes, size_t at, float v) {
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	rasterPut32(bytes, at, bits);
+}
+
+// Creates a directory if it does not exist yet; false if there is none after
+bool rasterMakeDirectory(const std::string& path) {
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+}
+
+bool TiffTileWriter::open(const std::string& path, int width, int height, int tileSize, int channels, RasterFormat format) {
+	int bytesPerSample = format == RASTER_UINT16 ? 2 : 4;
+	tilesAcross = (width + tileSize - 1) / tileSize;
+	int tilesDown = (height + tileSize - 1) / tileSize;
+	int numTiles = tilesAcross * tilesDown;
+	tileBytes = (long long)tileSize * tileSize * channels * bytesPerSample;
+
+	// Header, one directory, then the arrays that do not fit in an entry
+	const int numEntries = 12;
+	size_t directory = 8;
+	size_t arrays = directory + 2 + 12 * numEntries + 4;
+	size_t bitsArray = arrays;
+	size_t formatArray = bitsArray + 2 * channels;
+	size_t offsetsArray = formatArray + 2 * channels;
+	size_t countsArray = offsetsArray + 4 * numTiles;
+	firstTile = (countsArray + 4 * numTiles + 15) / 16 * 16;
+	if (firstTile + numTiles * tileBytes > 0xFFFFFFFFLL) return false;
+
+	std::vector<unsigned char> header(firstTile, 0);
+	header[0] = 'I';
+	header[1] = 'I';
+	rasterPut16(header, 2, 42);
+	rasterPut32(header, 4, (uint32_t)directory);
+	rasterPut16(header, directory, numEntries);
+
+	size_t entry = directory + 2;
+	// Values of up to four bytes are stored in the entry itself
+	auto add = [&](uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+		rasterPut16(header, entry, tag);
+		rasterPut16(header, entry + 2, type);
+		rasterPut32(header, entry + 4, count);
+		if (type == 3 && count == 1) rasterPut16(header, entry + 8, (uint16_t)value);
+		else rasterPut32(header, entry + 8, value);
+		entry += 12;
+	};
+	const uint16_t SHORT = 3, LONG = 4;
+	uint16_t sampleFormat = format == RASTER_UINT16 ? 1 : 3;
+	for (int c = 0; c < channels; ++c) {
+		rasterPut16(header, bitsArray + 2 * c, (uint16_t)(8 * bytesPerSample));
+		rasterPut16(header, formatArray + 2 * c, sampleFormat);
+	}
+	for (int t = 0; t < numTiles; ++t) {
+		rasterPut32(header, offsetsArray + 4 * t, (uint32_t)(firstTile + t * tileBytes));
+		rasterPut32(header, countsArray + 4 * t, (uint32_t)tileBytes);
+	}
+
+	add(256, LONG, 1, width);
+	add(257, LONG, 1, height);
+	add(258, SHORT, channels, channels == 1 ? 8 * bytesPerSample : (uint32_t)bitsArray);
+	add(259, SHORT, 1, 1);
+	// Grayscale heights, RGB normals
+	add(262, SHORT, 1, channels == 1 ? 1 : 2);
+	add(277, SHORT, 1, channels);
+	add(284, SHORT, 1, 1);
+	add(322, LONG, 1, tileSize);
+	add(323, LONG, 1, tileSize);
+	add(324, LONG, numTiles, numTiles == 1 ? (uint32_t)firstTile : (uint32_t)offsetsArray);
+	add(325, LONG, numTiles, numTiles == 1 ? (uint32_t)tileBytes : (uint32_t)countsArray);
+	add(339, SHORT, channels, channels == 1 ? sampleFormat : (uint32_t)formatArray);
+	rasterPut32(header, entry, 0);
+
+	file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+	file.write((const char*)&header[0], header.size());
+	failed = !file;
+	return !failed;
+}
+
+void TiffTileWriter::writeTile(int tx, int ty, const std::vector<unsigned char>& bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	file.seekp(firstTile + (long long)(ty * tilesAcross + tx) * tileBytes);
+	file.write((const char*)&bytes[0], bytes.size());
+	if (!file) failed = true;
+}
+
+bool TiffTileWriter::close() {
+	file.close();
+	return !failed && !file.fail();
+}
+
+RasterExporter::RasterExporter(const Terrain& terrain, const RasterExportParams& params)
+	: terrain(terrain), params(params), noise(terrain.noise()) {
+	center = terrain.getMesh()->getCenter();
+	radius = terrain.getMesh()->getRadius();
+	if (!(this->params.minHeight < this->params.maxHeight)) {
+		this->params.maxHeight = 2.0f * std::sqrt(radius);
+		this->params.minHeight = -this->params.maxHeight;
+	}
+}
+
+const char* RasterExporter::faceName(int face) {
+	const char* names[RASTER_CUBE_FACES] = { "px", "nx", "py", "ny", "pz", "nz" };
+	return names[face];
+}
+
+// Texel centers are at half-integer coordinates; the border of a tile may
+// reach past the image, which continues over the sphere
+Vec3 RasterExporter::direction(const RasterView& view, float x, float y) const {
+	if (!view.cube) {
+		float longitude = (x / view.width) * 2.0f * (float)M_PI - (float)M_PI;
+		float latitude = 0.5f * (float)M_PI - (y / view.height) * (float)M_PI;
+		return directionFromLatLong(latitude, longitude);
+	}
+
+	float a = 2.0f * x / view.width - 1.0f;
+	float b = 2.0f * y / view.height - 1.0f;
+	Vec3 d;
+	switch (view.face) {
+	case RASTER_POSITIVE_X: d = Vec3(1, -b, -a); break;
+	case RASTER_NEGATIVE_X: d = Vec3(-1, -b, a); break;
+	case RASTER_POSITIVE_Y: d = Vec3(a, 1, b); break;
+	case RASTER_NEGATIVE_Y: d = Vec3(a, -1, -b); break;
+	case RASTER_POSITIVE_Z: d = Vec3(a, -b, 1); break;
+	default: d = Vec3(-a, -b, -1); break;
+	}
+	return d.normalized();
+}
+
+void RasterExporter::renderTile(const RasterView& view, int x0, int y0, int w, int h, std::vector<float>& heights, std::vector<Vec3>& normals) const {
+	int pitch = w + 2;
+	std::vector<Vec3> surface(pitch * (h + 2));
+	heights.resize(w * h);
+	for (int y = -1; y <= h; ++y) {
+		for (int x = -1; x <= w; ++x) {
+			Vec3 d = direction(view, x0 + x + 0.5f, y0 + y + 0.5f);
+			float height = terrain.height(noise, center + d * radius);
+			surface[(y + 1) * pitch + x + 1] = d * (radius + height);
+			if (x >= 0 && x < w && y >= 0 && y < h) heights[y * w + x] = height;
+		}
+	}
+
+	// Central differences across the texel; the orientation of the axes
+	// differs between projections, so the normal is turned outwards
+	normals.resize(w * h);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int i = (y + 1) * pitch + x + 1;
+			Vec3 n = (surface[i + 1] - surface[i - 1]).cross(surface[i + pitch] - surface[i - pitch]);
+			if (n.dot(surface[i]) < 0) n = -n;
+			float length = n.norm();
+			normals[y * w + x] = length > 0 ? Vec3(n / length) : Vec3(surface[i].normalized());
+		}
+	}
+}
+
+void RasterExporter::encodeHeights(const std::vector<float>& heights, std::vector<unsigned char>& bytes) const {
+	if (params.format == RASTER_FLOAT32) {
+		bytes.resize(4 * heights.size());
+		for (size_t i = 0; i < heights.size(); ++i) rasterPutFloat(bytes, 4 * i, heights[i]);
+		return;
+	}
+	bytes.resize(2 * heights.size());
+	float scale = 65535.0f / (params.maxHeight - params.minHeight);
+	for (size_t i = 0; i < heights.size(); ++i) {
+		float v = std::min(std::max((heights[i] - params.minHeight) * scale, 0.0f), 65535.0f);
+		rasterPut16(bytes, 2 * i, (uint16_t)(v + 0.5f));
+	}
+}
+
+void RasterExporter::encodeNormals(const std::vector<Vec3>& normals, std::vector<unsigned char>& bytes) const {
+	int bytesPerSample = params.format == RASTER_UINT16 ? 2 : 4;
+	bytes.resize(3 * bytesPerSample * normals.size());
+	for (size_t i = 0; i < normals.size(); ++i) {
+		for (int c = 0; c < 3; ++c) {
+			size_t at = (3 * i + c) * bytesPerSample;
+			float v = normals[i][c];
+			if (params.format == RASTER_FLOAT32) rasterPutFloat(bytes, at, v);
+			else rasterPut16(bytes, at, (uint16_t)(std::min(std::max(v * 0.5f + 0.5f, 0.0f), 1.0f) * 65535.0f + 0.5f));
+		}
+	}
+}
+
+bool RasterExporter::writeTiffs(const RasterView& view, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool) {
+	int tileSize = params.tileSize;
+	TiffTileWriter heightTiff, normalTiff;
+	if (!heightPath.empty() && !heightTiff.open(heightPath, view.width, view.height, tileSize, 1, params.format)) return false;
+	if (!normalPath.empty() && !normalTiff.open(normalPath, view.width, view.height, tileSize, 3, params.format)) return false;
+
+	// Edge tiles are computed whole: TIFF tiles are all the same size
+	int tilesAcross = (view.width + tileSize - 1) / tileSize;
+	int tilesDown = (view.height + tileSize - 1) / tileSize;
+	pool.parallelFor(0, tilesAcross * tilesDown, 1, [&](int t) {
+		TRACE_SCOPE("raster tile");
+		int tx = t % tilesAcross, ty = t / tilesAcross;
+		std::vector<float> heights;
+		std::vector<Vec3> normals;
+		std::vector<unsigned char> bytes;
+		renderTile(view, tx * tileSize, ty * tileSize, tileSize, tileSize, heights, normals);
+		if (!heightPath.empty()) {
+			encodeHeights(heights, bytes);
+			heightTiff.writeTile(tx, ty, bytes);
+		}
+		if (!normalPath.empty()) {
+			encodeNormals(normals, bytes);
+			normalTiff.writeTile(tx, ty, bytes);
+		}
+	});
+
+	bool ok = true;
+	if (!heightPath.empty()) ok = heightTiff.close() && ok;
+	if (!normalPath.empty()) ok = normalTiff.close() && ok;
+	return ok;
+}
+
+bool RasterExporter::writeEquirect(int width, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool) {
+	TRACE_SCOPE("raster equirect");
+	RasterView view = { false, 0, width, width / 2 };
+	return writeTiffs(view, heightPath, normalPath, pool);
+}
+
+bool RasterExporter::writeCube(int size, const std::string& heightPath, const std::string& normalPath, ThreadPool& pool) {
+	TRACE_SCOPE("raster cube");
+	for (int face = 0; face < RASTER_CUBE_FACES; ++face) {
+		RasterView view = { true, face, size, size };
+		std::string suffix = std::string("_") + faceName(face) + ".tif";
+		if (!writeTiffs(view, heightPath.empty() ? "" : heightPath + suffix, normalPath.empty() ? "" : normalPath + suffix, pool)) return false;
+	}
+	return true;
+}
+
+bool RasterExporter::writePyramid(int maxZoom, const std::string& dir, bool heights, bool normals, ThreadPool& pool) {
+	TRACE_SCOPE("raster pyramid");
+	int tileSize = params.tileSize;
+	std::vector<std::string> layers;
+	if (heights) layers.push_back(dir + "/height");
+	if (normals) layers.push_back(dir + "/normal");
+	if (maxZoom > MAX_PYRAMID_ZOOM || (2LL << maxZoom) * tileSize > INT_MAX) return false;
+
+	for (int zoom = 0; zoom <= maxZoom; ++zoom) {
+		int tilesDown = 1 << zoom;
+		int tilesAcross = 2 * tilesDown;
+		for (const std::string& layer : layers) {
+			if (!rasterMakeDirectory(layer) || !rasterMakeDirectory(layer + "/" + std::to_string(zoom))) return false;
+			for (int tx = 0; tx < tilesAcross; ++tx) {
+				if (!rasterMakeDirectory(layer + "/" + std::to_string(zoom) + "/" + std::to_string(tx))) return false;
+			}
+		}
+
+		RasterView view = { false, 0, tilesAcross * tileSize, tilesDown * tileSize };
+		std::vector<char> failed(tilesAcross * tilesDown, 0);
+		pool.parallelFor(0, tilesAcross * tilesDown, 1, [&](int t) {
+			TRACE_SCOPE("raster tile");
+			int tx = t % tilesAcross, ty = t / tilesAcross;
+			std::vector<float> tileHeights;
+			std::vector<Vec3> tileNormals;
+			std::vector<unsigned char> bytes;
+			renderTile(view, tx * tileSize, ty * tileSize, tileSize, tileSize, tileHeights, tileNormals);
+
+			std::string name = "/" + std::to_string(zoom) + "/" + std::to_string(tx) + "/" + std::to_string(ty) + ".raw";
+			for (int l = 0; l < layers.size(); ++l) {
+				bool isHeight = heights && l == 0;
+				if (isHeight) encodeHeights(tileHeights, bytes);
+				else encodeNormals(tileNormals, bytes);
+				std::ofstream file((layers[l] + name).c_str(), std::ios::binary);
+				file.write((const char*)&bytes[0], bytes.size());
+				if (!file) failed[t] = 1;
+			}
+		});
+		if (std::count(failed.begin(), failed.end(), 1) > 0) return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef RENDERSTATS_H_
+#define RENDERSTATS_H_
+
+#include <string>
+#include <vector>
+
+#include <OpenGP/GL/Eigen.h>
+#include "OpenGP/GL/Application.h"
+
+using namespace OpenGP;
+
+// Work submitted to GL since the last reset(). Only counts what goes through
+// the helpers below, which the scene objects use for their per-frame buffers
+// and draws
+struct RenderStats {
+	long long drawCalls = 0;
+	long long triangles = 0;
+	long long bytesUploaded = 0;
+
+	void reset() {
+		drawCalls = 0;
+		triangles = 0;
+		bytesUploaded = 0;
+	}
+};
+
+RenderStats& renderStats() {
+	static RenderStats stats;
+	return stats;
+}
+
+template <typename T>
+void uploadVbo(GPUMesh& mesh, const std::string& name, const std::vector<T>& data) {
+	mesh.set_vbo<T>(name, data);
+	renderStats().bytesUploaded += (long long)(data.size() * sizeof(T));
+}
+
+// Overwrites count values of a vbo from first on with the same part of data
+template <typename T>
+void updateVbo(GPUMesh& mesh, const std::string& name, const std::vector<T>& data, int first, int count) {
+	mesh.update_vbo<T>(name, data.data() + first, first, count);
+	renderStats().bytesUploaded += (long long)(count * sizeof(T));
+}
+
+void uploadTexcoords(GPUMesh& mesh, const std::vector<Vec2>& uvs) {
+	mesh.set_vtexcoord(uvs);
+	renderStats().bytesUploaded += (long long)(uvs.size() * sizeof(Vec2));
+}
+
+void uploadTriangles(GPUMesh& mesh, const std::vector<unsigned int>& indices) {
+	mesh.set_triangles(indices);
+	renderStats().bytesUploaded += (long long)(indices.size() * sizeof(unsigned int));
+}
+
+// Draws the mesh; indices is the size of its index buffer and mode its
+// primitive type, which GPUMesh does not expose
+void drawMesh(GPUMesh& mesh, long long indices, GLenum mode = GL_TRIANGLES) {
+	mesh.draw();
+
+	RenderStats& stats = renderStats();
+	stats.drawCalls++;
+	if (mode == GL_TRIANGLES) stats.triangles += indices / 3;
+	else if (mode == GL_TRIANGLE_STRIP && indices > 2) stats.triangles += indices - 2;
+}
+
+// Draws the triangles of the bound vertex array object and index buffer, for
+// meshes that share buffers and so are not GPUMeshes
+void drawTriangles(long long indices) {
+	glDrawElements(GL_TRIANGLES, (GLsizei)indices, GL_UNSIGNED_INT, 0);
+
+	RenderStats& stats = renderStats();
+	stats.drawCalls++;
+	stats.triangles += indices / 3;
+}
+
+// drawTriangles() for instances copies of the triangles
+void drawTrianglesInstanced(long long indices, int instances) {
+	glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indices, GL_UNSIGNED_INT, 0, instances);
+
+	RenderStats& stats = renderStats();
+	stats.drawCalls++;
+	stats.triangles += indices / 3 * instances;
+}
+
+// Draws instances copies of the mesh; indices is the size of its index
+// buffer, which holds triangles
+void drawMeshInstanced(GPUMesh& mesh, long long indices, int instances) {
+	mesh.draw_instanced(instances);
+
+	RenderStats& stats = renderStats();
+	stats.drawCalls++;
+	stats.triangles += indices / 3 * instances;
+}
+
+#endif
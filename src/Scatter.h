@@ -0,0 +1,309 @@
+#ifndef SCATTER_H_
+#define SCATTER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "Icosphere.h"
+#include "Erosion.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// The texture terrain_fshader.glsl draws most of at a height and slope, as
+// bits for ScatterLayer::materials. Slope is the cosine between the surface
+// normal and the radial direction, 1 on flat ground
+enum TerrainMaterial {
+	MATERIAL_SAND = 1,
+	MATERIAL_GRASS = 2,
+	MATERIAL_ROCK = 4,
+	MATERIAL_SNOW = 8
+};
+
+// Mirrors the bands and blends of the shader; a blend counts as the texture
+// weighted most
+inline TerrainMaterial terrainMaterial(float height, float slope, float radius) {
+	float band = std::sqrt(radius);
+	float blend = (slope - 0.6f) / 0.6f;
+	bool flat = slope > 0.6f;
+	if (height < 0.0f) return MATERIAL_SAND;
+	if (height < 0.4f * band) return flat && height < 0.2f * band && blend < 0.5f ? MATERIAL_SAND : MATERIAL_GRASS;
+	if (height < 0.8f * band) return flat && height < 0.6f * band && blend < 0.5f ? MATERIAL_GRASS : MATERIAL_ROCK;
+	return flat && height < 0.9f * band && blend < 0.5f ? MATERIAL_ROCK : MATERIAL_SNOW;
+}
+
+// The model a renderer draws for the instances of a layer
+enum ScatterShape {
+	SCATTER_TREE,
+	SCATTER_ROCK
+};
+
+// One kind of scattered object, e.g. trees on grass
+struct ScatterLayer {
+	ScatterShape shape = SCATTER_TREE;
+	// No two instances are closer than this, in world units
+	float spacing = 0.5f;
+	// TerrainMaterial bits the instances may stand on
+	int materials = MATERIAL_GRASS;
+	// Ground flatter than this (see terrainMaterial) and within the heights
+	float minSlope = 0.8f;
+	float minHeight = -std::numeric_limits<float>::infinity();
+	float maxHeight = std::numeric_limits<float>::infinity();
+	float minScale = 0.8f, maxScale = 1.2f;
+	// Rounds of candidates; each fills gaps the previous ones left
+	int rounds = 3;
+	unsigned int seed = 0;
+};
+
+// Position on the surface and size, as the renderer reads them
+struct ScatterInstance {
+	float x, y, z;
+	float scale;
+};
+
+// The instances standing on one face of the icosphere at the patch level
+struct ScatterPatch {
+	int first = 0;
+	int count = 0;
+	// Bounds of the instance positions, and the patch's unit direction
+	Vec3 center = Vec3(0, 0, 0);
+	float radius = 0;
+	Vec3 axis = Vec3(0, 0, 0);
+};
+
+// Points on a sphere bucketed by the cell of a cubic grid they fall in,
+// with cells as large as the distance queried, so the points within it of
+// any point are in its 27 surrounding cells. Cells are hashed into a table
+// in compressed sparse row form, like VertexGraph
+class SphereHash {
+private:
+	float cellSize = 1.0f;
+	uint32_t mask = 0;
+	std::vector<int> offsets, items;
+
+	uint32_t bucket(int x, int y, int z) const {
+		uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+		return h & mask;
+	}
+	int cell(float coordinate) const { return (int)std::floor(coordinate / cellSize); }
+public:
+	void build(const std::vector<Vec3>& points, float cellSize);
+
+	// Calls visit(i) for every point i that may be within cellSize of p,
+	// and possibly for some farther ones; stops at the first call that
+	// returns true and returns true then
+	template <typename Visit>
+	bool any(const Vec3& p, Visit visit) const;
+};
+
+void SphereHash::build(const std::vector<Vec3>& points, float cellSize) {
+	this->cellSize = cellSize;
+	uint32_t size = 1;
+	while (size < 2 * points.size()) size <<= 1;
+	mask = size - 1;
+
+	std::vector<uint32_t> buckets(points.size());
+	offsets.assign(size + 1, 0);
+	for (int i = 0; i < points.size(); ++i) {
+		buckets[i] = bucket(cell(points[i][0]), cell(points[i][1]), cell(points[i][2]));
+		offsets[buckets[i] + 1]++;
+	}
+	for (uint32_t b = 0; b < size; ++b) offsets[b + 1] += offsets[b];
+	items.resize(points.size());
+	std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < points.size(); ++i) items[fill[buckets[i]]++] = i;
+}
+
+template <typename Visit>
+bool SphereHash::any(const Vec3& p, Visit visit) const {
+	if (items.empty()) return false;
+	int cx = cell(p[0]), cy = cell(p[1]), cz = cell(p[2]);
+	for (int dz = -1; dz <= 1; ++dz) {
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				uint32_t b = bucket(cx + dx, cy + dy, cz + dz);
+				for (int k = offsets[b]; k < offsets[b + 1]; ++k) {
+					if (visit(items[k])) return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Poisson disk placement of a layer on a terrain, in rounds. Each round
+// throws candidates uniformly on the sphere, drops the ones near an
+// instance of an earlier round, samples the terrain under the rest and
+// keeps those on allowed ground that have the highest priority among the
+// candidates within spacing (Matern's second process). Candidates and
+// priorities come from a hash of the seed and their index, and no decision
+// depends on another of the same round, so the result is the same on any
+// number of threads.
+//
+// Distances are measured on the undisplaced sphere. The instances are
+// sorted by the icosphere face they stand on at patchLevel, so a renderer
+// can cull and draw them a patch at a time.
+//
+// The surface is a Terrain, or anything else with its getMesh() and
+// sample(); Terrain keeps the scatters placed on it
+class Scatter {
+private:
+	int patchLevel;
+	ScatterLayer layer;
+	std::vector<ScatterInstance> instances;
+	std::vector<ScatterPatch> patches;
+public:
+	Scatter() : patchLevel(0) {}
+
+	template <typename Surface>
+	void place(const Surface& terrain, const ScatterLayer& layer, int patchLevel, ThreadPool& pool);
+
+	const ScatterLayer& getLayer() const { return layer; }
+	const std::vector<ScatterInstance>& getInstances() const { return instances; }
+	const std::vector<ScatterPatch>& getPatches() const { return patches; }
+	int getPatchLevel() const { return patchLevel; }
+	bool empty() const { return instances.empty(); }
+	size_t getMemoryBytes() const { return instances.capacity() * sizeof(ScatterInstance) + patches.capacity() * sizeof(ScatterPatch); }
+};
+
+template <typename Surface>
+void Scatter::place(const Surface& terrain, const ScatterLayer& layer, int patchLevel, ThreadPool& pool) {
+	TRACE_SCOPE("scatter");
+	this->layer = layer;
+	Icosphere* mesh = terrain.getMesh();
+	Vec3 center = mesh->getCenter();
+	float radius = mesh->getRadius();
+	this->patchLevel = std::min(patchLevel, mesh->getRecursions());
+	int patchShift = 2 * (mesh->getRecursions() - this->patchLevel);
+
+	// About two candidates per disk of radius spacing and round; a
+	// thinning keeps 1 - e^-2 of a disk's worth of them
+	float disk = (float)M_PI * layer.spacing * layer.spacing;
+	int perRound = (int)std::min(2.0 * 4.0 * M_PI * radius * radius / disk, (double)std::numeric_limits<int>::max() / 2);
+	float spacing2 = layer.spacing * layer.spacing;
+
+	// Only what is needed of the terrain under a candidate, as there are
+	// a few per final instance
+	struct Ground {
+		Vec3 position;
+		int face;
+	};
+
+	std::vector<Vec3> accepted;
+	std::vector<Ground> acceptedGround;
+	std::vector<uint32_t> acceptedPriority;
+	SphereHash acceptedHash;
+
+	std::vector<Vec3> candidates(perRound);
+	std::vector<char> alive(perRound);
+	std::vector<uint32_t> priority(perRound);
+	std::vector<Ground> ground(perRound);
+	std::vector<char> kept(perRound);
+
+	for (int round = 0; round < layer.rounds; ++round) {
+		uint32_t roundSeed = erosionHash(layer.seed, (uint64_t)round * 0x100000000ULL + 0xC0FFEE);
+
+		pool.parallelFor(0, perRound, 1024, [&](int i) {
+			uint32_t a = erosionHash(roundSeed, 3ULL * i);
+			uint32_t b = erosionHash(roundSeed, 3ULL * i + 1);
+			float z = 2.0f * (a / 4294967296.0f) - 1.0f;
+			float phi = 2.0f * (float)M_PI * (b / 4294967296.0f);
+			float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+			Vec3 direction(r * std::cos(phi), r * std::sin(phi), z);
+			candidates[i] = center + direction * radius;
+			priority[i] = erosionHash(roundSeed, 3ULL * i + 2);
+
+			bool free = !acceptedHash.any(candidates[i], [&](int j) {
+				return (accepted[j] - candidates[i]).squaredNorm() < spacing2;
+			});
+			alive[i] = 0;
+			if (!free) return;
+
+			auto sample = terrain.sample(direction);
+			float slope = sample.normal.dot(direction);
+			alive[i] = (terrainMaterial(sample.height, slope, radius) & layer.materials)
+				&& slope >= layer.minSlope && sample.height >= layer.minHeight && sample.height <= layer.maxHeight;
+			ground[i].position = sample.position;
+			ground[i].face = sample.face;
+		});
+
+		std::vector<Vec3> survivors;
+		std::vector<int> survivorIndex;
+		for (int i = 0; i < perRound; ++i) {
+			if (!alive[i]) continue;
+			survivors.push_back(candidates[i]);
+			survivorIndex.push_back(i);
+		}
+		SphereHash survivorHash;
+		survivorHash.build(survivors, layer.spacing);
+
+		// Priorities tie very rarely; the lower index wins then
+		pool.parallelFor(0, (int)survivors.size(), 1024, [&](int s) {
+			int i = survivorIndex[s];
+			kept[s] = !survivorHash.any(survivors[s], [&](int t) {
+				int j = survivorIndex[t];
+				if (j == i || (survivors[t] - survivors[s]).squaredNorm() >= spacing2) return false;
+				return priority[j] > priority[i] || (priority[j] == priority[i] && j < i);
+			});
+		});
+
+		for (int s = 0; s < survivors.size(); ++s) {
+			if (!kept[s]) continue;
+			accepted.push_back(survivors[s]);
+			acceptedGround.push_back(ground[survivorIndex[s]]);
+			acceptedPriority.push_back(priority[survivorIndex[s]]);
+		}
+		acceptedHash.build(accepted, layer.spacing);
+	}
+
+	// Counting sort by patch, stable, so the order only depends on the seed
+	int numPatches = 20 << (2 * this->patchLevel);
+	std::vector<int> patchOf(accepted.size());
+	std::vector<int> offsets(numPatches + 1, 0);
+	for (int i = 0; i < accepted.size(); ++i) {
+		patchOf[i] = acceptedGround[i].face >> patchShift;
+		offsets[patchOf[i] + 1]++;
+	}
+	for (int p = 0; p < numPatches; ++p) offsets[p + 1] += offsets[p];
+
+	instances.resize(accepted.size());
+	std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < accepted.size(); ++i) {
+		const Vec3& position = acceptedGround[i].position;
+		float t = acceptedPriority[i] / 4294967296.0f;
+		ScatterInstance& instance = instances[fill[patchOf[i]]++];
+		instance.x = position[0];
+		instance.y = position[1];
+		instance.z = position[2];
+		instance.scale = layer.minScale + (layer.maxScale - layer.minScale) * t;
+	}
+
+	patches.assign(numPatches, ScatterPatch());
+	pool.parallelFor(0, numPatches, 16, [&](int p) {
+		ScatterPatch& patch = patches[p];
+		patch.first = offsets[p];
+		patch.count = offsets[p + 1] - offsets[p];
+		if (patch.count == 0) return;
+
+		Vec3 lo = Vec3::Constant(std::numeric_limits<float>::max()), hi = -lo;
+		for (int i = patch.first; i < patch.first + patch.count; ++i) {
+			Vec3 position(instances[i].x, instances[i].y, instances[i].z);
+			lo = lo.cwiseMin(position);
+			hi = hi.cwiseMax(position);
+		}
+		patch.center = (lo + hi) * 0.5f;
+		patch.axis = (patch.center - center).normalized();
+		for (int i = patch.first; i < patch.first + patch.count; ++i) {
+			Vec3 position(instances[i].x, instances[i].y, instances[i].z);
+			patch.radius = std::max(patch.radius, (position - patch.center).norm() + instances[i].scale);
+		}
+	});
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef SCATTERRENDERER_H_
+#define SCATTERRENDERER_H_
+
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "Icosphere.h"
+#include "Scatter.h"
+#include "ShaderSource.h"
+#include "RenderStats.h"
+#include "FrameProfiler.h"
+#include "Frustum.h"
+
+#include <OpenGP/GL/Eigen.h>
+#include "OpenGP/GL/Application.h"
+
+using namespace OpenGP;
+
+// Draws the scatters of a terrain, e.g. trees and rocks. Every non-empty
+// patch of every layer holds the patch's instances and draws them in one
+// instanced call, over the buffers of its model that all patches share. A
+// frame only culls and draws patches, so its cost grows with their number
+// and the instances on screen, not with the instances on the planet
+class ScatterRenderer {
+private:
+	// A model, upright along y and standing on the origin
+	struct Model {
+		std::vector<Vec3> vertices;
+		std::vector<Vec3> normals;
+		std::vector<unsigned int> indices;
+	};
+
+	// A model's buffers, uploaded on the first setScatters()
+	struct ModelBuffers {
+		std::unique_ptr<ArrayBuffer<Vec3>> positions;
+		std::unique_ptr<ArrayBuffer<Vec3>> normals;
+		std::unique_ptr<ElementArrayBuffer<unsigned int>> indices;
+		int numIndices;
+	};
+
+	struct Batch {
+		std::unique_ptr<VertexArrayObject> vao;
+		std::unique_ptr<ArrayBuffer<Vec4>> instances;
+		int numIndices;
+		int count;
+		Vec3 albedo;
+		// Bounds of the instances, see ScatterPatch
+		Vec3 center;
+		float radius;
+	};
+
+	std::unique_ptr<Shader> shader;
+	ModelBuffers modelBuffers[2];
+	std::vector<Batch> batches;
+	Vec3 center = Vec3(0, 0, 0);
+	// Nothing below this radius is assumed to hide what is behind it, as
+	// valleys dip below the planet's radius
+	float occluderRadius = 0;
+
+	static Model treeModel();
+	static Model rockModel();
+	static Vec3 albedo(ScatterShape shape);
+	bool visible(const Batch& batch, const Vec3& cameraPos, const Frustum& frustum) const;
+public:
+	// Patches farther than this from the camera are not drawn
+	float drawDistance = 25.0f;
+
+	void init();
+
+	// Replaces the batches with the scatters of a planet
+	void setScatters(const std::vector<Scatter>& scatters, Vec3 center, float radius);
+	bool empty() const { return batches.empty(); }
+
+	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp);
+};
+
+void ScatterRenderer::init() {
+	shader = std::unique_ptr<Shader>(new Shader());
+	shader->verbose = true;
+	shader->add_vshader_from_source(loadShaderSource("Shaders/scatter_vshader.glsl").c_str());
+	shader->add_fshader_from_source(loadShaderSource("Shaders/scatter_fshader.glsl").c_str());
+	shader->link();
+}
+
+// A trunk and a cone of leaves, one unit high
+ScatterRenderer::Model ScatterRenderer::treeModel() {
+	Model model;
+	const int segments = 8;
+	// (radius, y) of the bottom and top rings of the trunk, then the leaves
+	const float rings[2][4] = { { 0.08f, 0.0f, 0.06f, 0.3f }, { 0.4f, 0.2f, 0.0f, 1.0f } };
+	for (int part = 0; part < 2; ++part) {
+		float bottom = rings[part][0], bottomY = rings[part][1];
+		float top = rings[part][2], topY = rings[part][3];
+		// Normal of the side, tilted up by the taper
+		float rise = (bottom - top) / (topY - bottomY);
+		for (int s = 0; s <= segments; ++s) {
+			float angle = 2.0f * (float)M_PI * s / segments;
+			Vec3 outward(std::cos(angle), 0, std::sin(angle));
+			Vec3 normal = (outward + Vec3(0, rise, 0)).normalized();
+			model.vertices.push_back(outward * bottom + Vec3(0, bottomY, 0));
+			model.vertices.push_back(outward * top + Vec3(0, topY, 0));
+			model.normals.push_back(normal);
+			model.normals.push_back(normal);
+		}
+		unsigned int first = part * 2 * (segments + 1);
+		for (int s = 0; s < segments; ++s) {
+			unsigned int a = first + 2 * s;
+			model.indices.insert(model.indices.end(), { a, a + 1, a + 2, a + 2, a + 1, a + 3 });
+		}
+	}
+	return model;
+}
+
+// A flattened, lumpy icosahedron half sunk into the ground
+ScatterRenderer::Model ScatterRenderer::rockModel() {
+	Icosphere sphere(Vec3(0, 0, 0), 0.5f, 1);
+	Model model;
+	model.indices = sphere.genMesh();
+	model.vertices = sphere.getVertices();
+	model.normals = sphere.getVertexNormals();
+	for (int i = 0; i < model.vertices.size(); ++i) {
+		Vec3& v = model.vertices[i];
+		float lump = 1.0f + 0.15f * std::sin(7.0f * v[0] + 3.0f * v[2]) * std::cos(5.0f * v[1]);
+		v = Vec3(v[0] * lump, v[1] * lump * 0.6f - 0.1f, v[2] * lump);
+		Vec3& n = model.normals[i];
+		n = Vec3(n[0] * 0.6f, n[1], n[2] * 0.6f).normalized();
+	}
+	return model;
+}
+
+Vec3 ScatterRenderer::albedo(ScatterShape shape) {
+	switch (shape) {
+	case SCATTER_ROCK: return Vec3(0.42f, 0.4f, 0.37f);
+	default: return Vec3(0.12f, 0.3f, 0.1f);
+	}
+}
+
+void ScatterRenderer::setScatters(const std::vector<Scatter>& scatters, Vec3 center, float radius) {
+	ProfileScope scope("scatter upload");
+	this->center = center;
+	this->occluderRadius = 0.9f * radius;
+	batches.clear();
+
+	// The models never change, so a regeneration only replaces the batches
+	for (int m = 0; m < 2; ++m) {
+		ModelBuffers& buffers = modelBuffers[m];
+		if (buffers.positions) continue;
+		Model model = m == SCATTER_ROCK ? rockModel() : treeModel();
+		buffers.positions = std::unique_ptr<ArrayBuffer<Vec3>>(new ArrayBuffer<Vec3>());
+		buffers.normals = std::unique_ptr<ArrayBuffer<Vec3>>(new ArrayBuffer<Vec3>());
+		buffers.indices = std::unique_ptr<ElementArrayBuffer<unsigned int>>(new ElementArrayBuffer<unsigned int>());
+		buffers.positions->upload(model.vertices);
+		buffers.normals->upload(model.normals);
+		buffers.indices->upload(model.indices);
+		buffers.numIndices = model.indices.size();
+		renderStats().bytesUploaded += (long long)(2 * model.vertices.size() * sizeof(Vec3) + model.indices.size() * sizeof(unsigned int));
+	}
+
+	shader->bind();
+	for (int l = 0; l < scatters.size(); ++l) {
+		const Scatter& scatter = scatters[l];
+		ModelBuffers& buffers = modelBuffers[scatter.getLayer().shape];
+		const std::vector<ScatterInstance>& instances = scatter.getInstances();
+		for (const ScatterPatch& patch : scatter.getPatches()) {
+			if (patch.count == 0) continue;
+			Batch batch;
+			batch.numIndices = buffers.numIndices;
+			batch.count = patch.count;
+			batch.albedo = albedo(scatter.getLayer().shape);
+			batch.center = patch.center;
+			batch.radius = patch.radius;
+
+			// ScatterInstance is laid out as a Vec4, one per instance
+			batch.instances = std::unique_ptr<ArrayBuffer<Vec4>>(new ArrayBuffer<Vec4>());
+			batch.instances->upload_raw(instances.data() + patch.first, patch.count);
+			renderStats().bytesUploaded += (long long)(patch.count * sizeof(ScatterInstance));
+
+			batch.vao = std::unique_ptr<VertexArrayObject>(new VertexArrayObject());
+			batch.vao->bind();
+			shader->set_attribute("vposition", *buffers.positions);
+			shader->set_attribute("vnormal", *buffers.normals);
+			shader->set_attribute("vinstance", *batch.instances, 1);
+			buffers.indices->bind();
+			batch.vao->unbind();
+			batches.push_back(std::move(batch));
+		}
+	}
+	shader->unbind();
+}
+
+// Outside the draw distance, the frustum or beyond the horizon. A point at
+// distance r from the center is hidden by a sphere of radius occluderRadius
+// once its angle from the camera's direction exceeds the sum of the angles
+// both see the horizon under
+bool ScatterRenderer::visible(const Batch& batch, const Vec3& cameraPos, const Frustum& frustum) const {
+	Vec3 toBatch = batch.center - cameraPos;
+	if (toBatch.norm() - batch.radius > drawDistance) return false;
+
+	if (!frustum.intersectsSphere(batch.center, batch.radius)) return false;
+
+	Vec3 camera = cameraPos - center;
+	Vec3 patch = batch.center - center;
+	float cameraDistance = camera.norm();
+	float patchDistance = patch.norm() + batch.radius;
+	if (cameraDistance <= occluderRadius || patch.norm() <= batch.radius) return true;
+	float cosine = camera.dot(patch) / (cameraDistance * patch.norm());
+	float angle = std::acos(std::max(-1.0f, std::min(1.0f, cosine)));
+	float spread = std::asin(std::min(1.0f, batch.radius / patch.norm()));
+	float horizon = std::acos(occluderRadius / cameraDistance) + std::acos(std::min(1.0f, occluderRadius / patchDistance));
+	return angle - spread < horizon;
+}
+
+void ScatterRenderer::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
+	if (batches.empty()) return;
+
+	Vec3 target = cameraPos + cameraFront;
+	Mat4x4 V = lookAt(cameraPos, target, cameraUp);
+	Mat4x4 P = perspective(fov, SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.01f, 100.0f);
+
+	Frustum frustum(P * V);
+
+	shader->bind();
+	shader->set_uniform("center", center);
+	shader->set_uniform("viewer", cameraPos);
+	shader->set_uniform("V", V);
+	shader->set_uniform("P", P);
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+
+	for (const Batch& batch : batches) {
+		if (!visible(batch, cameraPos, frustum)) continue;
+		shader->set_uniform("albedo", batch.albedo);
+		batch.vao->bind();
+		drawTrianglesInstanced(batch.numIndices, batch.count);
+	}
+	glBindVertexArray(0);
+	shader->unbind();
+}
+
+#endif
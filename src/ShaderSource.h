@@ -0,0 +1,40 @@
+#ifndef SHADERSOURCE_H_
+#define SHADERSOURCE_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// Shader sources read ahead of time by prefetchShaderSource(), so the GL
+// thread only has to compile them
+std::mutex shaderSourcesMutex;
+std::map<std::string, std::string> shaderSources;
+
+std::string readShaderSource(const char* fname) {
+	std::ifstream f(fname);
+	std::stringstream buffer;
+	buffer << f.rdbuf();
+	return buffer.str();
+}
+
+// Reads a shader source into the cache; safe to call from any thread
+void prefetchShaderSource(const char* fname) {
+	std::string source = readShaderSource(fname);
+
+	std::lock_guard<std::mutex> lock(shaderSourcesMutex);
+	shaderSources[fname] = source;
+}
+
+// Returns the cached source, or reads it if it was never prefetched
+std::string loadShaderSource(const char* fname) {
+	{
+		std::lock_guard<std::mutex> lock(shaderSourcesMutex);
+		auto it = shaderSources.find(fname);
+		if (it != shaderSources.end()) return it->second;
+	}
+	return readShaderSource(fname);
+}
+
+#endif
@@ -7,9 +7,11 @@
 #include <random>
 
 #include "Image.h"
-#include "PerlinNoise.h"
+#include "SkyboxGenerator.h"
 #include "Icosphere.h"
 #include "loadTexture.h"
+#include "ShaderSource.h"
+#include "RenderStats.h"
 
 #include <OpenGP/GL/Eigen.h>
 #include "OpenGP/GL/Application.h"
@@ -17,7 +19,7 @@
 using namespace OpenGP;
 
 // This class defines skybox that is procedurally generated using perlin noise
-// as a cube map
+// as a cube map. The faces themselves come from a SkyboxGenerator
 class Skybox {
 private:
 	// Id for cube mesh texture
@@ -25,87 +27,44 @@ private:
 
 	// size of each tile
 	int size;
-	// Defines the properties of the space background
-	float starDensity, brightness;
-	float nebulaeDensity, falloff;
-	float period;
 
-	// Stores the color for a nebulae
-	Vec3 nebulaeColor = Vec3(75, 0, 130);
+	SkyboxGenerator generator;
 
 	// Shader and GPUMesh
 	std::unique_ptr<Shader> shader;
 	std::unique_ptr<GPUMesh> glMesh;
+	int numIndices = 0;
 
-	// Stores the image file names
-	std::vector<std::string> textureFiles = {"./skybox_front.png", "./skybox_back.png", "./skybox_down.png", "./skybox_up.png", "./skybox_right.png", "./skybox_left.png"};
-	std::vector<Vec3> image_front;
-	std::vector<Vec3> image_back;
-	std::vector<Vec3> image_left;
-	std::vector<Vec3> image_right;
-	std::vector<Vec3> image_up;
-	std::vector<Vec3> image_down;
-
-	void generateSkybox();
-	void generateStars(std::vector<Vec3>& image);
-	void generateNebulae();
-	Vec3 lerp(Vec3 a, Vec3 b, float t) {
-		return a * t + (1 - t) * b;
-	}
 	std::string load_source(const char* fname) {
-		std::ifstream f(fname);
-		std::stringstream buffer;
-		buffer << f.rdbuf();
-		return buffer.str();
+		return loadShaderSource(fname);
 	}
 public:
-	Skybox(int size);
+	// Picks the random look of the sky; the faces are generated by
+	// generateFace() (any thread) or at the latest by init()
+	Skybox(int size) : Skybox(size, std::random_device()()) {}
+	Skybox(int size, unsigned int seed);
+
+	void generateSkybox() { generator.generateSkybox(); }
+	void generateFace(int face) { generator.generateFace(face); }
+	SkyboxGenerator& getGenerator() { return generator; }
 
 	void saveimg();
 	unsigned int loadCubemap();
 	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp);
 	void init();
 	void genMesh();
-	void getNebulaeColor();
 
 };
 
-Skybox::Skybox(int size) {
-	// Create random number generators for each property of the skymap
-	std::random_device rd;
-	std::default_random_engine e1(rd());
-	std::uniform_real_distribution<float> randStarDensity(0.01f, 0.1f);
-	std::uniform_real_distribution<float> randBrightness(0.01f, 0.5f);
-	std::uniform_real_distribution<float> randNebulaeDensity(0.01, 0.4);
-	std::uniform_real_distribution<float> randFalloff(2.0, 8.0);
-	std::uniform_real_distribution<float> randPeriod(100, 300);
-
-	// Sets the value for each property
-	this->size =size;
-	this->starDensity = randStarDensity(e1);
-	this->brightness = randBrightness(e1);
-	this->nebulaeDensity = randNebulaeDensity(e1);
-	this->falloff = randFalloff(e1);
-	this->period = randPeriod(e1);
-
-	// sets the color to black for each texture
-	for (int i = 0; i < size; ++i) {
-		for (int j = 0; j < size; ++j) {
-			image_front.push_back(Vec3(0.0, 0.0, 0.0));
-			image_back.push_back(Vec3(0.0, 0.0, 0.0));
-			image_left.push_back(Vec3(0.0, 0.0, 0.0));
-			image_right.push_back(Vec3(0.0, 0.0, 0.0));
-			image_up.push_back(Vec3(0.0, 0.0, 0.0));
-			image_down.push_back(Vec3(0.0, 0.0, 0.0));
-		}
-	}
-
-	generateSkybox();
-	saveimg();
+Skybox::Skybox(int size, unsigned int seed) : generator(size, seed) {
+	this->size = size;
 }
 
 // Loads the shaders + inits objects i.e. Shader and GPUMesh
 void Skybox::init() {
+	for (int i = 0; i < SKYBOX_FACES; ++i) {
+		if (!generator.hasFace(i)) generateFace(i);
+	}
 	loadCubemap();
 
 	shader = std::unique_ptr<Shader>(new Shader());
@@ -135,17 +94,17 @@ void Skybox::genMesh() {
 	std::vector<unsigned int> indices = { 3, 2, 6, 7, 4, 2, 0, 3, 1, 6, 5, 4, 1, 0 };
 	glMesh->set_vbo<Vec3>("vposition", points);
 	glMesh->set_triangles(indices);
+	numIndices = (int)indices.size();
 }
 
 // Loads the cube map
 unsigned int Skybox::loadCubemap() {
+	TRACE_SCOPE("skybox upload");
 	glGenTextures(1, &skyboxID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxID);
 
-	for (unsigned int i = 0; i < textureFiles.size(); i++) {
-		std::vector<unsigned char> image;
-		loadTexture(image, textureFiles[i].c_str());
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image[0]);
+	for (unsigned int i = 0; i < SKYBOX_FACES; i++) {
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &generator.getFaceData(i)[0]);
 	}
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -183,145 +142,26 @@ void Skybox::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
 	glDepthFunc(GL_LESS);
 	glEnable(GL_PRIMITIVE_RESTART);
 	glPrimitiveRestartIndex(999999);
-	glMesh->draw();
+	drawMesh(*glMesh, numIndices, GL_TRIANGLE_STRIP);
 	shader->unbind();
 }
 
-void Skybox::generateSkybox() {
-	// Generate stars for each face of the cube map
-	generateStars(image_front);
-	generateStars(image_back);
-	generateStars(image_left);
-	generateStars(image_right);
-	generateStars(image_up);
-	generateStars(image_down);
-
-	// generates the nebulae
-	getNebulaeColor();
-	generateNebulae();
-}
-
-// Picks a random color for the nebula
-void Skybox::getNebulaeColor() {
-	std::random_device rd;
-	std::default_random_engine e1(rd());
-	std::uniform_int_distribution<int> uniform_dist(20, 200);
-
-	nebulaeColor = Vec3(uniform_dist(e1), uniform_dist(e1), uniform_dist(e1));
-}
-
-// Generates the background stars
-void Skybox::generateStars(std::vector<Vec3>& image) {
-	std::random_device rd;
-	std::default_random_engine e1(rd());
-	std::uniform_int_distribution<int> uniform_dist(0, size * size - 1);
-
-	int numStars = (int)(size * size * starDensity);
-
-	for (int i = 0; i < numStars; ++i) {
-		int pt = uniform_dist(e1);
-		int color = (int)(255 * log(1 - rand() / (float)RAND_MAX) * -brightness);
-		image[pt][0] = color;
-		image[pt][1] = color;
-		image[pt][2] = color;
-	}
-
-}
-
-// generates the nebule
-void Skybox::generateNebulae() {
-	PerlinNoise noise = PerlinNoise(size, size, 8, 2, 0.9, 0.0, 128, 20202);
-
-	for (int y = 0; y < size; ++y) {
-		for (int x = 0; x < size; ++x) {
-			float noise_val = (noise.fBm(Vec3(x / period, y / period, 0)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_down[x + y * size] = lerp(nebulaeColor, image_down[x + y * size], val);
-
-		}
-	}
-
-	for (int y = 0; y < size; ++y) {
-		for (int x = 0; x < size; ++x) {
-			float noise_val = (noise.fBm(Vec3(x / period, y / period, size / period)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_up[x + y * size] = lerp(nebulaeColor, image_up[x + y * size], val);
-
-		}
-	}
-
-	for (int z = 0; z < size; ++z) {
-		for (int x = 0; x < size; ++x) {
-			float noise_val = (noise.fBm(Vec3(x / period, 0, z / period)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_left[x + z * size] = lerp(nebulaeColor, image_left[x + z * size], val);
-
-		}
-	}
-
-	for (int z = 0; z < size; ++z) {
-		for (int x = 0; x < size; ++x) {
-			float noise_val = (noise.fBm(Vec3(x / period, size / period, z / period)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_right[x + z * size] = lerp(nebulaeColor, image_right[x + z * size], val);
-
-		}
-	}
-
-	for (int z = 0; z < size; ++z) {
-		for (int y = 0; y < size; ++y) {
-			float noise_val = (noise.fBm(Vec3(0, y / period, z / period)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_front[y + z * size] = lerp(nebulaeColor, image_front[y + z * size], val);
-
-		}
-	}
-
-	for (int z = 0; z < size; ++z) {
-		for (int y = 0; y < size; ++y) {
-			float noise_val = (noise.fBm(Vec3(size / period, y / period, z / period)) + 1.0) / 2.0;
-			float val = pow(noise_val + nebulaeDensity, falloff);
-			val = (val > 1.0) ? 1.0 : val;
-			image_back[y + z * size] = lerp(nebulaeColor, image_back[y + z * size], val);
-
-		}
-	}
-}
-
-// Saves each face of the cube map
+// Saves each generated face of the cube map. The packed texels are the
+// saved image with its rows flipped, see SkyboxGenerator::packFace()
 void Skybox::saveimg() {
-	MyImage imageBack = MyImage(size, size);
-	MyImage imageFront = MyImage(size, size);
-	MyImage imageUp = MyImage(size, size);
-	MyImage imageDown = MyImage(size, size);
-	MyImage imageLeft = MyImage(size, size);
-	MyImage imageRight = MyImage(size, size);
-
-	std::reverse(image_up.begin(), image_up.end());
-
-	for (int j = 0; j < size; ++j) {
-		for (int i = 0; i < size; ++i) {
-			imageBack(size - 1 - i, j) = cv::Vec3b(image_back[j + i * size][0], image_back[j + i * size][1], image_back[j + i * size][2]);
-			imageFront(size - 1 - i, size - 1 - j) = cv::Vec3b(image_front[j + i * size][0], image_front[j + i * size][1], image_front[j + i * size][2]);
-			imageLeft(size - 1 - i, j) = cv::Vec3b(image_left[j + i * size][0], image_left[j + i * size][1], image_left[j + i * size][2]);
-			imageRight(size - 1 - i, size - 1 - j) = cv::Vec3b(image_right[j + i * size][0], image_right[j + i * size][1], image_right[j + i * size][2]);
-			imageUp(size - 1 - i, j) = cv::Vec3b(image_up[j + i * size][0], image_up[j + i * size][1], image_up[j + i * size][2]);
-			imageDown(size - 1 - i, size - 1 - j) = cv::Vec3b(image_down[j + i * size][0], image_down[j + i * size][1], image_down[j + i * size][2]);
+	const char* names[SKYBOX_FACES] = { "front", "back", "down", "up", "right", "left" };
+	for (int face = 0; face < SKYBOX_FACES; ++face) {
+		if (!generator.hasFace(face)) continue;
+		const std::vector<unsigned char>& data = generator.getFaceData(face);
+		MyImage image = MyImage(size, size);
+		for (int row = 0; row < size; ++row) {
+			for (int col = 0; col < size; ++col) {
+				const unsigned char* texel = &data[4 * (col + (size - 1 - row) * size)];
+				image(row, col) = cv::Vec3b(texel[2], texel[1], texel[0]);
+			}
 		}
-
+		image.save(std::string("./skybox_") + names[face] + ".png");
 	}
-
-	imageFront.save("./skybox_front.png");
-	imageBack.save("./skybox_back.png");
-	imageUp.save("./skybox_up.png");
-	imageDown.save("./skybox_down.png");
-	imageLeft.save("./skybox_left.png");
-	imageRight.save("./skybox_right.png");
 }
 
 #endif
\ No newline at end of file
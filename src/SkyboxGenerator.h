@@ -0,0 +1,187 @@
+#ifndef SKYBOXGENERATOR_H_
+#define SKYBOXGENERATOR_H_
+
+#include <cmath>
+#include <vector>
+#include <random>
+
+#include "PerlinNoise.h"
+#include "Arena.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// Cube map faces, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+enum SkyboxFace {
+	SKYBOX_FRONT = 0,
+	SKYBOX_BACK,
+	SKYBOX_DOWN,
+	SKYBOX_UP,
+	SKYBOX_RIGHT,
+	SKYBOX_LEFT,
+	SKYBOX_FACES
+};
+
+// Generates the faces of the procedural space background: stars plus perlin
+// noise nebulae. Has no GL dependency; the same seed always gives the same sky
+class SkyboxGenerator {
+private:
+	// size of each tile
+	int size;
+	unsigned int seed;
+
+	// Defines the properties of the space background
+	float starDensity, brightness;
+	float nebulaeDensity, falloff;
+	float period;
+
+	// Stores the color for a nebulae
+	Vec3 nebulaeColor = Vec3(75, 0, 130);
+
+	// RGBA texels of each face, ready for glTexImage2D
+	std::vector<unsigned char> faceData[SKYBOX_FACES];
+
+	// Colors of a face in [0, 255], rows of the noise cube side; scratch of
+	// generateFace()
+	typedef ArenaVector<Vec3> FaceImage;
+	void generateStars(int face, FaceImage& image);
+	void generateNebulae(int face, FaceImage& image);
+	void packFace(int face, const FaceImage& image);
+	Vec3 lerp(Vec3 a, Vec3 b, float t) {
+		return a * t + (1 - t) * b;
+	}
+public:
+	// Picks the look of the sky from the seed; the faces are generated by
+	// generateFace()
+	SkyboxGenerator(int size, unsigned int seed);
+
+	void generateSkybox();
+	// Faces are independent, so different faces can be generated
+	// concurrently, each with its own arena if one is given
+	void generateFace(int face, Arena* arena = nullptr);
+	bool hasFace(int face) const { return !faceData[face].empty(); }
+
+	int getSize() const { return size; }
+	unsigned int getSeed() const { return seed; }
+
+	// Texels of a face in cube map orientation
+	const std::vector<unsigned char>& getFaceData(int face) const { return faceData[face]; }
+};
+
+SkyboxGenerator::SkyboxGenerator(int size, unsigned int seed) {
+	// Create random number generators for each property of the skymap
+	std::default_random_engine e1(seed);
+	std::uniform_real_distribution<float> randStarDensity(0.01f, 0.1f);
+	std::uniform_real_distribution<float> randBrightness(0.01f, 0.5f);
+	std::uniform_real_distribution<float> randNebulaeDensity(0.01, 0.4);
+	std::uniform_real_distribution<float> randFalloff(2.0, 8.0);
+	std::uniform_real_distribution<float> randPeriod(100, 300);
+	std::uniform_int_distribution<int> randColor(20, 200);
+
+	// Sets the value for each property
+	this->size = size;
+	this->seed = seed;
+	this->starDensity = randStarDensity(e1);
+	this->brightness = randBrightness(e1);
+	this->nebulaeDensity = randNebulaeDensity(e1);
+	this->falloff = randFalloff(e1);
+	this->period = randPeriod(e1);
+
+	// Picks a random color for the nebula
+	int r = randColor(e1);
+	int g = randColor(e1);
+	int b = randColor(e1);
+	nebulaeColor = Vec3(r, g, b);
+}
+
+void SkyboxGenerator::generateSkybox() {
+	for (int i = 0; i < SKYBOX_FACES; ++i) {
+		generateFace(i);
+	}
+}
+
+// Generates the stars and nebulae of one face of the cube map
+void SkyboxGenerator::generateFace(int face, Arena* arena) {
+	TRACE_SCOPE_ARG("skybox face", "face", face);
+	Arena local;
+	Arena& scratch = arena != nullptr ? *arena : local;
+	ArenaScope scope(scratch);
+	FaceImage image(size * size, Vec3(0.0, 0.0, 0.0), ArenaAllocator<Vec3>(scratch));
+
+	generateStars(face, image);
+	generateNebulae(face, image);
+	packFace(face, image);
+}
+
+// Converts a face to RGBA texels. This matches what saving the face with
+// Skybox::saveimg() and loading the png back used to give: faces are mirrored
+// into the cube map orientation and the channels are in OpenCV's BGR order
+void SkyboxGenerator::packFace(int face, const FaceImage& image) {
+	std::vector<unsigned char>& data = faceData[face];
+	data.resize(4 * size * size);
+
+	bool mirror = face == SKYBOX_FRONT || face == SKYBOX_RIGHT || face == SKYBOX_DOWN;
+
+	for (int i = 0; i < size; ++i) {
+		for (int j = 0; j < size; ++j) {
+			int src = j + i * size;
+			if (face == SKYBOX_UP) src = size * size - 1 - src;
+			int dst = (mirror ? size - 1 - j : j) + i * size;
+
+			for (int c = 0; c < 3; ++c) {
+				float value = image[src][2 - c];
+				data[4 * dst + c] = (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+			}
+			data[4 * dst + 3] = 255;
+		}
+	}
+}
+
+// Generates the background stars. Each face draws from its own generator so
+// the result does not depend on the order faces are generated in
+void SkyboxGenerator::generateStars(int face, FaceImage& image) {
+	std::seed_seq faceSeed = { seed, (unsigned int)face };
+	std::default_random_engine e1(faceSeed);
+	std::uniform_int_distribution<int> uniform_dist(0, size * size - 1);
+	std::uniform_real_distribution<float> uniform_real(0.0f, 1.0f);
+
+	int numStars = (int)(size * size * starDensity);
+
+	for (int i = 0; i < numStars; ++i) {
+		int pt = uniform_dist(e1);
+		int color = (int)(255 * log(1 - uniform_real(e1)) * -brightness);
+		image[pt][0] = color;
+		image[pt][1] = color;
+		image[pt][2] = color;
+	}
+
+}
+
+// generates the nebule on one face
+void SkyboxGenerator::generateNebulae(int face, FaceImage& image) {
+	PerlinNoise noise = PerlinNoise(size, size, 8, 2, 0.9, 0.0, 128, 20202);
+
+	for (int v = 0; v < size; ++v) {
+		for (int u = 0; u < size; ++u) {
+			// Position of the texel on the sides of the noise cube
+			Vec3 coord;
+			switch (face) {
+			case SKYBOX_DOWN: coord = Vec3(u, v, 0); break;
+			case SKYBOX_UP: coord = Vec3(u, v, size); break;
+			case SKYBOX_LEFT: coord = Vec3(u, 0, v); break;
+			case SKYBOX_RIGHT: coord = Vec3(u, size, v); break;
+			case SKYBOX_FRONT: coord = Vec3(0, u, v); break;
+			default: coord = Vec3(size, u, v); break;
+			}
+
+			float noise_val = (noise.fBm(coord / period) + 1.0) / 2.0;
+			float val = pow(noise_val + nebulaeDensity, falloff);
+			val = (val > 1.0) ? 1.0 : val;
+			image[u + v * size] = lerp(nebulaeColor, image[u + v * size], val);
+		}
+	}
+}
+
+#endif
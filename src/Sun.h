@@ -6,6 +6,9 @@
 #include "PerlinNoise.h"
 #include "Icosphere.h"
 #include "loadTexture.h"
+#include "ShaderSource.h"
+#include "FrameProfiler.h"
+#include "RenderStats.h"
 
 #include <OpenGP/GL/Eigen.h>
 #include "OpenGP/GL/Application.h"
@@ -30,10 +33,7 @@ private:
 
 	// Loads a file
 	std::string load_source(const char* fname) {
-		std::ifstream f(fname);
-		std::stringstream buffer;
-		buffer << f.rdbuf();
-		return buffer.str();
+		return loadShaderSource(fname);
 	}
 public:
 	Sun(Icosphere* mesh);
@@ -88,20 +88,23 @@ void Sun::init() {
 
 // Draws the sun
 void Sun::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
-	updateTexture();
+	{
+		ProfileScope scope("sun texture");
+		updateTexture();
+	}
 
 	std::vector<unsigned int> triangle_indices = mesh->genMesh();
 	std::vector<Vec3> vertices = mesh->getVertices();
 	std::vector<Vec3> vnormals = mesh->getVertexNormals();
-	std::vector<Vec2> uvs = mesh->getUvs();
+	const std::vector<Vec2>& uvs = mesh->getUvs();
 
 	float radius = mesh->getRadius();
 
-	glMesh->set_vbo<Vec3>("vposition", vertices);
-	glMesh->set_vbo<Vec3>("vnormal", vnormals);
-	glMesh->set_vbo<float>("noise", noiseMap);
-	glMesh->set_vtexcoord(uvs);
-	glMesh->set_triangles(triangle_indices);
+	uploadVbo<Vec3>(*glMesh, "vposition", vertices);
+	uploadVbo<Vec3>(*glMesh, "vnormal", vnormals);
+	uploadVbo<float>(*glMesh, "noise", noiseMap);
+	uploadTexcoords(*glMesh, uvs);
+	uploadTriangles(*glMesh, triangle_indices);
 
 	shader->bind();
 
@@ -133,7 +136,7 @@ void Sun::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp) {
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); 
 
 	glMesh->set_attributes(*shader);
-	glMesh->draw();
+	drawMesh(*glMesh, triangle_indices.size());
 
 	shader->unbind();
 }
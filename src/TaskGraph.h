@@ -0,0 +1,165 @@
+#ifndef TASKGRAPH_H_
+#define TASKGRAPH_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// A set of named tasks with dependencies. Tasks run on a thread pool as soon
+// as their dependencies finish, except tasks flagged as main thread tasks
+// (anything touching the GL context), which run on the thread calling run().
+class TaskGraph {
+public:
+	typedef int TaskId;
+
+	TaskId add(const std::string& name, std::function<void()> func, const std::vector<TaskId>& dependencies = std::vector<TaskId>(), bool mainThread = false);
+	TaskId addMainThread(const std::string& name, std::function<void()> func, const std::vector<TaskId>& dependencies = std::vector<TaskId>()) {
+		return add(name, func, dependencies, true);
+	}
+
+	// Blocks until every task has run
+	void run(ThreadPool& pool);
+
+	// Wall time of the last run() in milliseconds
+	double getElapsed() const { return elapsed; }
+	void printTimings(std::ostream& out) const;
+
+private:
+	struct Task {
+		std::string name;
+		std::function<void()> func;
+		std::vector<TaskId> dependents;
+		int numDependencies = 0;
+		int pending = 0;
+		bool mainThread = false;
+		bool ranOnMain = false;
+		double start = 0;
+		double end = 0;
+	};
+
+	std::vector<Task> tasks;
+	std::deque<TaskId> mainQueue;
+	int remaining = 0;
+	double elapsed = 0;
+	std::chrono::steady_clock::time_point begin;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	double now() const;
+	void execute(TaskId id, bool onMain);
+	void schedule(TaskId id, ThreadPool& pool);
+	void finish(TaskId id, ThreadPool& pool);
+};
+
+TaskGraph::TaskId TaskGraph::add(const std::string& name, std::function<void()> func, const std::vector<TaskId>& dependencies, bool mainThread) {
+	TaskId id = (TaskId)tasks.size();
+
+	Task task;
+	task.name = name;
+	task.func = func;
+	task.mainThread = mainThread;
+	task.numDependencies = (int)dependencies.size();
+	tasks.push_back(task);
+
+	// Dependencies must already exist, which keeps the graph acyclic
+	for (int i = 0; i < dependencies.size(); ++i) {
+		assert(dependencies[i] >= 0 && dependencies[i] < id);
+		tasks[dependencies[i]].dependents.push_back(id);
+	}
+
+	return id;
+}
+
+double TaskGraph::now() const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void TaskGraph::execute(TaskId id, bool onMain) {
+	tasks[id].start = now();
+	{
+		TRACE_SCOPE(tasks[id].name.c_str());
+		tasks[id].func();
+	}
+	tasks[id].end = now();
+	tasks[id].ranOnMain = onMain;
+}
+
+void TaskGraph::schedule(TaskId id, ThreadPool& pool) {
+	// Without workers everything runs on the calling thread
+	if (tasks[id].mainThread || pool.getThreadCount() == 0) {
+		mainQueue.push_back(id);
+		condition.notify_all();
+		return;
+	}
+
+	pool.submit([this, id, &pool]() {
+		execute(id, false);
+		finish(id, pool);
+	});
+}
+
+void TaskGraph::finish(TaskId id, ThreadPool& pool) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (int i = 0; i < tasks[id].dependents.size(); ++i) {
+		TaskId dependent = tasks[id].dependents[i];
+		if (--tasks[dependent].pending == 0) schedule(dependent, pool);
+	}
+
+	if (--remaining == 0) condition.notify_all();
+}
+
+void TaskGraph::run(ThreadPool& pool) {
+	begin = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		remaining = (int)tasks.size();
+		mainQueue.clear();
+		for (int i = 0; i < tasks.size(); ++i) tasks[i].pending = tasks[i].numDependencies;
+		for (int i = 0; i < tasks.size(); ++i) {
+			if (tasks[i].pending == 0) schedule(i, pool);
+		}
+	}
+
+	while (true) {
+		TaskId id;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return remaining == 0 || !mainQueue.empty(); });
+			if (mainQueue.empty()) break;
+			id = mainQueue.front();
+			mainQueue.pop_front();
+		}
+		execute(id, true);
+		finish(id, pool);
+	}
+
+	elapsed = now();
+}
+
+// Prints when each task ran and how much of the work overlapped
+void TaskGraph::printTimings(std::ostream& out) const {
+	double total = 0;
+	for (int i = 0; i < tasks.size(); ++i) {
+		const Task& task = tasks[i];
+		total += task.end - task.start;
+		out << std::left << std::setw(24) << task.name
+			<< (task.ranOnMain ? " main  " : " worker")
+			<< std::right << std::fixed << std::setprecision(1)
+			<< std::setw(9) << task.start << " ms"
+			<< std::setw(9) << (task.end - task.start) << " ms" << std::endl;
+	}
+	out << "startup graph: " << std::fixed << std::setprecision(1) << elapsed << " ms wall, "
+		<< total << " ms of work" << std::endl;
+}
+
+#endif
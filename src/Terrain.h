@@ -0,0 +1,641 @@
+#ifndef TERRAIN_H_
+#define TERRAIN_H_
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include "PerlinNoise.h"
+#include "Icosphere.h"
+#include "OctaveCache.h"
+#include "VertexGraph.h"
+#include "Erosion.h"
+#include "Hydrology.h"
+#include "TerrainBVH.h"
+#include "Scatter.h"
+#include "MemoryReport.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+// A random seed in the range planets have always been generated with
+unsigned int randomTerrainSeed() {
+	std::random_device rd;
+	std::uniform_int_distribution<int> seed(0, 100000);
+	return seed(rd);
+}
+
+// The noise and shaping parameters of the height map; the defaults are the
+// ones planets have always been generated with
+struct TerrainParams {
+	int octaves = 8;
+	float lacunarity = 2.0f;
+	float H = 0.9f;
+	float offset = 0.0f;
+	// Scale of the features: vertex positions are divided by it
+	float period = 20.0f;
+	// How much the hybrid multifractal raises the continents. A double, as
+	// the constant it replaces was, so default planets stay bit-identical
+	double continent = 0.2;
+
+	bool valid() const {
+		return Noise::validOctaves(octaves) && Noise::validLacunarity(lacunarity) && Noise::validH(H)
+			&& Noise::validOffset(offset) && std::isfinite(period) && period > 0 && std::isfinite(continent);
+	}
+};
+
+// Optional passes after the height map: erosion before the normals, then
+// hydrology on the final heights, the ray-casting BVH and the scattered
+// objects, one Scatter per layer
+struct TerrainStages {
+	bool erosion = false;
+	ErosionParams erosionParams;
+	bool hydrology = false;
+	HydrologyParams hydrologyParams;
+	bool bvh = false;
+	std::vector<ScatterLayer> scatterLayers;
+	int scatterPatchLevel = 2;
+};
+
+enum BrushMode {
+	BRUSH_RAISE,
+	BRUSH_LOWER,
+	// Pulls heights towards their weighted average under the brush
+	BRUSH_FLATTEN,
+	// Pulls each height towards the average of its neighbors
+	BRUSH_SMOOTH
+};
+
+// A sculpting stroke. Only the direction of center from the planet center
+// matters, and radius is measured along the undisplaced sphere
+struct Brush {
+	BrushMode mode = BRUSH_RAISE;
+	Vec3 center = Vec3(0, 0, 1);
+	float radius = 5.0f;
+	// Height added at the center for raise and lower, fraction of the way
+	// to the target height in [0, 1] for flatten and smooth
+	float strength = 0.5f;
+};
+
+// The terrain under a direction from the planet center, interpolated over
+// the face of the mesh it points through
+struct TerrainSample {
+	// Point on the displaced surface, as drawn
+	Vec3 position;
+	float height;
+	Vec3 normal;
+	int face;
+};
+
+// Unit direction from the planet center at a latitude and longitude in
+// radians; latitude is measured from the equator towards +y and longitude
+// from +x towards +z, as the texture coordinates are
+Vec3 directionFromLatLong(float latitude, float longitude) {
+	return Vec3(cos(latitude) * cos(longitude), sin(latitude), cos(latitude) * sin(longitude));
+}
+
+// The vertices a brush touched, in ascending order
+struct TerrainEdit {
+	std::vector<int> heights;
+	std::vector<int> normals;
+};
+
+// A run of consecutive vertices, as uploaded with one glBufferSubData
+struct VertexRange {
+	int first;
+	int count;
+};
+
+// Merges sorted vertex indices into ranges, bridging gaps of up to maxGap
+// vertices: a few unchanged values cost less to upload than another call
+std::vector<VertexRange> vertexRanges(const std::vector<int>& sorted, int maxGap = 16) {
+	std::vector<VertexRange> ranges;
+	for (int i = 0; i < sorted.size(); ++i) {
+		if (!ranges.empty() && sorted[i] - (ranges.back().first + ranges.back().count) <= maxGap) {
+			ranges.back().count = sorted[i] - ranges.back().first + 1;
+		}
+		else {
+			ranges.push_back({ sorted[i], 1 });
+		}
+	}
+	return ranges;
+}
+
+// The CPU side of a planet: the height of every vertex of an icosphere and the
+// normals of the displaced surface. Has no GL dependency, so it can be used
+// headless (see planetgen)
+class Terrain {
+private:
+	Icosphere* mesh = nullptr;
+	unsigned int seed;
+	TerrainParams params;
+	OctaveCache* octaveCache = nullptr;
+	Arena* arena = nullptr;
+
+	std::vector<float> heightMap;
+	std::vector<Vec3> surfaceNormals;
+	Hydrology hydrology;
+	TerrainBVH bvh;
+	std::vector<Scatter> scatters;
+
+	// Connectivity for erosion, hydrology and editing, built when one first
+	// needs it; positions and faces are read from the mesh. Faces around
+	// each vertex are in ascending order so a local normal update sums them
+	// like calcSurfaceNormals() does and gives the same result
+	VertexGraph graph;
+	// Stroke that last reached each vertex, so a stroke only visits its
+	// region instead of clearing a flag per vertex
+	std::vector<unsigned int> brushStamps;
+	unsigned int brushStamp = 0;
+
+	void buildAdjacency();
+	void calcSurfaceNormal(int vertex);
+
+	float shapeHeight(float perlin_noise, float continent) const;
+	float smax(float a, float b, float t) const;
+	float lerp(float a, float b, float t) const;
+
+public:
+	Terrain(Icosphere* mesh, unsigned int seed);
+
+	void setMesh(Icosphere* mesh) {
+		this->mesh = mesh;
+		graph = VertexGraph();
+		brushStamps.clear();
+		bvh.clear();
+		scatters.clear();
+	}
+	Icosphere* getMesh() const { return this->mesh; }
+
+	void setSeed(unsigned int seed) { this->seed = seed; }
+	unsigned int getSeed() const { return this->seed; }
+
+	// Takes effect on the next calcHeightMap(); returns false and keeps the
+	// current parameters if params is not valid()
+	bool setParams(const TerrainParams& params);
+	const TerrainParams& getParams() const { return this->params; }
+
+	// Optional; lets calcHeightMap() reuse the octaves a parameter change
+	// did not affect. Not owned, and must not be shared by terrains
+	// generating concurrently
+	void setOctaveCache(OctaveCache* cache) { this->octaveCache = cache; }
+	OctaveCache* getOctaveCache() { return this->octaveCache; }
+
+	// Optional; calcSurfaceNormals() takes its scratch memory from it and
+	// gives it back before returning. Not owned, and must not be shared by
+	// terrains generating concurrently
+	void setArena(Arena* arena) { this->arena = arena; }
+	Arena* getArena() { return this->arena; }
+
+	// Drops the vertex graph and the brush's stamps, which the next
+	// erosion, hydrology pass or brush stroke rebuilds
+	void compact() {
+		graph = VertexGraph();
+		std::vector<unsigned int>().swap(brushStamps);
+	}
+	void reportMemory(MemoryReport& report, const std::string& name) const;
+
+	void generate() {
+		calcHeightMap();
+		calcSurfaceNormals();
+	}
+	void generate(const TerrainStages& stages, ThreadPool& pool);
+
+	void calcHeightMap();
+	const std::vector<float>& getHeightMap() const { return this->heightMap; }
+	// A height map made elsewhere, e.g. decoded by HeightfieldCodec, one
+	// height per vertex of the mesh; call calcSurfaceNormals() afterwards
+	void setHeightMap(std::vector<float> heights) {
+		heightMap = std::move(heights);
+		bvh.clear();
+		scatters.clear();
+	}
+
+	// The height function calcHeightMap() evaluates at the vertices, for
+	// any point of the undisplaced sphere, e.g. to export rasters at a
+	// resolution the mesh does not have. noise is noise(), made once
+	PerlinNoise noise() const;
+	float height(const PerlinNoise& noise, const Vec3& point) const;
+
+	void calcSurfaceNormals();
+	const std::vector<Vec3>& getSurfaceNormals() const { return this->surfaceNormals; }
+
+	// Changes the heights under the brush and recomputes the normals of the
+	// changed vertices and their neighbors; the rest of the planet is not
+	// touched. Needs a generated height map
+	TerrainEdit applyBrush(const Brush& brush);
+
+	// Runs hydraulic then thermal erosion on the height map; call
+	// calcSurfaceNormals() afterwards
+	void erode(const ErosionParams& params, ThreadPool& pool);
+
+	// Rivers and lakes of the current height map. Not kept up to date by
+	// brush edits
+	void calcHydrology(const HydrologyParams& params);
+	const Hydrology& getHydrology() const { return this->hydrology; }
+
+	// Places every layer on the current surface; needs the normals. Not
+	// kept up to date by brush edits, and dropped by a new height map
+	void scatter(const std::vector<ScatterLayer>& layers, int patchLevel, ThreadPool& pool);
+	const std::vector<Scatter>& getScatters() const { return this->scatters; }
+
+	// Height, normal and surface point in direction from the planet center,
+	// in O(level) with Icosphere::locateFace(). Needs a generated height map
+	// and normals
+	TerrainSample sample(Vec3 direction) const;
+	// sample() for every direction, split over the pool
+	void sample(const std::vector<Vec3>& directions, std::vector<TerrainSample>& samples, ThreadPool& pool) const;
+
+	// BVH over the displaced surface for ray casting; needs the normals.
+	// Brush edits refit it, a new height map drops it
+	void buildBVH(ThreadPool& pool);
+	const TerrainBVH& getBVH() const { return this->bvh; }
+
+	// Closest hit of the ray on the displaced surface with its smooth
+	// normal; false if it misses or there is no BVH
+	bool raycast(const Ray& ray, RayHit& hit) const;
+	// raycast() for every ray, in packets split over the pool
+	void raycast(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const;
+};
+
+Terrain::Terrain(Icosphere* mesh, unsigned int seed) {
+	this->mesh = mesh;
+	this->seed = seed;
+}
+
+bool Terrain::setParams(const TerrainParams& params) {
+	if (!params.valid()) return false;
+	this->params = params;
+	return true;
+}
+
+float Terrain::smax(float a, float b, float t) const {
+	return log(exp(a * t) + exp(a * t) - 1.0f) / t;
+}
+
+float Terrain::lerp(float a, float b, float t) const {
+	return a * t + (1 - t) * b;
+}
+
+PerlinNoise Terrain::noise() const {
+	return PerlinNoise(2048, 2048, params.octaves, params.lacunarity, params.H, params.offset, 512, seed);
+}
+
+float Terrain::height(const PerlinNoise& noise, const Vec3& point) const {
+	float period = params.period;
+	float perlin_noise = noise.fBm(point / period);
+	float continent = noise.hybridMultifractal(point / period) * params.continent;
+	return shapeHeight(perlin_noise, continent);
+}
+
+void Terrain::calcHeightMap() {
+	TRACE_SCOPE_ARG("heightmap", "seed", seed);
+	PerlinNoise noise = this->noise();
+	float period = params.period;
+
+	const std::vector<Vec3>& vertices = mesh->getVertices();
+
+	heightMap.clear();
+	heightMap.reserve(vertices.size());
+	bvh.clear();
+	scatters.clear();
+	if (octaveCache != nullptr) {
+		std::vector<Vec3> points(vertices.size());
+		for (int i = 0; i < vertices.size(); ++i) points[i] = vertices[i] / period;
+
+		std::vector<float> fBm, hybrid;
+		octaveCache->evaluate(noise, mesh, seed, period, points, params.octaves, params.lacunarity, params.H, params.offset, fBm, hybrid);
+		for (int i = 0; i < vertices.size(); ++i) {
+			heightMap.push_back(shapeHeight(fBm[i], hybrid[i] * params.continent));
+		}
+		return;
+	}
+
+	for (int i = 0; i < vertices.size(); ++i) {
+		heightMap.push_back(height(noise, vertices[i]));
+	}
+}
+
+// Raises the continents and the mountains above them
+float Terrain::shapeHeight(float perlin_noise, float continent) const {
+	if (perlin_noise > -0.1f) {
+		perlin_noise += lerp(0, continent, perlin_noise);
+	}
+
+	if (perlin_noise > 0.4) {
+		perlin_noise += lerp(0.0, 0.3, (perlin_noise - 0.4));
+	}
+
+	return perlin_noise * powf(mesh->getRadius(), 0.5);
+}
+
+// Averages the normals of the faces around each vertex of the displaced
+// surface, in one pass over the faces
+void Terrain::calcSurfaceNormals() {
+	TRACE_SCOPE_ARG("normals", "seed", seed);
+	const std::vector<Vec3>& vertices = mesh->getVertices();
+	Vec3 center = mesh->getCenter();
+	int numFaces = 20 << (2 * mesh->getRecursions());
+
+	Arena local;
+	Arena& scratch = arena != nullptr ? *arena : local;
+	ArenaScope scope(scratch);
+	ArenaVector<Vec3> displaced(vertices.size(), Vec3(0, 0, 0), ArenaAllocator<Vec3>(scratch));
+	for (int i = 0; i < vertices.size(); ++i) {
+		displaced[i] = vertices[i] + (vertices[i] - center).normalized() * heightMap[i];
+	}
+
+	ArenaVector<Vec3> sums(vertices.size(), Vec3(0, 0, 0), ArenaAllocator<Vec3>(scratch));
+	ArenaVector<int> counts(vertices.size(), 0, ArenaAllocator<int>(scratch));
+
+	for (int j = 0; j < numFaces; ++j) {
+		const Face& face = mesh->getFace(j);
+		int a = face.vertices[0];
+		int b = face.vertices[1];
+		int c = face.vertices[2];
+
+		Vec3 normal = (displaced[b] - displaced[a]).cross(displaced[c] - displaced[a]);
+		sums[a] += normal;
+		sums[b] += normal;
+		sums[c] += normal;
+		counts[a]++;
+		counts[b]++;
+		counts[c]++;
+	}
+
+	surfaceNormals.resize(vertices.size());
+	for (int i = 0; i < vertices.size(); ++i) {
+		Vec3 avg = sums[i] / (float)counts[i];
+		surfaceNormals[i] = avg.normalized();
+	}
+}
+
+void Terrain::buildAdjacency() {
+	TRACE_SCOPE("adjacency");
+	graph.build(mesh->genMesh(), mesh->getVertices().size());
+}
+
+void Terrain::reportMemory(MemoryReport& report, const std::string& name) const {
+	report.add(name + "/heights", vectorBytes(heightMap));
+	report.add(name + "/normals", vectorBytes(surfaceNormals));
+	report.add(name + "/graph", graph.getMemoryBytes() + vectorBytes(brushStamps));
+	report.add(name + "/hydrology", hydrology.getMemoryBytes());
+	report.add(name + "/bvh", bvh.getMemoryBytes());
+	size_t scatterBytes = vectorBytes(scatters);
+	for (const Scatter& scatter : scatters) scatterBytes += scatter.getMemoryBytes();
+	report.add(name + "/scatter", scatterBytes);
+	if (arena != nullptr) report.add(name + "/scratch", arena->getStats().capacity, arena->getStats().peakBytes);
+}
+
+void Terrain::erode(const ErosionParams& params, ThreadPool& pool) {
+	TRACE_SCOPE_ARG("erosion", "seed", seed);
+	if (heightMap.empty()) return;
+	if (graph.empty()) buildAdjacency();
+
+	Erosion erosion(graph, mesh->getVertices(), params);
+	erosion.erode(heightMap, pool);
+	bvh.clear();
+	scatters.clear();
+}
+
+void Terrain::calcHydrology(const HydrologyParams& params) {
+	if (heightMap.empty()) return;
+	if (graph.empty()) buildAdjacency();
+	hydrology.compute(graph, heightMap, params);
+}
+
+void Terrain::generate(const TerrainStages& stages, ThreadPool& pool) {
+	calcHeightMap();
+	if (stages.erosion) erode(stages.erosionParams, pool);
+	calcSurfaceNormals();
+	if (stages.hydrology) calcHydrology(stages.hydrologyParams);
+	if (stages.bvh) buildBVH(pool);
+	if (!stages.scatterLayers.empty()) scatter(stages.scatterLayers, stages.scatterPatchLevel, pool);
+}
+
+void Terrain::scatter(const std::vector<ScatterLayer>& layers, int patchLevel, ThreadPool& pool) {
+	if (surfaceNormals.empty()) return;
+	scatters.assign(layers.size(), Scatter());
+	for (int i = 0; i < layers.size(); ++i) {
+		// Every planet seed scatters differently
+		ScatterLayer layer = layers[i];
+		layer.seed = erosionHash(seed, layer.seed);
+		scatters[i].place(*this, layer, patchLevel, pool);
+	}
+}
+
+void Terrain::buildBVH(ThreadPool& pool) {
+	if (heightMap.empty()) return;
+	std::vector<Vec3> vertices = mesh->getVertices();
+	Vec3 center = mesh->getCenter();
+	pool.parallelFor(0, (int)vertices.size(), 4096, [&](int i) {
+		vertices[i] += (vertices[i] - center).normalized() * heightMap[i];
+	});
+	bvh.build(mesh->genMesh(), vertices, mesh->getRecursions(), pool);
+}
+
+bool Terrain::raycast(const Ray& ray, RayHit& hit) const {
+	if (!bvh.intersect(ray, hit)) return false;
+	const Face& corners = mesh->getFace(hit.face);
+	hit.normal = ((1 - hit.u - hit.v) * surfaceNormals[corners.vertices[0]] + hit.u * surfaceNormals[corners.vertices[1]]
+		+ hit.v * surfaceNormals[corners.vertices[2]]).normalized();
+	return true;
+}
+
+void Terrain::raycast(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const {
+	bvh.intersect(rays, hits, pool);
+	pool.parallelFor(0, (int)hits.size(), 1024, [&](int i) {
+		if (!hits[i].hit) return;
+		const Face& corners = mesh->getFace(hits[i].face);
+		hits[i].normal = ((1 - hits[i].u - hits[i].v) * surfaceNormals[corners.vertices[0]] + hits[i].u * surfaceNormals[corners.vertices[1]]
+			+ hits[i].v * surfaceNormals[corners.vertices[2]]).normalized();
+	});
+}
+
+TerrainSample Terrain::sample(Vec3 direction) const {
+	Vec3 center = mesh->getCenter();
+	int face = mesh->locateFace(direction);
+	const Face& corners = mesh->getFace(face);
+	Vec3 a = mesh->getVertex(corners.vertices[0]) - center;
+	Vec3 b = mesh->getVertex(corners.vertices[1]) - center;
+	Vec3 c = mesh->getVertex(corners.vertices[2]) - center;
+
+	// Barycentric coordinates of where the ray along direction crosses the
+	// face's plane. Clamped, since a direction right on an edge may have
+	// been assigned the face next to it
+	Vec3 e1 = b - a;
+	Vec3 e2 = c - a;
+	Vec3 p = direction.cross(e2);
+	float det = e1.dot(p);
+	float u = 0, v = 0;
+	if (std::abs(det) > 0) {
+		Vec3 q = -a;
+		u = q.dot(p) / det;
+		v = direction.dot(q.cross(e1)) / det;
+	}
+	u = std::max(0.0f, u);
+	v = std::max(0.0f, v);
+	if (u + v > 1) {
+		float sum = u + v;
+		u /= sum;
+		v /= sum;
+	}
+	float w[3] = { 1 - u - v, u, v };
+	Vec3 positions[3] = { a, b, c };
+
+	TerrainSample sample;
+	sample.face = face;
+	sample.height = 0;
+	sample.position = Vec3(0, 0, 0);
+	sample.normal = Vec3(0, 0, 0);
+	for (int i = 0; i < 3; ++i) {
+		int vertex = corners.vertices[i];
+		float height = heightMap[vertex];
+		sample.height += w[i] * height;
+		sample.position += w[i] * (positions[i] + positions[i].normalized() * height);
+		sample.normal += w[i] * surfaceNormals[vertex];
+	}
+	sample.position += center;
+	sample.normal.normalize();
+	return sample;
+}
+
+void Terrain::sample(const std::vector<Vec3>& directions, std::vector<TerrainSample>& samples, ThreadPool& pool) const {
+	TRACE_SCOPE_ARG("terrain samples", "count", (int)directions.size());
+	samples.resize(directions.size());
+	pool.parallelFor(0, (int)directions.size(), 256, [&](int i) {
+		samples[i] = sample(directions[i]);
+	});
+}
+
+// calcSurfaceNormals() for a single vertex
+void Terrain::calcSurfaceNormal(int vertex) {
+	const std::vector<Vec3>& vertices = mesh->getVertices();
+	Vec3 sum(0, 0, 0);
+	for (int k = graph.faceOffsets[vertex]; k < graph.faceOffsets[vertex + 1]; ++k) {
+		const int* face = mesh->getFace(graph.faces[k]).vertices;
+		Vec3 a = vertices[face[0]] + mesh->getVertexNormal(face[0]) * heightMap[face[0]];
+		Vec3 b = vertices[face[1]] + mesh->getVertexNormal(face[1]) * heightMap[face[1]];
+		Vec3 c = vertices[face[2]] + mesh->getVertexNormal(face[2]) * heightMap[face[2]];
+		sum += (b - a).cross(c - a);
+	}
+	Vec3 avg = sum / (float)(graph.faceOffsets[vertex + 1] - graph.faceOffsets[vertex]);
+	surfaceNormals[vertex] = avg.normalized();
+}
+
+TerrainEdit Terrain::applyBrush(const Brush& brush) {
+	TRACE_SCOPE_ARG("brush", "mode", brush.mode);
+	TerrainEdit edit;
+	if (heightMap.empty() || brush.radius <= 0) return edit;
+	if (graph.empty()) buildAdjacency();
+
+	const std::vector<Vec3>& vertices = mesh->getVertices();
+	Vec3 center = mesh->getCenter();
+	float radius = mesh->getRadius();
+	Vec3 direction = (brush.center - center).normalized();
+
+	// Closest corner of the face under the brush, then grow the region from
+	// it through neighbors within the brush radius
+	const Face& face = mesh->getFace(mesh->locateFace(direction));
+	int closest = face.vertices[0];
+	for (int c = 1; c < 3; ++c) {
+		int v = face.vertices[c];
+		if ((vertices[v] - center).dot(direction) > (vertices[closest] - center).dot(direction)) closest = v;
+	}
+
+	if (brushStamps.size() != vertices.size() || brushStamp == ~0u) {
+		brushStamps.assign(vertices.size(), 0);
+		brushStamp = 0;
+	}
+	brushStamp++;
+
+	std::vector<int> region;
+	std::vector<float> weights;
+	std::vector<int> queue(1, closest);
+	brushStamps[closest] = brushStamp;
+	for (int q = 0; q < queue.size(); ++q) {
+		int i = queue[q];
+		float cosine = (vertices[i] - center).normalized().dot(direction);
+		float distance = radius * acos(std::max(-1.0f, std::min(1.0f, cosine)));
+		if (distance > brush.radius && i != closest) continue;
+
+		// Smooth falloff, 1 at the center and 0 at the edge
+		float x = std::min(1.0f, distance / brush.radius);
+		region.push_back(i);
+		weights.push_back((1 - x * x) * (1 - x * x));
+
+		for (int k = graph.neighborOffsets[i]; k < graph.neighborOffsets[i + 1]; ++k) {
+			if (brushStamps[graph.neighbors[k]] != brushStamp) {
+				brushStamps[graph.neighbors[k]] = brushStamp;
+				queue.push_back(graph.neighbors[k]);
+			}
+		}
+	}
+
+	float target = 0;
+	if (brush.mode == BRUSH_FLATTEN) {
+		float total = 0;
+		for (int r = 0; r < region.size(); ++r) {
+			target += heightMap[region[r]] * weights[r];
+			total += weights[r];
+		}
+		target = total > 0 ? target / total : heightMap[closest];
+	}
+
+	// Smoothing reads the heights from before the stroke
+	std::vector<float> updated(region.size());
+	for (int r = 0; r < region.size(); ++r) {
+		int i = region[r];
+		float h = heightMap[i];
+		float amount = std::min(1.0f, brush.strength * weights[r]);
+
+		switch (brush.mode) {
+		case BRUSH_RAISE: h += brush.strength * weights[r]; break;
+		case BRUSH_LOWER: h -= brush.strength * weights[r]; break;
+		case BRUSH_FLATTEN: h += (target - h) * amount; break;
+		case BRUSH_SMOOTH: {
+			float sum = 0;
+			for (int k = graph.neighborOffsets[i]; k < graph.neighborOffsets[i + 1]; ++k) sum += heightMap[graph.neighbors[k]];
+			float average = sum / (graph.neighborOffsets[i + 1] - graph.neighborOffsets[i]);
+			h += (average - h) * amount;
+			break;
+		}
+		}
+		updated[r] = h;
+	}
+
+	for (int r = 0; r < region.size(); ++r) {
+		if (updated[r] != heightMap[region[r]]) {
+			heightMap[region[r]] = updated[r];
+			edit.heights.push_back(region[r]);
+		}
+	}
+	std::sort(edit.heights.begin(), edit.heights.end());
+
+	// A height change moves the faces around the vertex, which changes the
+	// normals of the vertex and its one-ring
+	for (int n = 0; n < edit.heights.size(); ++n) {
+		int i = edit.heights[n];
+		edit.normals.push_back(i);
+		edit.normals.insert(edit.normals.end(), graph.neighbors.begin() + graph.neighborOffsets[i], graph.neighbors.begin() + graph.neighborOffsets[i + 1]);
+	}
+	std::sort(edit.normals.begin(), edit.normals.end());
+	edit.normals.erase(std::unique(edit.normals.begin(), edit.normals.end()), edit.normals.end());
+
+	for (int n = 0; n < edit.normals.size(); ++n) calcSurfaceNormal(edit.normals[n]);
+
+	if (!bvh.empty()) {
+		std::vector<Vec3> displaced(edit.heights.size());
+		for (int n = 0; n < edit.heights.size(); ++n) {
+			int i = edit.heights[n];
+			displaced[n] = vertices[i] + mesh->getVertexNormal(i) * heightMap[i];
+		}
+		bvh.moveVertices(edit.heights, displaced, graph);
+	}
+	return edit;
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef TERRAINBVH_H_
+#define TERRAINBVH_H_
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "VertexGraph.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <OpenGP/GL/Eigen.h>
+
+using namespace OpenGP;
+
+struct Ray {
+	Vec3 origin;
+	// Need not be normalized; distances are in units of its length
+	Vec3 direction;
+	float maxDistance = std::numeric_limits<float>::infinity();
+};
+
+struct RayHit {
+	bool hit = false;
+	float distance = std::numeric_limits<float>::infinity();
+	Vec3 position = Vec3(0, 0, 0);
+	// Smooth normal of the surface at the hit, filled in by Terrain
+	Vec3 normal = Vec3(0, 0, 0);
+	int face = -1;
+	// Barycentric coordinates of the hit on the face: the weights of its
+	// second and third corners
+	float u = 0, v = 0;
+};
+
+// Bounding volume hierarchy over the displaced triangles of an icosphere
+// terrain. It follows the subdivision instead of sorting triangles: the
+// children of face j are faces 4j to 4j + 3 of the next level, so a node
+// of the tree is a patch of faces with consecutive indices, and the 20
+// icosahedron faces are its roots. Leaves are patches of LEAF_SIZE
+// triangles.
+//
+// Data is laid out for the traversal: the boxes of the 4 children of a
+// node are stored together, and a leaf stores its triangles' corners and
+// edges, so a ray tests 4 boxes or a whole leaf in one loop the compiler
+// vectorizes, reading contiguous memory. Building is a bottom-up pass over
+// the patches with no sorting, split over a thread pool; brush edits refit
+// only the patches they touch. Batches of rays are traversed in packets of
+// PACKET_SIZE, which share the node visits of coherent rays
+class TerrainBVH {
+public:
+	static const int LEAF_SIZE = 16;
+	static const int PACKET_SIZE = 8;
+private:
+	// Boxes of 4 sibling nodes, one coordinate per lane
+	struct BoxGroup {
+		float lo[3][4];
+		float hi[3][4];
+	};
+	// A patch of triangles as corner a and edges b - a, c - a. Patches of
+	// meshes with fewer levels are padded with degenerate triangles, which
+	// are never hit
+	struct Leaf {
+		float a[3][LEAF_SIZE];
+		float e1[3][LEAF_SIZE];
+		float e2[3][LEAF_SIZE];
+	};
+
+	std::vector<unsigned int> indices;
+	std::vector<Vec3> positions;
+	// Level l of the tree has 20 * 4^l nodes, in groups of 4 siblings
+	// starting at groupOffsets[l]; the nodes of the last level are leaves
+	std::vector<BoxGroup> groups;
+	std::vector<int> groupOffsets;
+	std::vector<Leaf> leaves;
+	int depth = 0;
+	// log4 of the faces in a leaf
+	int leafLevels = 0;
+
+	void fitLeaf(int leaf);
+	void fitNode(int level, int node);
+	void setBox(int level, int node, const Vec3& lo, const Vec3& hi);
+
+	// Distance at which the ray enters each box of a group, infinity for
+	// the ones it misses before farthest
+	void enter(const BoxGroup& group, const Vec3& origin, const Vec3& inverse, float farthest, float* near) const;
+	// Closest triangle of the leaf the ray hits before farthest, or -1
+	int intersectLeaf(const Leaf& leaf, const Vec3& origin, const Vec3& direction, float farthest, float& distance, float& u, float& v) const;
+	void intersectPacket(const Ray* rays, RayHit* hits, int count, bool anyHit) const;
+public:
+	// indices are the faces of an icosphere with recursions levels, in the
+	// order it creates them, and positions its displaced vertices
+	void build(const std::vector<unsigned int>& indices, const std::vector<Vec3>& positions, int recursions, ThreadPool& pool);
+	bool empty() const { return leaves.empty(); }
+	void clear();
+	size_t getMemoryBytes() const {
+		return indices.capacity() * sizeof(unsigned int) + positions.capacity() * sizeof(Vec3) + groups.capacity() * sizeof(BoxGroup)
+			+ groupOffsets.capacity() * sizeof(int) + leaves.capacity() * sizeof(Leaf);
+	}
+
+	// Moves vertices to new positions and refits the patches around them;
+	// graph gives the faces around each vertex
+	void moveVertices(const std::vector<int>& vertices, const std::vector<Vec3>& newPositions, const VertexGraph& graph);
+
+	// Closest hit along the ray within its maxDistance; the normal is left
+	// to the caller
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	// Whether anything is hit within maxDistance; stops at the first hit
+	bool occluded(const Ray& ray) const;
+	// intersect() for every ray, in packets split over the pool. Rays close
+	// in the array should be close in space for packets to pay off
+	void intersect(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const;
+
+	const std::vector<Vec3>& getPositions() const { return positions; }
+	int getNumLeaves() const { return leaves.size(); }
+};
+
+void TerrainBVH::clear() {
+	indices = std::vector<unsigned int>();
+	positions = std::vector<Vec3>();
+	groups = std::vector<BoxGroup>();
+	leaves = std::vector<Leaf>();
+	groupOffsets.clear();
+}
+
+void TerrainBVH::setBox(int level, int node, const Vec3& lo, const Vec3& hi) {
+	BoxGroup& group = groups[groupOffsets[level] + node / 4];
+	for (int axis = 0; axis < 3; ++axis) {
+		group.lo[axis][node % 4] = lo[axis];
+		group.hi[axis][node % 4] = hi[axis];
+	}
+}
+
+void TerrainBVH::fitLeaf(int leaf) {
+	Leaf& data = leaves[leaf];
+	int first = leaf << (2 * leafLevels);
+	int count = 1 << (2 * leafLevels);
+	Vec3 lo = positions[indices[3 * first]];
+	Vec3 hi = lo;
+	for (int t = 0; t < LEAF_SIZE; ++t) {
+		if (t >= count) {
+			for (int axis = 0; axis < 3; ++axis) data.a[axis][t] = data.e1[axis][t] = data.e2[axis][t] = 0;
+			continue;
+		}
+		int face = first + t;
+		const Vec3& a = positions[indices[3 * face]];
+		const Vec3& b = positions[indices[3 * face + 1]];
+		const Vec3& c = positions[indices[3 * face + 2]];
+		for (int axis = 0; axis < 3; ++axis) {
+			data.a[axis][t] = a[axis];
+			data.e1[axis][t] = b[axis] - a[axis];
+			data.e2[axis][t] = c[axis] - a[axis];
+		}
+		lo = lo.cwiseMin(a).cwiseMin(b).cwiseMin(c);
+		hi = hi.cwiseMax(a).cwiseMax(b).cwiseMax(c);
+	}
+	setBox(depth, leaf, lo, hi);
+}
+
+void TerrainBVH::fitNode(int level, int node) {
+	const BoxGroup& children = groups[groupOffsets[level + 1] + node];
+	Vec3 lo, hi;
+	for (int axis = 0; axis < 3; ++axis) {
+		lo[axis] = std::min(std::min(children.lo[axis][0], children.lo[axis][1]), std::min(children.lo[axis][2], children.lo[axis][3]));
+		hi[axis] = std::max(std::max(children.hi[axis][0], children.hi[axis][1]), std::max(children.hi[axis][2], children.hi[axis][3]));
+	}
+	setBox(level, node, lo, hi);
+}
+
+void TerrainBVH::build(const std::vector<unsigned int>& indices, const std::vector<Vec3>& positions, int recursions, ThreadPool& pool) {
+	TRACE_SCOPE_ARG("terrain bvh", "level", recursions);
+	this->indices = indices;
+	this->positions = positions;
+
+	leafLevels = std::min(recursions, 2);
+	depth = recursions - leafLevels;
+	groupOffsets.resize(depth + 2);
+	groupOffsets[0] = 0;
+	for (int l = 0; l <= depth; ++l) groupOffsets[l + 1] = groupOffsets[l] + (5 << (2 * l));
+	groups.resize(groupOffsets[depth + 1]);
+	leaves.resize(20 << (2 * depth));
+
+	// Every node of a level is fitted from the level below; a group is
+	// written by one thread
+	pool.parallelFor(0, leaves.size() / 4, 64, [this](int group) {
+		for (int c = 0; c < 4; ++c) fitLeaf(4 * group + c);
+	});
+	for (int l = depth - 1; l >= 0; --l) {
+		pool.parallelFor(0, 5 << (2 * l), 64, [this, l](int group) {
+			for (int c = 0; c < 4; ++c) fitNode(l, 4 * group + c);
+		});
+	}
+}
+
+void TerrainBVH::moveVertices(const std::vector<int>& vertices, const std::vector<Vec3>& newPositions, const VertexGraph& graph) {
+	if (empty()) return;
+	std::vector<int> nodes;
+	for (int i = 0; i < vertices.size(); ++i) {
+		int vertex = vertices[i];
+		positions[vertex] = newPositions[i];
+		for (int k = graph.faceOffsets[vertex]; k < graph.faceOffsets[vertex + 1]; ++k) {
+			nodes.push_back(graph.faces[k] >> (2 * leafLevels));
+		}
+	}
+
+	// Refit the touched leaves, then their parents level by level
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+	for (int i = 0; i < nodes.size(); ++i) fitLeaf(nodes[i]);
+	for (int l = depth - 1; l >= 0; --l) {
+		for (int i = 0; i < nodes.size(); ++i) nodes[i] >>= 2;
+		nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+		for (int i = 0; i < nodes.size(); ++i) fitNode(l, nodes[i]);
+	}
+}
+
+void TerrainBVH::enter(const BoxGroup& group, const Vec3& origin, const Vec3& inverse, float farthest, float* near) const {
+	float ox = origin[0], oy = origin[1], oz = origin[2];
+	float ix = inverse[0], iy = inverse[1], iz = inverse[2];
+	// One box per lane. A zero direction on a box's plane gives NaN, which
+	// std::max and std::min ignore as their second argument
+	float enters[4];
+	for (int c = 0; c < 4; ++c) {
+		float x0 = (group.lo[0][c] - ox) * ix, x1 = (group.hi[0][c] - ox) * ix;
+		float y0 = (group.lo[1][c] - oy) * iy, y1 = (group.hi[1][c] - oy) * iy;
+		float z0 = (group.lo[2][c] - oz) * iz, z1 = (group.hi[2][c] - oz) * iz;
+		float entry = std::max(std::max(std::max(0.0f, std::min(x0, x1)), std::min(y0, y1)), std::min(z0, z1));
+		float exit = std::min(std::min(std::min(farthest, std::max(x0, x1)), std::max(y0, y1)), std::max(z0, z1));
+		enters[c] = entry <= exit ? entry : std::numeric_limits<float>::infinity();
+	}
+	for (int c = 0; c < 4; ++c) near[c] = enters[c];
+}
+
+// Möller-Trumbore on every triangle of the leaf at once, accepting both
+// sides so rays from below the surface hit it too
+int TerrainBVH::intersectLeaf(const Leaf& leaf, const Vec3& origin, const Vec3& direction, float farthest, float& distance, float& u, float& v) const {
+	float ts[LEAF_SIZE], us[LEAF_SIZE], vs[LEAF_SIZE];
+	float dx = direction[0], dy = direction[1], dz = direction[2];
+	for (int i = 0; i < LEAF_SIZE; ++i) {
+		float px = dy * leaf.e2[2][i] - dz * leaf.e2[1][i];
+		float py = dz * leaf.e2[0][i] - dx * leaf.e2[2][i];
+		float pz = dx * leaf.e2[1][i] - dy * leaf.e2[0][i];
+		float det = leaf.e1[0][i] * px + leaf.e1[1][i] * py + leaf.e1[2][i] * pz;
+		float inverse = 1.0f / det;
+
+		float tx = origin[0] - leaf.a[0][i];
+		float ty = origin[1] - leaf.a[1][i];
+		float tz = origin[2] - leaf.a[2][i];
+		float ui = (tx * px + ty * py + tz * pz) * inverse;
+
+		float qx = ty * leaf.e1[2][i] - tz * leaf.e1[1][i];
+		float qy = tz * leaf.e1[0][i] - tx * leaf.e1[2][i];
+		float qz = tx * leaf.e1[1][i] - ty * leaf.e1[0][i];
+		float vi = (dx * qx + dy * qy + dz * qz) * inverse;
+		float ti = (leaf.e2[0][i] * qx + leaf.e2[1][i] * qy + leaf.e2[2][i] * qz) * inverse;
+
+		// Not short-circuited, so the loop has no branches
+		bool hit = (det != 0) & (ui >= 0) & (vi >= 0) & (ui + vi <= 1) & (ti >= 0) & (ti <= farthest);
+		ts[i] = hit ? ti : std::numeric_limits<float>::infinity();
+		us[i] = ui;
+		vs[i] = vi;
+	}
+
+	int closest = -1;
+	for (int i = 0; i < LEAF_SIZE; ++i) {
+		if (ts[i] < std::numeric_limits<float>::infinity() && (closest < 0 || ts[i] < ts[closest])) closest = i;
+	}
+	if (closest >= 0) {
+		distance = ts[closest];
+		u = us[closest];
+		v = vs[closest];
+	}
+	return closest;
+}
+
+bool TerrainBVH::intersect(const Ray& ray, RayHit& hit) const {
+	RayHit result;
+	result.distance = ray.maxDistance;
+	intersectPacket(&ray, &result, 1, false);
+	hit = result;
+	return hit.hit;
+}
+
+bool TerrainBVH::occluded(const Ray& ray) const {
+	RayHit result;
+	result.distance = ray.maxDistance;
+	intersectPacket(&ray, &result, 1, true);
+	return result.hit;
+}
+
+// Traverses the tree once for up to PACKET_SIZE rays: a node is opened when
+// any of them enters it before its closest hit so far, and children are
+// visited nearest first for the ray entering them earliest. hits[i].distance
+// must hold the ray's maxDistance on entry. With anyHit, stops at the first
+// hit of each ray
+void TerrainBVH::intersectPacket(const Ray* rays, RayHit* hits, int count, bool anyHit) const {
+	if (empty()) return;
+	Vec3 inverse[PACKET_SIZE];
+	for (int r = 0; r < count; ++r) inverse[r] = rays[r].direction.cwiseInverse();
+
+	struct Entry { int level, node; float near; };
+	// The roots, then at most 3 siblings left behind per level
+	Entry stack[20 + 3 * 32];
+	int size = 0;
+
+	// Pushes the nodes of groups the rays enter, sorted in place on top of
+	// the stack, farthest first so the nearest is popped next
+	auto push = [&](int level, int firstGroup, int numGroups) {
+		int bottom = size;
+		for (int g = firstGroup; g < firstGroup + numGroups; ++g) {
+			const BoxGroup& group = groups[groupOffsets[level] + g];
+			float nearest[4], near[4];
+			for (int c = 0; c < 4; ++c) nearest[c] = std::numeric_limits<float>::infinity();
+			for (int r = 0; r < count; ++r) {
+				if (anyHit && hits[r].hit) continue;
+				enter(group, rays[r].origin, inverse[r], hits[r].distance, near);
+				for (int c = 0; c < 4; ++c) nearest[c] = std::min(nearest[c], near[c]);
+			}
+			for (int c = 0; c < 4; ++c) {
+				if (nearest[c] == std::numeric_limits<float>::infinity()) continue;
+				int i = size++;
+				while (i > bottom && stack[i - 1].near < nearest[c]) {
+					stack[i] = stack[i - 1];
+					--i;
+				}
+				stack[i] = { level, 4 * g + c, nearest[c] };
+			}
+		}
+	};
+	push(0, 0, 5);
+
+	int remaining = count;
+	while (size > 0 && remaining > 0) {
+		Entry entry = stack[--size];
+		// Another part of the tree may have found closer hits since it was
+		// pushed
+		bool open = false;
+		for (int r = 0; r < count && !open; ++r) open = !(anyHit && hits[r].hit) && entry.near <= hits[r].distance;
+		if (!open) continue;
+
+		if (entry.level < depth) {
+			push(entry.level + 1, entry.node, 1);
+			continue;
+		}
+		const Leaf& leaf = leaves[entry.node];
+		for (int r = 0; r < count; ++r) {
+			if (anyHit && hits[r].hit) continue;
+			float distance, u, v;
+			int t = intersectLeaf(leaf, rays[r].origin, rays[r].direction, hits[r].distance, distance, u, v);
+			if (t < 0) continue;
+			hits[r].hit = true;
+			hits[r].distance = distance;
+			hits[r].face = (entry.node << (2 * leafLevels)) + t;
+			hits[r].u = u;
+			hits[r].v = v;
+			if (anyHit) remaining--;
+		}
+	}
+
+	for (int r = 0; r < count; ++r) {
+		if (hits[r].hit) hits[r].position = rays[r].origin + rays[r].direction * hits[r].distance;
+	}
+}
+
+void TerrainBVH::intersect(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const {
+	TRACE_SCOPE_ARG("terrain rays", "count", (int)rays.size());
+	hits.assign(rays.size(), RayHit());
+	int packets = (rays.size() + PACKET_SIZE - 1) / PACKET_SIZE;
+	pool.parallelFor(0, packets, 16, [&](int p) {
+		int first = p * PACKET_SIZE;
+		int count = std::min<int>((int)PACKET_SIZE, rays.size() - first);
+		for (int r = first; r < first + count; ++r) hits[r].distance = rays[r].maxDistance;
+		intersectPacket(&rays[first], &hits[first], count, false);
+	});
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef TERRAINTUNER_H_
+#define TERRAINTUNER_H_
+
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "Terrain.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Regenerates a planet's terrain on a worker while its parameters are tuned.
+// The renderer keeps drawing the terrain it has until takeResult() hands it a
+// complete new height map and normal set, which it swaps in at once.
+//
+// Requests made while a generation runs are coalesced: when it finishes, only
+// the latest request is generated next
+class TerrainTuner {
+private:
+	ThreadPool& pool;
+	Icosphere* mesh;
+
+	TerrainParams params;
+	unsigned int seed;
+
+	// Only the generation job touches them, and there is one job at a time
+	OctaveCache octaveCache;
+	Arena arena;
+
+	TerrainStages stages;
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	bool running = false;
+	bool pending = false;
+	std::unique_ptr<Terrain> ready;
+	double lastMs = 0;
+
+	void start();
+	void generate(TerrainParams params, unsigned int seed, const TerrainStages& stages);
+public:
+	// Generations reuse the octaves of the previous one that a change did
+	// not affect; cacheSettings trade its memory for speed
+	TerrainTuner(ThreadPool& pool, Icosphere* mesh, const TerrainParams& params, unsigned int seed,
+		const OctaveCacheSettings& cacheSettings = OctaveCacheSettings());
+	// Waits for the running generation, which uses this object
+	~TerrainTuner();
+
+	TerrainTuner(const TerrainTuner&) = delete;
+	TerrainTuner& operator=(const TerrainTuner&) = delete;
+
+	// Queues a regeneration; returns false and queues nothing if params is
+	// not valid()
+	bool request(const TerrainParams& params, unsigned int seed);
+	bool request(const TerrainParams& params) { return request(params, seed); }
+
+	// Passes run on every generated terrain from the next request on
+	void setStages(const TerrainStages& stages) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->stages = stages;
+	}
+
+	// The parameters of the latest request
+	const TerrainParams& getParams() const { return params; }
+	unsigned int getSeed() const { return seed; }
+
+	// The newest finished terrain, or null if none finished since the last call
+	std::unique_ptr<Terrain> takeResult();
+	bool busy();
+	// Wall time of the last finished generation
+	double getLastMs();
+};
+
+TerrainTuner::TerrainTuner(ThreadPool& pool, Icosphere* mesh, const TerrainParams& params, unsigned int seed,
+	const OctaveCacheSettings& cacheSettings) : pool(pool), octaveCache(cacheSettings) {
+	this->mesh = mesh;
+	this->params = params;
+	this->seed = seed;
+}
+
+TerrainTuner::~TerrainTuner() {
+	std::unique_lock<std::mutex> lock(mutex);
+	pending = false;
+	idle.wait(lock, [this] { return !running; });
+}
+
+bool TerrainTuner::request(const TerrainParams& params, unsigned int seed) {
+	if (!params.valid()) return false;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	this->params = params;
+	this->seed = seed;
+	pending = true;
+	if (running) return true;
+
+	lock.unlock();
+	start();
+	return true;
+}
+
+// Takes the pending request and generates it on the pool. The job keeps
+// going while requests arrive, so the tuner is idle once it returns
+void TerrainTuner::start() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running || !pending) return;
+		running = true;
+	}
+	pool.submit([this]() {
+		while (true) {
+			TerrainParams next;
+			unsigned int nextSeed;
+			TerrainStages nextStages;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!pending) {
+					// Notified under the lock: the destructor may run as
+					// soon as it is released
+					running = false;
+					idle.notify_all();
+					return;
+				}
+				pending = false;
+				next = params;
+				nextSeed = seed;
+				nextStages = stages;
+			}
+			generate(next, nextSeed, nextStages);
+		}
+	});
+}
+
+void TerrainTuner::generate(TerrainParams params, unsigned int seed, const TerrainStages& stages) {
+	TRACE_SCOPE_ARG("tune terrain", "seed", seed);
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	std::unique_ptr<Terrain> terrain(new Terrain(mesh, seed));
+	terrain->setParams(params);
+	terrain->setOctaveCache(&octaveCache);
+	terrain->setArena(&arena);
+	terrain->generate(stages, pool);
+	terrain->setOctaveCache(nullptr);
+	terrain->setArena(nullptr);
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	std::lock_guard<std::mutex> lock(mutex);
+	// A newer result replaces one the renderer has not taken yet
+	ready = std::move(terrain);
+	lastMs = elapsed;
+}
+
+std::unique_ptr<Terrain> TerrainTuner::takeResult() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return std::move(ready);
+}
+
+bool TerrainTuner::busy() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return running || pending;
+}
+
+double TerrainTuner::getLastMs() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return lastMs;
+}
+
+#endif
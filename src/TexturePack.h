@@ -0,0 +1,110 @@
+#ifndef TEXTUREPACK_H_
+#define TEXTUREPACK_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+#include "MappedFile.h"
+
+// Binary container written by the texbake tool. Every texture is stored with
+// its full mip chain, already flipped for OpenGL, so loading is a single
+// mapping of the file and one upload per level.
+//
+// Layout: TexturePackHeader, TexturePackEntry[count], level data.
+#define TEXTUREPACK_MAGIC 0x314b5054 // "TPK1"
+#define TEXTUREPACK_VERSION 1
+#define TEXTUREPACK_MAX_LEVELS 16
+#define TEXTUREPACK_NAME_SIZE 64
+
+enum TexturePackFormat {
+	TEXTUREPACK_RGBA8 = 0,
+	TEXTUREPACK_BC1 = 1
+};
+
+struct TexturePackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct TexturePackEntry {
+	char name[TEXTUREPACK_NAME_SIZE];
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t levels;
+	// Offsets are relative to the start of the file
+	uint64_t levelOffset[TEXTUREPACK_MAX_LEVELS];
+	uint32_t levelSize[TEXTUREPACK_MAX_LEVELS];
+};
+
+// Read-only view of a texture pack backed by a memory mapping
+class TexturePack {
+private:
+	MappedFile file;
+
+	const TexturePackHeader* header() const { return (const TexturePackHeader*)file.getData(); }
+	const TexturePackEntry* entries() const { return (const TexturePackEntry*)(file.getData() + sizeof(TexturePackHeader)); }
+
+public:
+	TexturePack() {}
+	TexturePack(const char* filename) { open(filename); }
+	~TexturePack() { close(); }
+
+	TexturePack(const TexturePack&) = delete;
+	TexturePack& operator=(const TexturePack&) = delete;
+
+	bool open(const char* filename);
+	void close() { file.close(); }
+	bool isOpen() const { return file.isOpen(); }
+
+	const TexturePackEntry* find(const char* name) const;
+	const unsigned char* levelData(const TexturePackEntry* entry, int level) const;
+	int getCount() const { return isOpen() ? (int)header()->count : 0; }
+};
+
+// Maps the whole file and validates the header/entry table
+bool TexturePack::open(const char* filename) {
+	if (!file.openReadOnly(filename)) return false;
+
+	size_t size = file.getSize();
+	bool valid = size >= sizeof(TexturePackHeader)
+		&& header()->magic == TEXTUREPACK_MAGIC
+		&& header()->version == TEXTUREPACK_VERSION
+		&& size >= sizeof(TexturePackHeader) + header()->count * sizeof(TexturePackEntry);
+
+	for (int i = 0; valid && i < getCount(); ++i) {
+		const TexturePackEntry& e = entries()[i];
+		if (e.levels == 0 || e.levels > TEXTUREPACK_MAX_LEVELS) valid = false;
+		for (unsigned int l = 0; valid && l < e.levels; ++l) {
+			if (e.levelOffset[l] + e.levelSize[l] > size) valid = false;
+		}
+	}
+
+	if (!valid) {
+		std::cout << "texture pack " << filename << " is invalid or out of date" << std::endl;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+// Looks up a texture by its source file name, e.g. "sand.png"
+const TexturePackEntry* TexturePack::find(const char* name) const {
+	for (int i = 0; i < getCount(); ++i) {
+		if (strncmp(entries()[i].name, name, TEXTUREPACK_NAME_SIZE) == 0) {
+			return &entries()[i];
+		}
+	}
+	return nullptr;
+}
+
+const unsigned char* TexturePack::levelData(const TexturePackEntry* entry, int level) const {
+	return file.getData() + entry->levelOffset[level];
+}
+
+#endif
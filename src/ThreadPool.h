@@ -0,0 +1,144 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+#include "Trace.h"
+
+// A fixed set of worker threads consuming a shared FIFO of jobs
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	void workerLoop();
+public:
+	// A pool with zero threads runs every job inline on the caller
+	ThreadPool(int numThreads = defaultThreadCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()> job);
+	int getThreadCount() const { return (int)workers.size(); }
+
+	// Runs func(i) for i in [begin, end) in chunks of grain; the calling
+	// thread takes part and returns once every index has been processed
+	template <typename Func>
+	void parallelFor(int begin, int end, int grain, Func func);
+
+	static int defaultThreadCount();
+};
+
+ThreadPool::ThreadPool(int numThreads) {
+	for (int i = 0; i < numThreads; ++i) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (int i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}
+
+int ThreadPool::defaultThreadCount() {
+	int hardware = (int)std::thread::hardware_concurrency();
+	// Leave the calling (GL context) thread its own core
+	return hardware > 1 ? hardware - 1 : 1;
+}
+
+void ThreadPool::workerLoop() {
+	TRACE_THREAD_NAME("worker");
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	if (workers.empty()) {
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	condition.notify_one();
+}
+
+template <typename Func>
+void ThreadPool::parallelFor(int begin, int end, int grain, Func func) {
+	if (end <= begin) return;
+	if (grain < 1) grain = 1;
+
+	int numChunks = (end - begin + grain - 1) / grain;
+	if (workers.empty() || numChunks == 1) {
+		for (int i = begin; i < end; ++i) func(i);
+		return;
+	}
+
+	// Shared with the helper jobs, which may still be queued after we return
+	struct State {
+		std::atomic<int> next;
+		std::atomic<int> done;
+		std::mutex mutex;
+		std::condition_variable condition;
+	};
+	std::shared_ptr<State> state(new State());
+	state->next = 0;
+	state->done = 0;
+
+	// Chunks are claimed one at a time, so func is only called while the
+	// caller is still waiting for the remaining chunks
+	Func* body = &func;
+	auto work = [state, body, begin, end, grain, numChunks]() {
+		int chunk;
+		while ((chunk = state->next.fetch_add(1)) < numChunks) {
+			int from = begin + chunk * grain;
+			int to = std::min(end, from + grain);
+			for (int i = from; i < to; ++i) (*body)(i);
+
+			if (state->done.fetch_add(1) + 1 == numChunks) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->condition.notify_all();
+			}
+		}
+	};
+
+	int helpers = std::min((int)workers.size(), numChunks - 1);
+	for (int i = 0; i < helpers; ++i) submit(work);
+	work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&state, numChunks] { return state->done.load() == numChunks; });
+}
+
+#endif
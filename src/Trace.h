@@ -0,0 +1,195 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// Scoped trace spans written as Chrome trace_event JSON, which chrome://tracing
+// and Perfetto (ui.perfetto.dev) can open. Spans are only recorded when built
+// with TERRAIN_TRACE; otherwise the macros below compile to nothing.
+//
+//   TRACE_SCOPE("heightmap");                  span named after the block
+//   TRACE_SCOPE_ARG("skybox face", "face", i); span with an integer argument
+//   TRACE_THREAD_NAME("worker");               names the calling thread
+//   TRACE_WRITE("trace.json");                 writes every span so far
+//
+// Each thread records into its own fixed-size buffer without taking a lock;
+// only its first span registers the buffer. Names are copied, so they do not
+// have to outlive the span.
+
+#ifdef TERRAIN_TRACE
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+struct TraceEvent {
+	char name[48];
+	char argName[16];
+	long long argValue;
+	double start;
+	double duration;
+};
+
+// The spans of one thread. Only that thread appends; count is published
+// with release semantics so writeTrace() can read a consistent prefix
+struct TraceBuffer {
+	static const int CAPACITY = 1 << 16;
+
+	int tid;
+	char threadName[32];
+	std::vector<TraceEvent> events;
+	std::atomic<int> count;
+	std::atomic<int> dropped;
+
+	TraceBuffer(int tid) : tid(tid), events(CAPACITY), count(0), dropped(0) {
+		threadName[0] = 0;
+	}
+};
+
+// Buffers outlive their threads, so pool workers can exit before the trace
+// is written
+struct TraceRegistry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<TraceBuffer> > buffers;
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+TraceRegistry& traceRegistry() {
+	static TraceRegistry registry;
+	return registry;
+}
+
+TraceBuffer& traceBuffer() {
+	static thread_local TraceBuffer* buffer = nullptr;
+	if (buffer == nullptr) {
+		TraceRegistry& registry = traceRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer((int)registry.buffers.size() + 1)));
+		buffer = registry.buffers.back().get();
+	}
+	return *buffer;
+}
+
+// Microseconds since the registry was created
+double traceNow() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceRegistry().epoch).count();
+}
+
+// Under the registry's mutex, as writeTrace() may be reading the name
+void traceThreadName(const char* name) {
+	TraceBuffer& buffer = traceBuffer();
+	std::lock_guard<std::mutex> lock(traceRegistry().mutex);
+	strncpy(buffer.threadName, name, sizeof(buffer.threadName) - 1);
+	buffer.threadName[sizeof(buffer.threadName) - 1] = 0;
+}
+
+class TraceSpan {
+private:
+	TraceEvent event;
+public:
+	TraceSpan(const char* name, const char* argName = nullptr, long long argValue = 0) {
+		strncpy(event.name, name, sizeof(event.name) - 1);
+		event.name[sizeof(event.name) - 1] = 0;
+		event.argName[0] = 0;
+		if (argName != nullptr) {
+			strncpy(event.argName, argName, sizeof(event.argName) - 1);
+			event.argName[sizeof(event.argName) - 1] = 0;
+		}
+		event.argValue = argValue;
+		event.start = traceNow();
+	}
+
+	~TraceSpan() {
+		event.duration = traceNow() - event.start;
+
+		TraceBuffer& buffer = traceBuffer();
+		int n = buffer.count.load(std::memory_order_relaxed);
+		if (n == TraceBuffer::CAPACITY) {
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		buffer.events[n] = event;
+		buffer.count.store(n + 1, std::memory_order_release);
+	}
+};
+
+// Writes a JSON string, escaping the characters JSON requires
+void writeTraceString(std::ofstream& file, const char* text) {
+	file << '"';
+	for (const char* c = text; *c; ++c) {
+		if (*c == '"' || *c == '\\') file << '\\' << *c;
+		else if ((unsigned char)*c < 0x20) file << ' ';
+		else file << *c;
+	}
+	file << '"';
+}
+
+// Writes the spans recorded so far. Threads may keep recording meanwhile;
+// their newer spans are simply not included
+bool writeTrace(const std::string& path) {
+	std::ofstream file(path.c_str());
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file.precision(3);
+	file << std::fixed;
+
+	TraceRegistry& registry = traceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	bool first = true;
+	for (int b = 0; b < registry.buffers.size(); ++b) {
+		const TraceBuffer& buffer = *registry.buffers[b];
+
+		if (buffer.threadName[0]) {
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid << ",\"args\":{\"name\":";
+			writeTraceString(file, buffer.threadName);
+			file << "}}";
+			first = false;
+		}
+
+		int n = buffer.count.load(std::memory_order_acquire);
+		for (int i = 0; i < n; ++i) {
+			const TraceEvent& event = buffer.events[i];
+			file << (first ? "" : ",\n") << "{\"name\":";
+			writeTraceString(file, event.name);
+			file << ",\"cat\":\"terrain\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.tid
+				<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+			if (event.argName[0]) {
+				file << ",\"args\":{";
+				writeTraceString(file, event.argName);
+				file << ":" << event.argValue << "}";
+			}
+			file << "}";
+			first = false;
+		}
+
+		if (buffer.dropped.load() > 0) {
+			file << (first ? "" : ",\n") << "{\"name\":\"dropped spans\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << buffer.tid
+				<< ",\"ts\":" << traceNow() << ",\"args\":{\"count\":" << buffer.dropped.load() << "}}";
+			first = false;
+		}
+	}
+
+	file << "\n]}\n";
+	return (bool)file;
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, argName, argValue) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name, argName, (long long)(argValue))
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#define TRACE_WRITE(path) writeTrace(path)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, argName, argValue)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_WRITE(path)
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef VERTEXGRAPH_H_
+#define VERTEXGRAPH_H_
+
+#include <vector>
+#include <algorithm>
+
+// The connectivity of a triangle mesh in compressed sparse row form: the
+// faces around vertex v are faces[faceOffsets[v]] up to
+// faces[faceOffsets[v + 1]], in ascending order, and its one-ring neighbors
+// are stored the same way, sorted. Flat arrays, so a pass over the graph
+// reads memory in order
+struct VertexGraph {
+	std::vector<int> faceOffsets, faces;
+	std::vector<int> neighborOffsets, neighbors;
+
+	void build(const std::vector<unsigned int>& indices, int numVertices);
+
+	int numVertices() const { return faceOffsets.empty() ? 0 : (int)faceOffsets.size() - 1; }
+	bool empty() const { return faceOffsets.empty(); }
+	int degree(int v) const { return neighborOffsets[v + 1] - neighborOffsets[v]; }
+	size_t getMemoryBytes() const {
+		return (faceOffsets.capacity() + faces.capacity() + neighborOffsets.capacity() + neighbors.capacity()) * sizeof(int);
+	}
+};
+
+void VertexGraph::build(const std::vector<unsigned int>& indices, int numVertices) {
+	// Faces around each vertex, counted then filled in face order
+	faceOffsets.assign(numVertices + 1, 0);
+	for (int j = 0; j < indices.size(); ++j) faceOffsets[indices[j] + 1]++;
+	for (int i = 0; i < numVertices; ++i) faceOffsets[i + 1] += faceOffsets[i];
+
+	faces.resize(indices.size());
+	std::vector<int> fill(faceOffsets.begin(), faceOffsets.end() - 1);
+	for (int j = 0; j < indices.size(); ++j) faces[fill[indices[j]]++] = j / 3;
+
+	// Neighbors are the other corners of those faces
+	neighborOffsets.assign(numVertices + 1, 0);
+	neighbors.clear();
+	neighbors.reserve(2 * indices.size());
+	for (int i = 0; i < numVertices; ++i) {
+		int begin = neighbors.size();
+		for (int k = faceOffsets[i]; k < faceOffsets[i + 1]; ++k) {
+			for (int c = 0; c < 3; ++c) {
+				int v = indices[3 * faces[k] + c];
+				if (v != i) neighbors.push_back(v);
+			}
+		}
+		std::sort(neighbors.begin() + begin, neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin() + begin, neighbors.end()), neighbors.end());
+		neighborOffsets[i + 1] = neighbors.size();
+	}
+}
+
+#endif
@@ -3,17 +3,24 @@
 
 #include "PerlinNoise.h"
 #include "Icosphere.h"
+#include "Terrain.h"
+#include "Ocean.h"
 #include "loadTexture.h"
+#include "ShaderSource.h"
+#include "RenderStats.h"
+#include "FrameProfiler.h"
 
 #include <OpenGP/GL/Eigen.h>
 #include "OpenGP/GL/Application.h"
 
 using namespace OpenGP;
 
+typedef Texture<GL_RGBA32F, GL_RGBA, GL_FLOAT> RGBA32FTexture;
+
 // This class define water on a planet
 class Water {
 private:
-	Icosphere* mesh;
+	std::unique_ptr<Icosphere> mesh;
 	float radius;
 	
 	std::unique_ptr<Shader> shader;
@@ -21,23 +28,112 @@ private:
 	std::unique_ptr<RGBA8Texture> texture;
 
 	float timer;
+
+	// Depth of the seabed below every vertex of the water sphere, negative
+	// under land. Sampled from the terrain once per regeneration, so the
+	// water can have any level of detail
+	std::vector<float> depth;
+	// Unit directions of the vertices from the center, to find the ones an
+	// edit moves the seabed under
+	std::vector<Vec3> directions;
+
+	// Only triangles over the sea or within coastMargin of it are drawn:
+	// the rest is hidden under land and would only cost blending
+	float coastMargin = 0.25f;
+	std::vector<unsigned int> sphereIndices;
+	VertexGraph graph;
+	// Marks the vertices an updateSeabed() has visited, equal to
+	// seabedStamp; reset only when the sphere changes or the stamp wraps
+	std::vector<unsigned int> seabedStamps;
+	unsigned int seabedStamp = 0;
+	std::vector<char> wet;
+	std::vector<unsigned int> wetIndices;
+
+	// The water mesh is static, so it is uploaded once on the first draw,
+	// and the depth and the drawn triangles once per regeneration or edit
+	bool uploaded = false;
+	bool depthUploaded = false;
+	bool indicesUploaded = false;
+	int numIndices = 0;
+
+	// Waves from an FFT ocean simulated on a worker, if one is set. Each
+	// field is uploaded into the texture not drawn with last, so the upload
+	// does not wait for draws still reading the other one
+	OceanSimulator* ocean = nullptr;
+	std::unique_ptr<RGBA32FTexture> oceanTextures[2];
+	int oceanFront = -1;
+	// World units one ocean patch covers; the patch repeats over the sphere
+	float oceanTile = 4.0f;
+	bool oceanSynchronous = false;
+
+	float seabedDepth(const Terrain& terrain, int vertex) const;
+	bool isWet(int face) const;
+	void collectWetTriangles();
+	void updateOcean(double seconds);
 public:
 	Water(float radius, Vec3 center, int lod);
 
+	// Replaces the water sphere, e.g. with one matching a refined planet
+	void setMesh(std::unique_ptr<Icosphere> mesh) {
+		this->mesh = std::move(mesh);
+		uploaded = false;
+		depth.clear();
+		directions.clear();
+		sphereIndices.clear();
+		graph = VertexGraph();
+		seabedStamps.clear();
+		wet.clear();
+	}
+	Icosphere* getMesh() { return mesh.get(); }
+
 	void init();
-	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, std::vector<float> planetHeightMap, std::vector<Vec3> pVertices, std::vector<Vec3> pVNormals);
+	// Samples the depth of the planet's surface under every water vertex,
+	// which the shader colors the water by. The planet calls it whenever it
+	// regenerates; the terrain needs its normals
+	void setSeabed(const Terrain& terrain);
+	// Resamples the depth where an edit moved the terrain, and reuploads
+	// only that
+	void updateSeabed(const Terrain& terrain, const TerrainEdit& edit);
+	const std::vector<float>& getDepth() const { return depth; }
+
+	void reportMemory(MemoryReport& report, const std::string& name) const;
+
+	// Triangles drawn and in the whole sphere
+	int getNumWetTriangles() const { return wet.empty() ? getNumTriangles() : wetIndices.size() / 3; }
+	int getNumTriangles() const { return sphereIndices.size() / 3; }
+	// How far above the water the seabed of a drawn triangle may be, in
+	// world units; takes effect on the next setSeabed()
+	void setCoastMargin(float margin) { this->coastMargin = margin; }
+
+	// Draws the waves of the ocean, which must outlive the water; null goes
+	// back to the scrolling texture. Synchronous waits for the step of each
+	// draw's time (OceanSimulator::step()) instead of drawing the newest
+	// one finished, so a replayed run draws and uploads the same
+	void setOcean(OceanSimulator* ocean, bool synchronous = false) {
+		this->ocean = ocean;
+		this->oceanSynchronous = synchronous;
+		oceanFront = -1;
+	}
+	void setOceanTile(float size) { this->oceanTile = size; }
+
+	// seconds is the scene time the waves are drawn at
+	void draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds);
 
 	std::string load_source(const char* fname) {
-		std::ifstream f(fname);
-		std::stringstream buffer;
-		buffer << f.rdbuf();
-		return buffer.str();
+		return loadShaderSource(fname);
 	}
 };
 
+void Water::reportMemory(MemoryReport& report, const std::string& name) const {
+	mesh->reportMemory(report, name + "/mesh");
+	report.add(name + "/seabed", vectorBytes(depth) + vectorBytes(directions) + vectorBytes(wet));
+	report.add(name + "/indices", vectorBytes(sphereIndices) + vectorBytes(wetIndices));
+	report.add(name + "/graph", graph.getMemoryBytes() + vectorBytes(seabedStamps));
+}
+
 Water::Water(float radius, Vec3 center, int lod) {
 	this->radius = radius;
-	mesh = new Icosphere(center, radius, lod);
+	mesh = std::unique_ptr<Icosphere>(new Icosphere(center, radius, lod));
 }
 
 void Water::init() {
@@ -50,29 +146,176 @@ void Water::init() {
 	shader->add_fshader_from_source(load_source("Shaders/water_fshader.glsl").c_str());
 	shader->link();
 
-	loadTexture(texture, "water.png");
-	texture->bind();
+	loadMipmappedTexture(texture, "water.png");
+
+	for (int i = 0; i < 2; ++i) {
+		oceanTextures[i] = std::unique_ptr<RGBA32FTexture>(new RGBA32FTexture());
+		oceanTextures[i]->bind();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		oceanTextures[i]->unbind();
+	}
+}
+
+// Starts the ocean step for the time and uploads the newest finished
+// field. The step runs on the pool, so this only costs the upload, unless
+// the ocean is synchronous
+void Water::updateOcean(double seconds) {
+	ProfileScope scope("ocean upload");
+	if (oceanSynchronous) ocean->step(seconds);
+	else ocean->update(seconds);
+	std::unique_ptr<OceanField> field = ocean->takeResult();
+	if (!field) return;
+
+	int back = oceanFront == 0 ? 1 : 0;
+	RGBA32FTexture& target = *oceanTextures[back];
+	if (target.get_width() != field->size) target.allocate(field->size, field->size);
+	target.bind();
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, field->size, field->size, GL_RGBA, GL_FLOAT, field->texels.data());
 	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	target.unbind();
+	renderStats().bytesUploaded += (long long)(field->texels.size() * sizeof(float));
+
+	oceanFront = back;
+	ocean->recycle(std::move(field));
 }
 
-void Water::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, std::vector<float> planetHeightMap, std::vector<Vec3> pVertices, std::vector<Vec3> pVNormals) {
-	std::vector<unsigned int> triangle_indices = mesh->genMesh();
-	std::vector<Vec3> vertices = mesh->getVertices();
-	std::vector<Vec3> vnormals = mesh->getVertexNormals();
-	float radius = mesh->getRadius();
+float Water::seabedDepth(const Terrain& terrain, int vertex) const {
+	TerrainSample ground = terrain.sample(directions[vertex]);
+	return radius - (ground.position - mesh->getCenter()).norm();
+}
+
+// Whether the seabed under any corner of the face is below the water or
+// within coastMargin above it. Water drawn over land is hidden by it
+bool Water::isWet(int face) const {
+	float deepest = std::max(depth[sphereIndices[3 * face]], std::max(depth[sphereIndices[3 * face + 1]], depth[sphereIndices[3 * face + 2]]));
+	return deepest > -coastMargin;
+}
+
+void Water::collectWetTriangles() {
+	wetIndices.clear();
+	for (int f = 0; f < wet.size(); ++f) {
+		if (wet[f]) wetIndices.insert(wetIndices.end(), sphereIndices.begin() + 3 * f, sphereIndices.begin() + 3 * f + 3);
+	}
+	indicesUploaded = false;
+}
+
+void Water::setSeabed(const Terrain& terrain) {
+	TRACE_SCOPE("seabed");
+	std::vector<Vec3> normals = mesh->getVertexNormals();
+	directions.swap(normals);
+	depth.resize(directions.size());
+	for (int i = 0; i < directions.size(); ++i) depth[i] = seabedDepth(terrain, i);
+	depthUploaded = false;
+
+	if (graph.empty()) {
+		if (sphereIndices.empty()) sphereIndices = mesh->genMesh();
+		graph.build(sphereIndices, directions.size());
+	}
+	wet.resize(sphereIndices.size() / 3);
+	for (int f = 0; f < wet.size(); ++f) wet[f] = isWet(f);
+	collectWetTriangles();
+}
+
+void Water::updateSeabed(const Terrain& terrain, const TerrainEdit& edit) {
+	if (depth.empty() || edit.normals.empty()) return;
+
+	// The faces an edit moves all have a corner among edit.normals, so the
+	// water over them is within the cap around those vertices
+	Icosphere* planetMesh = terrain.getMesh();
+	Vec3 axis(0, 0, 0);
+	for (int n = 0; n < edit.normals.size(); ++n) axis += (planetMesh->getVertex(edit.normals[n]) - planetMesh->getCenter()).normalized();
+	axis.normalize();
+	float cosCap = 1.0f;
+	for (int n = 0; n < edit.normals.size(); ++n) {
+		cosCap = std::min(cosCap, (planetMesh->getVertex(edit.normals[n]) - planetMesh->getCenter()).normalized().dot(axis));
+	}
+
+	// Grown from the water vertex closest to the axis through neighbors
+	// inside the cap, so an edit costs its size rather than the sphere's
+	const Face& face = mesh->getFace(mesh->locateFace(axis));
+	int closest = face.vertices[0];
+	for (int c = 1; c < 3; ++c) {
+		if (directions[face.vertices[c]].dot(axis) > directions[closest].dot(axis)) closest = face.vertices[c];
+	}
+
+	if (seabedStamps.size() != directions.size() || seabedStamp == ~0u) {
+		seabedStamps.assign(directions.size(), 0);
+		seabedStamp = 0;
+	}
+	seabedStamp++;
+
+	std::vector<int> changed;
+	std::vector<int> queue(1, closest);
+	seabedStamps[closest] = seabedStamp;
+	for (int q = 0; q < queue.size(); ++q) {
+		int i = queue[q];
+		if (directions[i].dot(axis) < cosCap) continue;
+		float d = seabedDepth(terrain, i);
+		if (d != depth[i]) {
+			depth[i] = d;
+			changed.push_back(i);
+		}
+		for (int k = graph.neighborOffsets[i]; k < graph.neighborOffsets[i + 1]; ++k) {
+			if (seabedStamps[graph.neighbors[k]] != seabedStamp) {
+				seabedStamps[graph.neighbors[k]] = seabedStamp;
+				queue.push_back(graph.neighbors[k]);
+			}
+		}
+	}
+	// Vertices come in visiting order; the upload ranges want them sorted
+	std::sort(changed.begin(), changed.end());
+
+	// Only the triangles around changed vertices can get wet or dry; the
+	// index buffer is only rebuilt if one did
+	bool coastChanged = false;
+	for (int n = 0; n < changed.size(); ++n) {
+		int v = changed[n];
+		for (int k = graph.faceOffsets[v]; k < graph.faceOffsets[v + 1]; ++k) {
+			int f = graph.faces[k];
+			char w = isWet(f);
+			if (w != wet[f]) {
+				wet[f] = w;
+				coastChanged = true;
+			}
+		}
+	}
+	if (coastChanged) collectWetTriangles();
 
-	glMesh->set_vbo<Vec3>("vposition", vertices);
-	glMesh->set_vbo<Vec3>("vnormal", vnormals);
+	if (!depthUploaded) return;
+	std::vector<VertexRange> ranges = vertexRanges(changed);
+	for (int i = 0; i < ranges.size(); ++i) {
+		updateVbo<float>(*glMesh, "vdepth", depth, ranges[i].first, ranges[i].count);
+	}
+}
 
-	glMesh->set_vbo<Vec3>("pvnormal", pVNormals);
-	glMesh->set_vbo<Vec3>("pvposition", pVertices);
-	glMesh->set_vbo<float>("pvheight", planetHeightMap);
+void Water::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, double seconds) {
+	float radius = mesh->getRadius();
 
-	glMesh->set_triangles(triangle_indices);
+	if (!uploaded) {
+		uploadVbo<Vec3>(*glMesh, "vposition", mesh->getVertices());
+		uploadVbo<Vec3>(*glMesh, "vnormal", mesh->getVertexNormals());
+		uploaded = true;
+		depthUploaded = false;
+		indicesUploaded = false;
+	}
+	if (!indicesUploaded) {
+		// The whole sphere until the planet passes its surface
+		if (sphereIndices.empty()) sphereIndices = mesh->genMesh();
+		const std::vector<unsigned int>& indices = wet.empty() ? sphereIndices : wetIndices;
+		uploadTriangles(*glMesh, indices);
+		numIndices = indices.size();
+		indicesUploaded = true;
+	}
+	if (numIndices == 0) return;
+	if (ocean != nullptr) updateOcean(seconds);
+	if (!depthUploaded) {
+		// Deep water everywhere until the planet passes its surface
+		if (depth.size() != mesh->getVertices().size()) depth.assign(mesh->getVertices().size(), radius);
+		uploadVbo<float>(*glMesh, "vdepth", depth);
+		depthUploaded = true;
+	}
 
 	shader->bind();
 
@@ -103,6 +346,14 @@ void Water::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, std
 	texture->bind();
 	shader->set_uniform("waterTex", 0);
 
+	shader->set_uniform("oceanEnabled", oceanFront >= 0 ? 1 : 0);
+	if (oceanFront >= 0) {
+		glActiveTexture(GL_TEXTURE1);
+		oceanTextures[oceanFront]->bind();
+		shader->set_uniform("oceanTex", 1);
+		shader->set_uniform("oceanTile", oceanTile);
+	}
+
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -115,7 +366,7 @@ void Water::draw(float fov, Vec3 cameraPos, Vec3 cameraFront, Vec3 cameraUp, std
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); 
 
 	glMesh->set_attributes(*shader);
-	glMesh->draw();
+	drawMesh(*glMesh, numIndices);
 
 	glDisable(GL_BLEND);
 
@@ -0,0 +1,25 @@
+#version 330 core
+
+out vec4 color;
+
+// Light position in view space
+uniform vec3 lightPos;
+
+in vec2 fcorner;
+in vec3 fcenter;
+in float fradius;
+in vec3 falbedo;
+
+void main() {
+    float r2 = dot(fcorner, fcorner);
+    if (r2 > 1.0) discard;
+
+    // Normal of the sphere seen through this point of the disc
+    vec3 normal = vec3(fcorner, sqrt(1.0 - r2));
+    vec3 surface = fcenter + normal * fradius;
+
+    float ambient = 0.1f;
+    float diffuse = max(0.0f, dot(normal, normalize(lightPos - surface)));
+
+    color = vec4(falbedo * (ambient + 0.9f * diffuse), 1.0);
+}
@@ -0,0 +1,27 @@
+#version 330 core
+
+// Corner of the quad, in [-1, 1]
+in vec2 vcorner;
+
+// Center and radius of the body, and its mean color
+in vec4 vbody;
+in vec3 valbedo;
+
+uniform mat4 V;
+uniform mat4 P;
+
+out vec2 fcorner;
+out vec3 fcenter;
+out float fradius;
+out vec3 falbedo;
+
+void main() {
+    fcorner = vcorner;
+    fcenter = (V * vec4(vbody.xyz, 1.0f)).xyz;
+    fradius = vbody.w;
+    falbedo = valbedo;
+
+    // The quad faces the camera, in front of the body's center
+    vec3 position = fcenter + vec3(vcorner * vbody.w, vbody.w);
+    gl_Position = P * vec4(position, 1.0f);
+}
@@ -3,6 +3,12 @@
 #include <OpenGP/GL/Application.h>
 #include <OpenGP/external/LodePNG/lodepng.cpp>
 
+#include <map>
+#include <mutex>
+
+#include "TexturePack.h"
+#include "Trace.h"
+
 using namespace OpenGP;
 
 void loadTexture(std::unique_ptr<RGBA8Texture> &texture, const char *filename) {
@@ -28,9 +34,8 @@ void loadTexture(std::unique_ptr<RGBA8Texture> &texture, const char *filename) {
     texture->upload_raw(width, height, &image[0]);
 }
 
-void loadTexture(std::vector<unsigned char> &image, const char *filename) {
+void loadTexture(std::vector<unsigned char> &image, const char *filename, unsigned &width, unsigned &height) {
     // Used snippet from https://raw.githubusercontent.com/lvandeve/lodepng/master/examples/example_decode.cpp
-    unsigned width, height;
     //decode
     unsigned error = lodepng::decode(image, width, height, filename);
     //if there's an error, display it
@@ -46,3 +51,103 @@ void loadTexture(std::vector<unsigned char> &image, const char *filename) {
     }
     delete row;
 }
+
+void loadTexture(std::vector<unsigned char> &image, const char *filename) {
+    unsigned width, height;
+    loadTexture(image, filename, width, height);
+}
+
+// The texture pack baked at build time, mapped on first use
+const TexturePack& defaultTexturePack() {
+    static TexturePack pack("textures.pack");
+    return pack;
+}
+
+// Uploads every mip level of a baked texture. Returns false if the pack does
+// not hold the texture (or the GL cannot sample its format).
+bool loadTexture(std::unique_ptr<RGBA8Texture> &texture, const TexturePack &pack, const char *filename) {
+    const TexturePackEntry* entry = pack.find(filename);
+    if (entry == nullptr) return false;
+    if (entry->format == TEXTUREPACK_BC1 && !GLEW_EXT_texture_compression_s3tc) return false;
+
+    texture = std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
+    texture->bind();
+
+    GLsizei width = entry->width;
+    GLsizei height = entry->height;
+    for (unsigned int level = 0; level < entry->levels; ++level) {
+        const unsigned char* data = pack.levelData(entry, level);
+        if (entry->format == TEXTUREPACK_BC1) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, width, height, 0, entry->levelSize[level], data);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        }
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->levels - 1);
+
+    return true;
+}
+
+// Pngs decoded ahead of time by prefetchTexture(), waiting for their upload
+struct DecodedTexture {
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<unsigned char> image;
+};
+
+std::mutex decodedTexturesMutex;
+std::map<std::string, DecodedTexture> decodedTextures;
+
+// The CPU half of loadMipmappedTexture(), safe to call from any thread: pages
+// in the baked levels, or decodes the png when the pack does not have it
+void prefetchTexture(const char *filename) {
+    TRACE_SCOPE("texture decode");
+    const TexturePack &pack = defaultTexturePack();
+    const TexturePackEntry* entry = pack.find(filename);
+
+    if (entry != nullptr) {
+        volatile unsigned char sum = 0;
+        for (unsigned int level = 0; level < entry->levels; ++level) {
+            const unsigned char* data = pack.levelData(entry, level);
+            for (unsigned int i = 0; i < entry->levelSize[level]; i += 4096) sum += data[i];
+        }
+        return;
+    }
+
+    DecodedTexture decoded;
+    loadTexture(decoded.image, filename, decoded.width, decoded.height);
+
+    std::lock_guard<std::mutex> lock(decodedTexturesMutex);
+    decodedTextures[filename] = std::move(decoded);
+}
+
+// Loads a repeating, trilinear filtered texture, preferring the baked pack
+// over decoding the png and generating mipmaps at runtime
+void loadMipmappedTexture(std::unique_ptr<RGBA8Texture> &texture, const char *filename) {
+    TRACE_SCOPE("texture upload");
+    if (loadTexture(texture, defaultTexturePack(), filename)) {
+        texture->bind();
+    } else {
+        DecodedTexture decoded;
+        {
+            std::lock_guard<std::mutex> lock(decodedTexturesMutex);
+            auto it = decodedTextures.find(filename);
+            if (it != decodedTextures.end()) {
+                decoded = std::move(it->second);
+                decodedTextures.erase(it);
+            }
+        }
+        if (decoded.image.empty()) loadTexture(decoded.image, filename, decoded.width, decoded.height);
+
+        texture = std::unique_ptr<RGBA8Texture>(new RGBA8Texture());
+        texture->upload_raw(decoded.width, decoded.height, &decoded.image[0]);
+        texture->bind();
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+}
@@ -1,6 +1,8 @@
 #include<cstdlib>
 #include<cmath>
+#include <cstring>
 #include <fstream>
+#include <chrono>
 
 #include <OpenGP/GL/Application.h>
 
@@ -9,9 +11,20 @@
 #include "Planet.h"
 #include "Skybox.h"
 #include "Sun.h"
+#include "TaskGraph.h"
+#include "FrameProfiler.h"
+#include "RenderStats.h"
+#include "CameraPath.h"
+#include "Flythrough.h"
+#include "TerrainTuner.h"
+#include "PlanetRefiner.h"
+#include "PlanetSystem.h"
 
 using namespace OpenGP;
 
+// Taken during static initialization, as close to process start as we get
+std::chrono::steady_clock::time_point startupBegin = std::chrono::steady_clock::now();
+
 // Defines the screen width/height
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
@@ -22,13 +35,70 @@ using namespace OpenGP;
 // The radius of the planet
 float radius = 50.0f;
 
-// Create two sphere meshes for the sun and planet
-Icosphere icosphere(Vec3(0,0,0), radius, 5);
-Icosphere sunMesh(Vec3(50, -50, 200), 50, 4);
-// Defines the planet, sun and skybox objects
-Planet planet = Planet(&icosphere);
-Skybox skybox = Skybox(500);
-Sun sun = Sun(&sunMesh);
+// Startup configuration, see parseArguments()
+int planetLevel = 5;
+// The water samples the seabed depth from the terrain, so its level is
+// independent of the planet's
+int waterLevel = 5;
+int numThreads = ThreadPool::defaultThreadCount();
+std::string frameTimesPath = "frame_times";
+bool progressive = false;
+// --erosion DROPLETS: erodes the planet with that many droplets per vertex
+float erosionDroplets = 0.0f;
+// --rivers: computes the planet's rivers and lakes and draws them
+bool rivers = false;
+// --ocean N: grid size of the FFT ocean the water draws waves from; 0, the
+// default, keeps the scrolling texture
+int oceanSize = 0;
+// --scatter: trees and rocks on the planet
+bool scatter = false;
+// --system N: that many planets and moons orbiting the planet
+int systemBodies = 0;
+// --compact: drops what only generation needs once the planet is uploaded
+bool compact = false;
+
+// Benchmark mode: replays a camera path instead of taking input, see
+// parseArguments(). "orbit" is the built-in path
+std::string flythroughPath;
+float flythroughTimestep = 1.0f / 60.0f;
+bool offscreen = false;
+std::string reportPath = "flythrough";
+std::unique_ptr<Flythrough> flythrough;
+
+// Camera recording, toggled with R
+std::string recordPath = "camera_path.txt";
+bool recording = false;
+CameraPath recordedPath;
+std::chrono::steady_clock::time_point recordingBegin;
+
+// Sculpting: 1-4 pick raise, lower, flatten or smooth, space applies the
+// brush where the camera looks at the planet
+Brush brush;
+
+// Live tuning of the planet: [ ] change the octaves, - = the roughness (H),
+// , . the lacunarity and N picks a new seed. The planet regenerates on the
+// pool and is swapped in when done
+std::unique_ptr<TerrainTuner> tuner;
+
+// --progressive: the planet starts coarse and is refined on the pool; tuning
+// starts once it is complete
+std::unique_ptr<PlanetRefiner> refiner;
+ThreadPool* generationPool = nullptr;
+
+// Simulates the waves on the pool at a fixed rate, see --ocean
+std::unique_ptr<OceanSimulator> ocean;
+
+// The sphere meshes for the planet, its water and the sun, and the planet,
+// skybox and sun objects. All of them are built by the startup graph in init()
+std::unique_ptr<Icosphere> icosphere;
+std::unique_ptr<Icosphere> sunMesh;
+std::unique_ptr<Water> water;
+std::unique_ptr<Planet> planet;
+std::unique_ptr<Skybox> skybox;
+std::unique_ptr<Sun> sun;
+std::unique_ptr<PlanetSystem> planetSystem;
+
+bool firstFrameDrawn = false;
 
 // The camera properties
 Vec3 cameraPos;
@@ -45,26 +115,416 @@ float halflife;
 float yaw;
 float pitch;
 
-// Inits the scene
-void init() {
-	skybox.init();
-	planet.init();
-	sun.init();
+// --threads N: generation workers (0 generates everything on the main thread)
+// --serial: same as --threads 0
+// --level N: subdivision level of the planet
+// --water-level N: subdivision level of the water sphere (default 5)
+// --frame-times PATH: where frame timings are written (PATH.csv, PATH.json)
+// --flythrough FILE|orbit: benchmark along a camera path, then exit
+// --timestep S: camera time between flythrough frames (default 1/60)
+// --offscreen: render the flythrough into a framebuffer, without a window
+// --report PATH: where the flythrough stats are written (PATH.csv, PATH.json)
+// --record FILE: where R saves the recorded camera path
+// --progressive: show a coarse planet at once and refine it in the background
+// --erosion DROPLETS: droplets per vertex of hydraulic erosion (default off)
+// --rivers: rivers and lakes from a hydrology pass
+// --ocean N: FFT ocean grid size, a power of two (default off)
+// --scatter: instanced trees on grass and rocks on rock
+// --system N: N more planets and moons on orbits around the planet
+// --compact: keep a single copy of the planet after startup, see Planet::compact()
+void parseArguments(int argc, char** argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) numThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--serial") == 0) numThreads = 0;
+		else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) planetLevel = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--water-level") == 0 && i + 1 < argc) waterLevel = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc) frameTimesPath = argv[++i];
+		else if (strcmp(argv[i], "--flythrough") == 0 && i + 1 < argc) flythroughPath = argv[++i];
+		else if (strcmp(argv[i], "--timestep") == 0 && i + 1 < argc) flythroughTimestep = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--offscreen") == 0) offscreen = true;
+		else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) reportPath = argv[++i];
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) recordPath = argv[++i];
+		else if (strcmp(argv[i], "--progressive") == 0) progressive = true;
+		else if (strcmp(argv[i], "--erosion") == 0 && i + 1 < argc) erosionDroplets = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--rivers") == 0) rivers = true;
+		else if (strcmp(argv[i], "--ocean") == 0 && i + 1 < argc) oceanSize = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--scatter") == 0) scatter = true;
+		else if (strcmp(argv[i], "--system") == 0 && i + 1 < argc) systemBodies = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--compact") == 0) compact = true;
+	}
+}
+
+// The passes --erosion, --rivers and --scatter turn on. The sea level is the height of
+// the water sphere above the planet
+TerrainStages terrainStages() {
+	float seaLevel = radius * 0.02f;
+	TerrainStages stages;
+	stages.erosion = erosionDroplets > 0;
+	stages.erosionParams.droplets = erosionDroplets;
+	stages.erosionParams.seaLevel = seaLevel;
+	stages.hydrology = rivers;
+	stages.hydrologyParams.seaLevel = seaLevel;
+	// Picks the brush position on the displaced surface
+	stages.bvh = true;
+	if (scatter) {
+		// Trees on grass above the water, rocks on steeper rock
+		ScatterLayer trees;
+		trees.spacing = 0.4f;
+		trees.materials = MATERIAL_GRASS;
+		trees.minSlope = 0.85f;
+		trees.minHeight = seaLevel;
+		trees.minScale = 0.25f;
+		trees.maxScale = 0.45f;
+		ScatterLayer rocks;
+		rocks.shape = SCATTER_ROCK;
+		rocks.spacing = 1.0f;
+		rocks.materials = MATERIAL_ROCK;
+		rocks.minSlope = 0.5f;
+		rocks.minScale = 0.15f;
+		rocks.maxScale = 0.35f;
+		rocks.seed = 1;
+		stages.scatterLayers.push_back(trees);
+		stages.scatterLayers.push_back(rocks);
+	}
+	return stages;
+}
+
+// Prints what the planet, its water and the other bodies hold against the
+// process' resident set, after startup and on F3
+void printMemory() {
+	MemoryReport report;
+	planet->reportMemory(report);
+	if (planetSystem) planetSystem->reportMemory(report);
+	report.print(std::cout);
+}
+
+// Inits the scene. Mesh, terrain and sky generation, texture decoding and
+// shader loading run concurrently on the pool; only the GL uploads run here,
+// on the context thread
+void init(ThreadPool& pool) {
+	typedef TaskGraph::TaskId TaskId;
+	TaskGraph startup;
+
+	TaskId shaders = startup.add("shader sources", []() {
+		const char* files[] = {
+			"Shaders/terrain_vshader.glsl", "Shaders/terrain_fshader.glsl",
+			"Shaders/water_vshader.glsl", "Shaders/water_fshader.glsl",
+			"Shaders/skybox_vshader.glsl", "Shaders/skybox_fshader.glsl",
+			"Shaders/sun_vshader.glsl", "Shaders/sun_fshader.glsl",
+			"Shaders/scatter_vshader.glsl", "Shaders/scatter_fshader.glsl",
+			"Shaders/impostor_vshader.glsl", "Shaders/impostor_fshader.glsl" };
+		for (int i = 0; i < 12; ++i) prefetchShaderSource(files[i]);
+	});
+
+	TaskId textures = startup.add("texture decode", []() {
+		const char* files[] = { "sand.png", "grass.png", "rock.png", "snow.png", "water.png" };
+		for (int i = 0; i < 5; ++i) prefetchTexture(files[i]);
+	});
+
+	// A progressive planet starts at a level and octave count that generate
+	// within a frame
+	int startLevel = progressive ? PlanetRefiner::coarseLevel(planetLevel) : planetLevel;
+
+	TaskId planetMesh = startup.add("icosphere", [startLevel]() {
+		icosphere = std::unique_ptr<Icosphere>(new Icosphere(Vec3(0, 0, 0), radius, startLevel));
+		planet = std::unique_ptr<Planet>(new Planet(icosphere.get()));
+		if (progressive) {
+			TerrainParams params;
+			params.octaves = PlanetRefiner::coarseOctaves(params.octaves);
+			planet->getTerrain().setParams(params);
+		}
+	});
+	TaskId heightMap = startup.add("heightmap", []() { planet->calcHeightMap(); }, { planetMesh });
+	TerrainStages stages = terrainStages();
+	if (stages.erosion) {
+		heightMap = startup.add("erosion", [&pool, stages]() { planet->getTerrain().erode(stages.erosionParams, pool); }, { heightMap });
+	}
+	TaskId normals = startup.add("normals", []() { planet->calcSurfaceNormals(); }, { heightMap });
+	if (stages.bvh) startup.add("bvh", [&pool]() { planet->getTerrain().buildBVH(pool); }, { normals });
+	if (stages.hydrology) {
+		normals = startup.add("hydrology", [stages]() { planet->getTerrain().calcHydrology(stages.hydrologyParams); }, { normals });
+	}
+	if (!stages.scatterLayers.empty()) {
+		normals = startup.add("scatter", [&pool, stages]() { planet->getTerrain().scatter(stages.scatterLayers, stages.scatterPatchLevel, pool); }, { normals });
+	}
+
+	TaskId waterMesh = startup.add("water icosphere", []() {
+		water = std::unique_ptr<Water>(new Water(radius * 1.02, Vec3(0, 0, 0), waterLevel));
+	});
+
+	TaskId sunSphere = startup.add("sun icosphere", []() {
+		sunMesh = std::unique_ptr<Icosphere>(new Icosphere(Vec3(50, -50, 200), 50, 4));
+		sun = std::unique_ptr<Sun>(new Sun(sunMesh.get()));
+	});
+
+	skybox = std::unique_ptr<Skybox>(new Skybox(500));
+	std::vector<TaskId> skyboxReady;
+	for (int i = 0; i < SKYBOX_FACES; ++i) {
+		skyboxReady.push_back(startup.add("skybox face " + std::to_string(i), [i]() { skybox->generateFace(i); }));
+	}
+	skyboxReady.push_back(shaders);
+
+	startup.addMainThread("skybox upload", []() { skybox->init(); }, skyboxReady);
+	startup.addMainThread("planet upload", []() {
+		planet->setWater(water.get());
+		planet->init();
+		if (compact) planet->compact();
+	}, { normals, waterMesh, textures, shaders });
+	startup.addMainThread("sun upload", []() { sun->init(); }, { sunSphere, shaders });
+
+	if (systemBodies > 0) {
+		TaskId system = startup.add("planet system", [&pool]() {
+			planetSystem = std::unique_ptr<PlanetSystem>(new PlanetSystem(PlanetSystem::randomSystem(systemBodies, 2021, radius * 3.0f), radius));
+			planetSystem->generate(pool);
+		});
+		startup.addMainThread("planet system upload", []() { planetSystem->init(); }, { system, textures, shaders });
+	}
+
+	startup.run(pool);
+	startup.printTimings(std::cout);
+	printMemory();
+}
+
+void startTuner() {
+	tuner = std::unique_ptr<TerrainTuner>(new TerrainTuner(*generationPool, icosphere.get(), planet->getTerrain().getParams(), planet->getTerrain().getSeed()));
+	tuner->setStages(terrainStages());
+}
+
+// Swaps in the planet's next refinement step if one is ready
+void refine() {
+	std::unique_ptr<PlanetRefinement> step = refiner->takeResult();
+	if (step) {
+		planet->setSurface(step->mesh.get(), std::move(*step->terrain));
+		// Frees the previous level, which nothing refers to anymore
+		icosphere = std::move(step->mesh);
+		std::cout << "planet refined to level " << step->level << ", " << step->octaves << " octaves" << std::endl;
+	}
+
+	if (refiner->finished()) {
+		refiner.reset();
+		startTuner();
+	}
+}
+
+// Time the moving parts of the scene are drawn at: the wall clock since
+// startup, or the flythrough's time, so a replay draws every frame the same
+double sceneSeconds() {
+	if (flythrough) return flythrough->getTime();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - startupBegin).count();
 }
 
 // Updates the scene
 void update() {
+	if (refiner) refine();
+	if (tuner) {
+		std::unique_ptr<Terrain> tuned = tuner->takeResult();
+		if (tuned) {
+			planet->setTerrain(std::move(*tuned));
+			std::cout << "terrain regenerated in " << tuner->getLastMs() << " ms" << std::endl;
+		}
+	}
+
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	skybox.draw(fov, cameraPos, cameraFront, cameraUp);
+	{
+		ProfileScope scope("skybox");
+		skybox->draw(fov, cameraPos, cameraFront, cameraUp);
+	}
 	glClear(GL_DEPTH_BUFFER_BIT);
-	planet.draw(fov, cameraPos, cameraFront, cameraUp);
-	sun.draw(fov, cameraPos, cameraFront, cameraUp);
+	// The other bodies are a layer behind the planet, as they are drawn with
+	// a far plane of their own
+	if (planetSystem) {
+		ProfileScope scope("planet system");
+		planetSystem->draw(fov, cameraPos, cameraFront, cameraUp, sceneSeconds());
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+	{
+		ProfileScope scope("planet");
+		planet->draw(fov, cameraPos, cameraFront, cameraUp, sceneSeconds());
+	}
+	{
+		ProfileScope scope("sun");
+		sun->draw(fov, cameraPos, cameraFront, cameraUp);
+	}
+}
+
+// Writes the recorded frame timings and prints their percentiles
+void dumpFrameTimes() {
+	FrameProfiler& profiler = frameProfiler();
+	profiler.printSummary(std::cout);
+	if (profiler.writeCSV(frameTimesPath + ".csv") && profiler.writeJSON(frameTimesPath + ".json")) {
+		std::cout << "frame times written to " << frameTimesPath << ".csv/.json" << std::endl;
+	}
+}
+
+// Moves the camera to a keyframe of a path
+void applyCamera(const CameraKeyframe& keyframe) {
+	cameraPos = keyframe.position;
+	yaw = keyframe.yaw;
+	pitch = keyframe.pitch;
+	fov = keyframe.fov;
+	cameraFront = cameraDirection(yaw, pitch);
+}
+
+// Loads the path to benchmark; false if it cannot be read
+bool loadFlythrough() {
+	CameraPath path;
+	if (flythroughPath == "orbit") path = CameraPath::orbit(radius, 20.0f);
+	else if (!path.load(flythroughPath)) {
+		std::cout << "could not read camera path " << flythroughPath << std::endl;
+		return false;
+	}
+	if (flythroughTimestep <= 0) flythroughTimestep = 1.0f / 60.0f;
+
+	flythrough = std::unique_ptr<Flythrough>(new Flythrough(path, flythroughTimestep));
+	std::cout << "flythrough: " << flythrough->getFrameCount() << " frames of " << flythroughTimestep << " s" << std::endl;
+	return true;
+}
+
+// Renders the next flythrough frame and records what it cost. glFinish()
+// makes the frame time include the GL work, also on software renderers
+void flythroughFrame() {
+	applyCamera(flythrough->getCamera());
+	renderStats().reset();
+
+	auto begin = std::chrono::steady_clock::now();
+	update();
+	auto issued = std::chrono::steady_clock::now();
+	glFinish();
+	auto end = std::chrono::steady_clock::now();
+
+	FlythroughFrame stats;
+	stats.cpuMs = std::chrono::duration<float, std::milli>(issued - begin).count();
+	stats.frameMs = std::chrono::duration<float, std::milli>(end - begin).count();
+	stats.drawCalls = renderStats().drawCalls;
+	stats.triangles = renderStats().triangles;
+	stats.bytesUploaded = renderStats().bytesUploaded;
+	flythrough->record(stats);
+}
+
+void writeFlythroughReport() {
+	flythrough->printSummary(std::cout);
+	if (flythrough->writeCSV(reportPath + ".csv") && flythrough->writeJSON(reportPath + ".json")) {
+		std::cout << "flythrough stats written to " << reportPath << ".csv/.json" << std::endl;
+	}
+}
+
+// Renders the whole flythrough into a framebuffer of the hidden context
+void runOffscreen() {
+	RGB8Texture color;
+	D16Texture depth;
+	color.allocate(SCREEN_WIDTH, SCREEN_HEIGHT);
+	depth.allocate(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+	Framebuffer framebuffer;
+	framebuffer.attach_color_texture(color);
+	framebuffer.attach_depth_texture(depth);
+
+	framebuffer.bind();
+	while (!flythrough->finished()) {
+		frameProfiler().beginFrame();
+		flythroughFrame();
+		frameProfiler().endFrame();
+	}
+	framebuffer.unbind();
+
+	writeFlythroughReport();
+}
+
+// Starts or stops recording the camera; a stopped recording is saved to
+// recordPath and can be replayed with --flythrough
+void toggleRecording() {
+	recording = !recording;
+	if (recording) {
+		recordedPath.clear();
+		recordingBegin = std::chrono::steady_clock::now();
+		std::cout << "recording camera path" << std::endl;
+	} else if (recordedPath.save(recordPath)) {
+		std::cout << recordedPath.size() << " keyframes written to " << recordPath << std::endl;
+	}
+}
+
+void recordCamera() {
+	CameraKeyframe keyframe;
+	keyframe.time = std::chrono::duration<float>(std::chrono::steady_clock::now() - recordingBegin).count();
+	keyframe.position = cameraPos;
+	keyframe.yaw = yaw;
+	keyframe.pitch = pitch;
+	keyframe.fov = fov;
+	recordedPath.add(keyframe);
+}
+
+// Applies the brush where the view ray hits the terrain, or the planet's
+// sphere while there is no BVH
+void sculpt() {
+	Ray ray;
+	ray.origin = cameraPos;
+	ray.direction = cameraFront.normalized();
+	RayHit hit;
+	if (!planet->getTerrain().getBVH().empty()) {
+		if (!planet->getTerrain().raycast(ray, hit)) return;
+		brush.center = hit.position;
+		planet->applyBrush(brush);
+		return;
+	}
+
+	Icosphere* mesh = planet->getMesh();
+	Vec3 offset = cameraPos - mesh->getCenter();
+	Vec3 direction = cameraFront.normalized();
+
+	float b = offset.dot(direction);
+	float c = offset.squaredNorm() - mesh->getRadius() * mesh->getRadius();
+	float discriminant = b * b - c;
+	if (discriminant < 0) return;
+
+	float distance = -b - sqrt(discriminant);
+	if (distance < 0) distance = -b + sqrt(discriminant);
+	if (distance < 0) return;
+
+	brush.center = cameraPos + direction * distance;
+	planet->applyBrush(brush);
+}
+
+// Keeps the camera this far above the terrain
+const float cameraClearance = 0.2f;
+
+// Pushes the camera back out when a move takes it into the terrain
+void collideCamera() {
+	if (planet->getTerrain().getSurfaceNormals().empty()) return;
+	Vec3 center = planet->getMesh()->getCenter();
+	Vec3 offset = cameraPos - center;
+	if (offset.squaredNorm() == 0) return;
+
+	TerrainSample ground = planet->sampleSurface(offset.normalized());
+	float minDistance = (ground.position - center).norm() + cameraClearance;
+	if (offset.norm() < minDistance) cameraPos = center + offset.normalized() * minDistance;
+}
+
+// Requests a regeneration with a changed parameter
+void tune(const TerrainParams& params, unsigned int seed) {
+	if (!tuner->request(params, seed)) {
+		std::cout << "invalid terrain parameters" << std::endl;
+		return;
+	}
+	std::cout << "seed " << seed << ", octaves " << params.octaves << ", H " << params.H
+		<< ", lacunarity " << params.lacunarity << std::endl;
+}
+
+// Reports the time from process start until the first frame was rendered
+void reportFirstFrame() {
+	glFinish();
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count();
+	std::cout << "time to first frame: " << elapsed << " ms" << std::endl;
 }
 
 
-int main(int, char**) {
+int main(int argc, char** argv) {
+	TRACE_THREAD_NAME("main");
+	parseArguments(argc, argv);
+
 	Application app;
+	ThreadPool pool(numThreads);
+	frameProfiler().enableGpuTiming();
 
 	// Initialize camera position and direction
 	cameraPos = Vec3(-68.8, 97.1, -15.9);
@@ -80,17 +540,70 @@ int main(int, char**) {
 	yaw = 0.0f;
 	pitch = 0.0f;
 
-	// inits
-	init();
+	if (offscreen && flythroughPath.empty()) flythroughPath = "orbit";
+	if (!flythroughPath.empty() && !loadFlythrough()) return 1;
+	// Benchmarks measure the finished planet
+	if (!flythroughPath.empty()) progressive = false;
 
-	// Listens for applicatio update
+	// inits
+	init(pool);
+	TRACE_WRITE("startup_trace.json");
+
+	if (oceanSize > 0) {
+		OceanParams params;
+		params.size = oceanSize;
+		if (params.valid()) {
+			ocean = std::unique_ptr<OceanSimulator>(new OceanSimulator(pool, params));
+			water->setOcean(ocean.get(), (bool)flythrough);
+		} else {
+			std::cout << "--ocean needs a power of two, got " << oceanSize << std::endl;
+		}
+	}
+
+	if (offscreen) {
+		runOffscreen();
+		ocean.reset();
+		return 0;
+	}
+
+	generationPool = &pool;
+	if (progressive) {
+		refiner = std::unique_ptr<PlanetRefiner>(new PlanetRefiner(pool, Vec3(0, 0, 0), radius, planet->getTerrain().getSeed(), TerrainParams()));
+		refiner->setStages(terrainStages());
+		refiner->start(planetLevel);
+	} else {
+		startTuner();
+	}
+
+	// Listens for applicatio update. A profiled frame spans this update and
+	// the window draw that follows it. A flythrough only renders in the
+	// window draw, so each of its frames is drawn once
 	app.add_listener<ApplicationUpdateEvent>([](const ApplicationUpdateEvent&) {
+		frameProfiler().beginFrame();
+		if (flythrough) return;
+		if (recording) recordCamera();
 		update();
 		});
 
 
 	// Creates a window
-	Window& window = app.create_window([](Window&) { update(); });
+	Window& window = app.create_window([&app](Window&) {
+		if (flythrough) {
+			if (flythrough->finished()) return;
+			flythroughFrame();
+			if (flythrough->finished()) {
+				writeFlythroughReport();
+				app.close();
+			}
+		} else {
+			update();
+		}
+		if (!firstFrameDrawn) {
+			firstFrameDrawn = true;
+			reportFirstFrame();
+		}
+		frameProfiler().endFrame();
+		});
 	window.set_title("Procedural Terrain");
 	window.set_size(SCREEN_WIDTH, SCREEN_HEIGHT);
 
@@ -139,6 +652,8 @@ int main(int, char**) {
 			cameraPos = cameraPos - speed * cameraFront.normalized();
 		}
 
+		if (k.key == GLFW_KEY_W || k.key == GLFW_KEY_A || k.key == GLFW_KEY_S || k.key == GLFW_KEY_D) collideCamera();
+
 		if (k.key == GLFW_KEY_UP) {
 			fov -= 1.0f;
 			if (fov <= 1.0f) fov = 1.0f;
@@ -159,7 +674,50 @@ int main(int, char**) {
 			if (speed <= 0.0f) speed = 0.0f;
 		}
 
+		if (k.key == GLFW_KEY_F2 && !k.released) {
+			dumpFrameTimes();
+		}
+
+		if (k.key == GLFW_KEY_F3 && !k.released) {
+			printMemory();
+		}
+
+		if (k.key == GLFW_KEY_R && !k.released) {
+			toggleRecording();
+		}
+
+		if (k.key >= GLFW_KEY_1 && k.key <= GLFW_KEY_4 && !k.released) {
+			brush.mode = (BrushMode)(k.key - GLFW_KEY_1);
+		}
+
+		if (k.key == GLFW_KEY_SPACE && !k.released) {
+			sculpt();
+		}
+
+		if (!k.released && tuner) {
+			TerrainParams params = tuner->getParams();
+			unsigned int seed = tuner->getSeed();
+			bool changed = true;
+			switch (k.key) {
+			case GLFW_KEY_LEFT_BRACKET: params.octaves--; break;
+			case GLFW_KEY_RIGHT_BRACKET: params.octaves++; break;
+			case GLFW_KEY_MINUS: params.H -= 0.05f; break;
+			case GLFW_KEY_EQUAL: params.H += 0.05f; break;
+			case GLFW_KEY_COMMA: params.lacunarity -= 0.1f; break;
+			case GLFW_KEY_PERIOD: params.lacunarity += 0.1f; break;
+			case GLFW_KEY_N: seed = randomTerrainSeed(); break;
+			default: changed = false; break;
+			}
+			if (changed) tune(params, seed);
+		}
+
 		});
 
-	return app.run();
+	int result = app.run();
+	// Their jobs run on the pool, which goes away with main()
+	tuner.reset();
+	refiner.reset();
+	ocean.reset();
+	dumpFrameTimes();
+	return result;
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 330 core
+
+out vec4 color;
+
+uniform vec3 viewer;
+uniform vec3 albedo;
+
+in vec3 fposition;
+in vec3 fnormal;
+in float fshade;
+
+void main() {
+    //light position
+    vec3 lightPos = vec3(50.0f, -50.0f, 200.0f);
+
+    vec3 normal = normalize(fnormal);
+
+    float ambient = 0.35f;
+    float diffuse_coefficient = 0.65f;
+    float specular_coefficient = 0.05f;
+    float specularPower = 8.0;
+
+    vec3 lightDir = normalize(lightPos - fposition);
+    float diffuse = diffuse_coefficient * max(0.0f, dot(normal, lightDir));
+
+    vec3 view_direction = normalize(viewer - fposition);
+    vec3 halfway = normalize(lightDir + view_direction);
+    float specular = specular_coefficient * pow(max(0.0f, dot(normal, halfway)), specularPower);
+
+    color = vec4(albedo * fshade * (ambient + diffuse) + specular, 1.0);
+}
@@ -0,0 +1,40 @@
+#version 330 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// The model, upright along y and standing on the origin
+in vec3 vposition;
+in vec3 vnormal;
+
+// Ground position of the instance, and its size
+in vec4 vinstance;
+
+uniform vec3 center;
+uniform mat4 V;
+uniform mat4 P;
+
+out vec3 fposition;
+out vec3 fnormal;
+out float fshade;
+
+void main() {
+    // Frame with y along the radial direction, turned about it by an angle
+    // hashed from the position so instances do not all face the same way
+    vec3 up = normalize(vinstance.xyz - center);
+    vec3 side = abs(up.y) < 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3 tangent = normalize(cross(side, up));
+    vec3 bitangent = cross(up, tangent);
+
+    float hash = fract(sin(dot(vinstance.xyz, vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+    float angle = 2.0 * M_PI * hash;
+    vec3 x = cos(angle) * tangent + sin(angle) * bitangent;
+    vec3 z = cross(x, up);
+    mat3 frame = mat3(x, up, z);
+
+    fposition = vinstance.xyz + frame * (vposition * vinstance.w);
+    fnormal = frame * vnormal;
+    // Slight variation in color between instances
+    fshade = 0.85 + 0.3 * fract(hash * 17.0);
+
+    gl_Position = P * V * vec4(fposition, 1.0f);
+}
@@ -15,6 +15,8 @@ in vec3 fragPos;
 in vec3 vs;
 in float fheight;
 in vec3 fnormal;
+in float friver;
+in float flake;
 
 uniform float radius;
 uniform vec3 center;
@@ -22,6 +24,7 @@ const float  sandLevel = 0.5;
 const float  grassLevel = 0.7;
 const float  rockLevel = 0.9;
 const float  snowLevel = 0.95;
+const vec4   freshWater = vec4(0.12, 0.32, 0.55, 1.0);
 
 void main() {
     vec4 col = vec4(0,0,0,1.0);
@@ -63,6 +66,13 @@ void main() {
         }
     }
 
+    // Rivers get wider and lakes darker with the water they carry
+    if (flake > 0.0f) {
+        col = mix(col, freshWater * 0.8, min(1.0, 0.6 + flake));
+    } else if (friver > 0.0f) {
+        col = mix(col, freshWater, clamp(friver * 1.5, 0.3, 0.9));
+    }
+
 	// Calculate ambient lighting factor
     float ambient = 0.05f;
     float diffuse_coefficient = 0.2f;
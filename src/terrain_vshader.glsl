@@ -5,6 +5,8 @@ in vec3 vnormal;
 in vec3 vsurfacenormal;
 in vec2 vtexcoord;
 in float vheight;
+in float vriver;
+in float vlake;
 
 uniform float radius;
 uniform vec3 center;
@@ -18,16 +20,21 @@ out vec3 fragPos;
 out vec3 vs;
 out float fheight;
 out vec3 fnormal;
+out float friver;
+out float flake;
 
 void main() {
     vs = vsurfacenormal;
     fnormal = vnormal;
     fheight = vheight;
+    friver = vriver;
+    flake = vlake;
    
-    fragPos =  vposition + vnormal * vheight;
+    // M places a body sharing the mesh of another, see PlanetSystem
+    fragPos = (M * vec4(vposition + vnormal * vheight, 1.0f)).xyz;
 
     // Set gl_Position
-    gl_Position = P*V*M*vec4(fragPos, 1.0f);
+    gl_Position = P*V*vec4(fragPos, 1.0f);
 
 }
 
@@ -4,9 +4,15 @@
 
 uniform sampler2D waterTex;
 
+// FFT ocean field: slopes along u and v, height, and the Jacobian of the
+// choppy displacement. One texture repeats every oceanTile world units
+uniform sampler2D oceanTex;
+uniform int oceanEnabled;
+uniform float oceanTile;
+
 in vec4 vcolor;
 in vec3 fnormal;
-in vec3 vposition;
+in vec3 fposition;
 
 uniform vec3 viewer;
 uniform float radius;
@@ -16,25 +22,41 @@ out vec4 color;
 
 void main() {
     vec4 col = vcolor;  
+    vec3 normal = normalize(fnormal);
+
+    if (oceanEnabled != 0) {
+        // The flat field is projected along the three axes and blended by
+        // how much the surface faces each; every projection tilts the
+        // normal by its slopes within its plane
+        vec3 weights = pow(abs(normal), vec3(4.0f));
+        weights /= weights.x + weights.y + weights.z;
+        vec4 fx = texture(oceanTex, fposition.yz / oceanTile);
+        vec4 fy = texture(oceanTex, fposition.zx / oceanTile);
+        vec4 fz = texture(oceanTex, fposition.xy / oceanTile);
+        vec3 tilt = weights.x * vec3(0.0f, fx.x, fx.y) + weights.y * vec3(fy.y, 0.0f, fy.x) + weights.z * vec3(fz.x, fz.y, 0.0f);
+        normal = normalize(normal - tilt);
 
-    // computes yv coordinates
-    float u = (atan(fnormal.x, fnormal.z) / M_PI) / 2.f + 0.5f;
-    float v = (asin(-fnormal.y) / (M_PI / 2.f)) / 2.f + 0.5f;
+        // Foam where the waves compress toward folding over
+        float jacobian = dot(weights, vec3(fx.w, fy.w, fz.w));
+        col += vec4(clamp((0.8f - jacobian) * 2.0f, 0.0f, 1.0f));
+    } else {
+        // computes yv coordinates
+        float u = (atan(fnormal.x, fnormal.z) / M_PI) / 2.f + 0.5f;
+        float v = (asin(-fnormal.y) / (M_PI / 2.f)) / 2.f + 0.5f;
 
-    // displaces water texture
-    vec4 texCol = vec4(0, 0, 0, 0.0);
-    texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (sin(time) + 1.0) / 2.0 + 0.5);
-    texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (cos(2 * time) + 1.0) / 2.0 + 0.5);
-    texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (sin(3 * time) + 1.0) / 2.0 + 0.5);
-    texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (cos(4 * time) + 1.0) / 2.0 + 0.5);
-    texCol /= 4;
-    col += texCol;
+        // displaces water texture
+        vec4 texCol = vec4(0, 0, 0, 0.0);
+        texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (sin(time) + 1.0) / 2.0 + 0.5);
+        texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (cos(2 * time) + 1.0) / 2.0 + 0.5);
+        texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (sin(3 * time) + 1.0) / 2.0 + 0.5);
+        texCol  +=  texture2D(waterTex, (vec2(u, v) - 0.5) * (cos(4 * time) + 1.0) / 2.0 + 0.5);
+        texCol /= 4;
+        col += texCol;
+    }
 
     //light position
     vec3 lightPos = vec3(50.0f, -50.0f, 200.0f);
     vec3 viewPos = viewer;
-
-    vec3 normal = fnormal;
 	
 	// Calculate ambient lighting factor
     float ambient = 0.05f;
@@ -43,11 +65,11 @@ void main() {
     float specularPower = 16.0;
 
     // Calculate diffuse lighting factor
-    vec3 lightDir = normalize(lightPos - vposition);
+    vec3 lightDir = normalize(lightPos - fposition);
     float diffuse = diffuse_coefficient * max(0.0f, -dot(normal, lightDir));
 
     // Calculate specular lighting factor
-    vec3 view_direction = normalize(viewPos - vposition);
+    vec3 view_direction = normalize(viewPos - fposition);
     vec3 halfway = normalize(lightDir + view_direction);
     float specular = specular_coefficient * max(0.0f, pow(dot(normal, halfway), specularPower));
 	   
@@ -5,9 +5,8 @@ uniform sampler2D waterTex;
 in vec3 vposition;
 in vec3 vnormal;
 
-in vec3 pvnormal;
-in vec3 pvposition;
-in float pvheight;
+// Depth of the seabed below the vertex, negative under land
+in float vdepth;
 
 uniform float radius;
 uniform vec3 viewer;
@@ -26,61 +25,26 @@ const float multiplierAlpha = 0.1f;
 
 out vec4 vcolor;
 out vec3 fnormal;
-
-bool intsertRaySphere(vec3 o, vec3 d, vec3 c, float r, out float t, out vec3 intersect) {
-    vec3 m = o - center;
-
-    float A = length(d) * length(d);
-	float B = 2 * dot(d, m);
-	float C = length(m) * length(m) - r * r;
-
-	float discriminant = B * B - 4 * A * C;
-
-	bool hasIntersect = discriminant >= 0.00001f;
-
-	float t1;
-	float t2;
-	if (!hasIntersect) 
-		return hasIntersect;
-
-	t1 = (-B + sqrt(discriminant)) / (2.0f * A);
-	t2 = (-B - sqrt(discriminant)) / (2.0f * A);
-		
-	t = t1;
-
-	if (t1 < t2)
-		t = t2;
-
-	intersect = o + t * d;
-
-	return hasIntersect;
-
-}
+out vec3 fposition;
 
 void main() {
 	fnormal = vnormal;
-    float pvradius = length((pvposition + pvnormal * pvheight) - center);
-
-	float t;
-	float tp;
-	vec3 intersectionPoint;
-	vec3 planetIntersectionPoint;
+	fposition = (M * vec4(vposition, 1.0f)).xyz;
 
-	bool hasHit = intsertRaySphere(viewer, normalize(vposition - viewer), center, radius, t, intersectionPoint);
-	bool hasHitPlanet = intsertRaySphere(viewer, normalize(vposition - viewer), center, pvradius, tp, planetIntersectionPoint);
+	// Length of the view ray through the water, from the depth below the
+	// vertex and the angle the ray enters at
+	vec3 toViewer = normalize(viewer - vposition);
+	float cosine = max(dot(normalize(vnormal), toViewer), 0.2f);
+	float depth = vdepth / cosine;
 
 	vcolor = colB;
-	float depth;
-	if (hasHit && hasHitPlanet) {
-		depth = t - tp;
-		if (depth > 0.00001f) {
-			float opticalDepth = 1 - exp(-depth * multiplierDepth);
-			float alpha = 1 - exp(-depth *multiplierAlpha);
-			vec4 oceanColor = mix(colA, colB, opticalDepth);
-			vcolor = mix(colB, oceanColor, alpha);
-		}
+	if (depth > 0.00001f) {
+		float opticalDepth = 1 - exp(-depth * multiplierDepth);
+		float alpha = 1 - exp(-depth *multiplierAlpha);
+		vec4 oceanColor = mix(colA, colB, opticalDepth);
+		vcolor = mix(colB, oceanColor, alpha);
 	}
 
     gl_Position = P*V*M*vec4(vposition, 1.0f);
 
-}
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compares two terrain_bench result files.
+
+usage: bench_compare.py BASELINE.json CURRENT.json [--threshold 0.10]
+
+Benchmarks are matched by name and thread count. A benchmark whose ns/op
+grew by more than the threshold (a fraction, 0.10 = 10%) is a regression;
+the script exits with status 1 if there is any.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data.get("context", {}), {(b["name"], b["threads"]): b for b in data["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag terrain_bench regressions against a baseline")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative ns/op increase counted as a regression (default 0.10)")
+    args = parser.parse_args()
+
+    base_context, baseline = load(args.baseline)
+    context, current = load(args.current)
+
+    for key in ("optimized", "level", "skybox"):
+        if base_context.get(key) != context.get(key):
+            print("warning: %s differs (%s vs %s), results may not be comparable"
+                  % (key, base_context.get(key), context.get(key)))
+
+    regressions = 0
+    print("%-44s %14s %14s %9s" % ("benchmark", "baseline ns", "current ns", "change"))
+    for key in sorted(current):
+        name, threads = key
+        label = "%s [%dt]" % (name, threads)
+        if key not in baseline:
+            print("%-44s %14s %14.1f %9s" % (label, "-", current[key]["ns_per_op"], "new"))
+            continue
+
+        before = baseline[key]["ns_per_op"]
+        after = current[key]["ns_per_op"]
+        change = after / before - 1.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  improved"
+        print("%-44s %14.1f %14.1f %+8.1f%%%s" % (label, before, after, 100.0 * change, flag))
+
+    for key in sorted(set(baseline) - set(current)):
+        print("%-44s missing from current results" % ("%s [%dt]" % key))
+
+    if regressions:
+        print("%d regression(s) above %.0f%%" % (regressions, 100.0 * args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
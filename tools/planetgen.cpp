@@ -0,0 +1,494 @@
+// Batch planet generator: builds planets from seeds without a display or GL
+// context and writes their meshes (binary PLY or glTF), optionally their
+// skybox cube maps (png), height and normal rasters (tiled TIFF) and
+// compressed height maps.
+//
+// usage: planetgen [--count N] [--seed S] [--level L] [--radius R]
+//                  [--threads T] [--format ply|gltf] [--skybox SIZE] [--out DIR]
+//                  [--erosion DROPLETS] [--raster WIDTH] [--projection equirect|cube]
+//                  [--raster-format u16|f32] [--tile SIZE] [--pyramid ZOOM]
+//                  [--compress ERROR] [--compact] [--memory]
+//                  [--out-of-core] [--patch-level P]
+//
+// Planet i uses seed S + i. Every planet of a batch shares one icosphere, and
+// planets are generated in parallel. --erosion erodes each planet with that
+// many droplets per vertex.
+//
+// --raster evaluates the height function at every texel of WIDTH x WIDTH/2
+// equirectangular maps (or WIDTH^2 cube faces), independently of --level,
+// and streams them to PLANET_height.tif and PLANET_normal.tif tile by tile.
+// --pyramid writes equirectangular tiles of zoom 0 to ZOOM (at most 12) to
+// PLANET_tiles/{height,normal}/z/x/y.raw. Erosion does not show in rasters,
+// which sample the noise directly.
+//
+// --compress writes PLANET.hfz, the height map within ERROR of the mesh's
+// (see HeightfieldCodec), decodes it back, and reports its size against a
+// float height and normal per vertex and how fast it decodes.
+//
+// --compact drops the icosphere's UVs and each terrain's vertex graph once
+// they are generated (see Planet::compact()). --memory prints the bytes the
+// icosphere and the first planet hold, then the process' resident set.
+//
+// --out-of-core generates each planet into PLANET.blocks, a memory mapped
+// file of patches of the icosphere of level P (by default L - 8), and
+// streams the PLY from it, so the level is bound by disk rather than
+// memory (see OutOfCorePlanet). Only the height function is applied: it
+// does not go with --erosion, --compress, --compact or glTF. P may not
+// leave a patch fewer vertices than a memory page has bytes, whose
+// blocks would be mostly padding (see OutOfCorePlanet::maxPatchLevel()).
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <OpenGP/external/LodePNG/lodepng.cpp>
+
+#include "Icosphere.h"
+#include "Terrain.h"
+#include "SkyboxGenerator.h"
+#include "RasterExport.h"
+#include "HeightfieldCodec.h"
+#include "OutOfCorePlanet.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+struct Options {
+	int count = 1;
+	unsigned int seed = 0;
+	int level = 5;
+	float radius = 50.0f;
+	int threads = ThreadPool::defaultThreadCount();
+	std::string format = "ply";
+	int skybox = 0;
+	std::string out = ".";
+	float erosion = 0.0f;
+	int raster = 0;
+	std::string projection = "equirect";
+	std::string rasterFormat = "u16";
+	int tile = 256;
+	int pyramid = -1;
+	float compress = 0.0f;
+	bool compact = false;
+	bool memory = false;
+	bool outOfCore = false;
+	int patchLevel = -1;
+};
+
+// Writes values in little endian order, whatever the host is
+class LittleEndianWriter {
+private:
+	std::vector<unsigned char> bytes;
+public:
+	void u8(unsigned char v) { bytes.push_back(v); }
+	void u32(uint32_t v) {
+		for (int i = 0; i < 4; ++i) bytes.push_back((unsigned char)(v >> (8 * i)));
+	}
+	void f32(float v) {
+		uint32_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		u32(bits);
+	}
+	const std::vector<unsigned char>& data() const { return bytes; }
+	void clear() { bytes.clear(); }
+};
+
+bool writeFile(const std::string& path, const std::string& header, const std::vector<unsigned char>& body) {
+	std::ofstream file(path.c_str(), std::ios::binary);
+	file.write(header.data(), header.size());
+	if (!body.empty()) file.write((const char*)&body[0], body.size());
+	return (bool)file;
+}
+
+// Displaced positions of a generated terrain
+std::vector<Vec3> displacedVertices(const std::vector<Vec3>& vertices, const std::vector<Vec3>& vnormals, const Terrain& terrain) {
+	const std::vector<float>& heightMap = terrain.getHeightMap();
+	std::vector<Vec3> displaced(vertices.size());
+	for (int i = 0; i < vertices.size(); ++i) {
+		displaced[i] = vertices[i] + vnormals[i] * heightMap[i];
+	}
+	return displaced;
+}
+
+bool writePly(const std::string& path, const std::vector<Vec3>& positions, const std::vector<unsigned int>& indices, const Terrain& terrain) {
+	const std::vector<Vec3>& normals = terrain.getSurfaceNormals();
+	const std::vector<float>& heightMap = terrain.getHeightMap();
+
+	std::ostringstream header;
+	header << "ply\n"
+		<< "format binary_little_endian 1.0\n"
+		<< "comment seed " << terrain.getSeed() << "\n"
+		<< "element vertex " << positions.size() << "\n"
+		<< "property float x\nproperty float y\nproperty float z\n"
+		<< "property float nx\nproperty float ny\nproperty float nz\n"
+		<< "property float height\n"
+		<< "element face " << indices.size() / 3 << "\n"
+		<< "property list uchar int vertex_indices\n"
+		<< "end_header\n";
+
+	LittleEndianWriter body;
+	for (int i = 0; i < positions.size(); ++i) {
+		for (int c = 0; c < 3; ++c) body.f32(positions[i][c]);
+		for (int c = 0; c < 3; ++c) body.f32(normals[i][c]);
+		body.f32(heightMap[i]);
+	}
+	for (int i = 0; i < indices.size(); i += 3) {
+		body.u8(3);
+		for (int c = 0; c < 3; ++c) body.u32(indices[i + c]);
+	}
+
+	return writeFile(path, header.str(), body.data());
+}
+
+// A .gltf describing one indexed triangle mesh, with the buffer in a .bin
+// next to it
+bool writeGltf(const std::string& dir, const std::string& name, const std::vector<Vec3>& positions, const std::vector<unsigned int>& indices, const Terrain& terrain) {
+	const std::vector<Vec3>& normals = terrain.getSurfaceNormals();
+
+	Vec3 lo = positions[0];
+	Vec3 hi = positions[0];
+	LittleEndianWriter body;
+	for (int i = 0; i < positions.size(); ++i) {
+		lo = lo.cwiseMin(positions[i]);
+		hi = hi.cwiseMax(positions[i]);
+		for (int c = 0; c < 3; ++c) body.f32(positions[i][c]);
+	}
+	for (int i = 0; i < normals.size(); ++i) {
+		for (int c = 0; c < 3; ++c) body.f32(normals[i][c]);
+	}
+	for (int i = 0; i < indices.size(); ++i) body.u32(indices[i]);
+
+	size_t vertexBytes = 12 * positions.size();
+	size_t indexBytes = 4 * indices.size();
+
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\n"
+		<< "  \"asset\": { \"version\": \"2.0\", \"generator\": \"planetgen\" },\n"
+		<< "  \"scene\": 0,\n"
+		<< "  \"scenes\": [ { \"nodes\": [ 0 ] } ],\n"
+		<< "  \"nodes\": [ { \"mesh\": 0, \"name\": \"" << name << "\" } ],\n"
+		<< "  \"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, \"NORMAL\": 1 }, \"indices\": 2, \"mode\": 4 } ] } ],\n"
+		<< "  \"buffers\": [ { \"uri\": \"" << name << ".bin\", \"byteLength\": " << body.data().size() << " } ],\n"
+		<< "  \"bufferViews\": [\n"
+		<< "    { \"buffer\": 0, \"byteOffset\": 0, \"byteLength\": " << vertexBytes << ", \"target\": 34962 },\n"
+		<< "    { \"buffer\": 0, \"byteOffset\": " << vertexBytes << ", \"byteLength\": " << vertexBytes << ", \"target\": 34962 },\n"
+		<< "    { \"buffer\": 0, \"byteOffset\": " << 2 * vertexBytes << ", \"byteLength\": " << indexBytes << ", \"target\": 34963 }\n"
+		<< "  ],\n"
+		<< "  \"accessors\": [\n"
+		<< "    { \"bufferView\": 0, \"componentType\": 5126, \"count\": " << positions.size() << ", \"type\": \"VEC3\", "
+		<< "\"min\": [ " << lo[0] << ", " << lo[1] << ", " << lo[2] << " ], "
+		<< "\"max\": [ " << hi[0] << ", " << hi[1] << ", " << hi[2] << " ] },\n"
+		<< "    { \"bufferView\": 1, \"componentType\": 5126, \"count\": " << normals.size() << ", \"type\": \"VEC3\" },\n"
+		<< "    { \"bufferView\": 2, \"componentType\": 5125, \"count\": " << indices.size() << ", \"type\": \"SCALAR\" }\n"
+		<< "  ]\n"
+		<< "}\n";
+
+	return writeFile(dir + "/" + name + ".gltf", json.str(), std::vector<unsigned char>())
+		&& writeFile(dir + "/" + name + ".bin", "", body.data());
+}
+
+// Writes the faces of a skybox as pngs, top row first
+bool writeSkybox(const std::string& dir, const std::string& name, const SkyboxGenerator& sky) {
+	const char* faceNames[SKYBOX_FACES] = { "front", "back", "down", "up", "right", "left" };
+	unsigned int size = sky.getSize();
+
+	for (int face = 0; face < SKYBOX_FACES; ++face) {
+		std::vector<unsigned char> image = sky.getFaceData(face);
+		for (unsigned int i = 0; i < size / 2; ++i) {
+			std::swap_ranges(image.begin() + 4 * i * size, image.begin() + 4 * (i + 1) * size,
+				image.begin() + 4 * (size - 1 - i) * size);
+		}
+
+		std::string path = dir + "/" + name + "_" + faceNames[face] + ".png";
+		if (lodepng::encode(path, image, size, size)) return false;
+	}
+	return true;
+}
+
+// The rasters and the tile pyramid the options ask for, at base +
+// "_height.tif" and so on; true if there are none
+bool writeRasters(const Options& options, const Terrain& terrain, const std::string& base, ThreadPool& pool) {
+	if (options.raster <= 0 && options.pyramid < 0) return true;
+	RasterExportParams rasterParams;
+	rasterParams.format = options.rasterFormat == "u16" ? RASTER_UINT16 : RASTER_FLOAT32;
+	rasterParams.tileSize = options.tile;
+	RasterExporter exporter(terrain, rasterParams);
+	bool ok = true;
+	if (options.raster > 0) {
+		ok = options.projection == "cube"
+			? exporter.writeCube(options.raster, base + "_height", base + "_normal", pool)
+			: exporter.writeEquirect(options.raster, base + "_height.tif", base + "_normal.tif", pool);
+	}
+	if (ok && options.pyramid >= 0) {
+		ok = rasterMakeDirectory(base + "_tiles") && exporter.writePyramid(options.pyramid, base + "_tiles", true, true, pool);
+	}
+	return ok;
+}
+
+// The PLY of writePly() from the blocks of planet, streamed in chunks
+bool writeBlocksPly(const std::string& path, OutOfCorePlanet& planet) {
+	std::ofstream file(path.c_str(), std::ios::binary);
+	file << "ply\n"
+		<< "format binary_little_endian 1.0\n"
+		<< "comment seed " << planet.getSeed() << "\n"
+		<< "element vertex " << planet.getNumVertices() << "\n"
+		<< "property float x\nproperty float y\nproperty float z\n"
+		<< "property float nx\nproperty float ny\nproperty float nz\n"
+		<< "property float height\n"
+		<< "element face " << planet.getNumFaces() << "\n"
+		<< "property list uchar int vertex_indices\n"
+		<< "end_header\n";
+
+	const size_t CHUNK_BYTES = 1 << 20;
+	LittleEndianWriter chunk;
+	auto drain = [&](bool always) {
+		if (!always && chunk.data().size() < CHUNK_BYTES) return;
+		if (!chunk.data().empty()) file.write((const char*)&chunk.data()[0], chunk.data().size());
+		chunk.clear();
+	};
+
+	planet.forEachVertex([&](const Vec3& vertex, float height, const Vec3& normal) {
+		Vec3 position = vertex + vertex.normalized() * height;
+		for (int c = 0; c < 3; ++c) chunk.f32(position[c]);
+		for (int c = 0; c < 3; ++c) chunk.f32(normal[c]);
+		chunk.f32(height);
+		drain(false);
+	});
+	planet.forEachTriangle([&](long long a, long long b, long long c) {
+		chunk.u8(3);
+		chunk.u32((uint32_t)a);
+		chunk.u32((uint32_t)b);
+		chunk.u32((uint32_t)c);
+		drain(false);
+	});
+	drain(true);
+	// Closed if the block file could not be mapped again
+	return (bool)file && planet.isOpen();
+}
+
+// Planets one after the other, each generated over the whole pool into its
+// block file
+int generateOutOfCore(const Options& options) {
+	TRACE_THREAD_NAME("main");
+	auto begin = std::chrono::steady_clock::now();
+	ThreadPool pool(options.threads);
+	OutOfCorePlanet planet(options.radius, options.level, options.patchLevel);
+
+	double generating = 0.0;
+	size_t fileBytes = 0;
+	for (int i = 0; i < options.count; ++i) {
+		unsigned int seed = options.seed + (unsigned int)i;
+		std::string name = options.out + "/planet_" + std::to_string(seed);
+
+		auto generateBegin = std::chrono::steady_clock::now();
+		Terrain terrain(planet.getCoarseMesh(), seed);
+		bool ok = planet.generate(name + ".blocks", terrain, pool);
+		generating += std::chrono::duration<double>(std::chrono::steady_clock::now() - generateBegin).count();
+
+		ok = ok && writeBlocksPly(name + ".ply", planet);
+		if (ok && options.skybox > 0) {
+			SkyboxGenerator sky(options.skybox, seed);
+			sky.generateSkybox();
+			ok = writeSkybox(options.out, "planet_" + std::to_string(seed), sky);
+		}
+		ok = ok && writeRasters(options, terrain, name, pool);
+		if (!ok) {
+			std::cout << "planet_" << seed << " could not be written to " << options.out << std::endl;
+			return 1;
+		}
+
+		if (i == 0 && options.memory) {
+			MemoryReport memory;
+			planet.reportMemory(memory, "blocks");
+			memory.print(std::cout);
+		}
+		fileBytes = planet.getFileBytes();
+		planet.close();
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	TRACE_WRITE(options.out + "/planetgen_trace.json");
+	std::cout << options.count << " planets (level " << options.level << ", " << planet.getNumVertices() << " vertices, "
+		<< planet.getNumBlocks() << " blocks of " << planet.getBlockVertices() << ") out of core in " << seconds << " s; generated at "
+		<< options.count * planet.getNumVertices() / generating / 1e6 << " Mvertices/s on " << pool.getThreadCount() + 1 << " thread(s)" << std::endl;
+	std::cout << "block file: " << fileBytes / 1e6 << " MB; process resident " << MemoryReport::residentBytes() / 1e6
+		<< " MB, peak " << MemoryReport::peakResidentBytes() / 1e6 << " MB" << std::endl;
+	return 0;
+}
+
+bool parseArguments(int argc, char** argv, Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--compact") options.compact = true;
+		else if (arg == "--memory") options.memory = true;
+		else if (arg == "--out-of-core") options.outOfCore = true;
+		if (arg == "--compact" || arg == "--memory" || arg == "--out-of-core") continue;
+		if (i + 1 >= argc) return false;
+		std::string value = argv[++i];
+
+		if (arg == "--count") options.count = atoi(value.c_str());
+		else if (arg == "--seed") options.seed = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+		else if (arg == "--level") options.level = atoi(value.c_str());
+		else if (arg == "--radius") options.radius = (float)atof(value.c_str());
+		else if (arg == "--threads") options.threads = atoi(value.c_str());
+		else if (arg == "--format") options.format = value;
+		else if (arg == "--skybox") options.skybox = atoi(value.c_str());
+		else if (arg == "--out") options.out = value;
+		else if (arg == "--erosion") options.erosion = (float)atof(value.c_str());
+		else if (arg == "--raster") options.raster = atoi(value.c_str());
+		else if (arg == "--projection") options.projection = value;
+		else if (arg == "--raster-format") options.rasterFormat = value;
+		else if (arg == "--tile") options.tile = atoi(value.c_str());
+		else if (arg == "--pyramid") options.pyramid = atoi(value.c_str());
+		else if (arg == "--compress") options.compress = (float)atof(value.c_str());
+		else if (arg == "--patch-level") options.patchLevel = atoi(value.c_str());
+		else return false;
+	}
+	// TIFF tiles are multiples of 16 texels
+	return options.count > 0 && options.level >= 0 && options.threads >= 0
+		&& (options.format == "ply" || options.format == "gltf")
+		&& options.raster >= 0 && (options.projection == "equirect" || options.projection == "cube")
+		&& (options.rasterFormat == "u16" || options.rasterFormat == "f32")
+		&& options.tile >= 16 && options.tile % 16 == 0 && options.pyramid <= RasterExporter::MAX_PYRAMID_ZOOM
+		&& options.compress >= 0 && options.patchLevel <= OutOfCorePlanet::maxPatchLevel(options.level)
+		&& (!options.outOfCore || (options.format == "ply" && options.erosion == 0 && options.compress == 0 && !options.compact));
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseArguments(argc, argv, options)) {
+		std::cout << "usage: planetgen [--count N] [--seed S] [--level L] [--radius R]" << std::endl
+			<< "                 [--threads T] [--format ply|gltf] [--skybox SIZE] [--out DIR]" << std::endl
+			<< "                 [--erosion DROPLETS] [--raster WIDTH] [--projection equirect|cube]" << std::endl
+			<< "                 [--raster-format u16|f32] [--tile SIZE] [--pyramid ZOOM]" << std::endl
+			<< "                 [--compress ERROR] [--compact] [--memory]" << std::endl
+			<< "                 [--out-of-core] [--patch-level P]" << std::endl;
+		return 1;
+	}
+	if (options.outOfCore) return generateOutOfCore(options);
+
+	TRACE_THREAD_NAME("main");
+	auto begin = std::chrono::steady_clock::now();
+
+	Arena meshArena;
+	Icosphere icosphere(Vec3(0, 0, 0), options.radius, options.level, &meshArena);
+	if (options.compact) icosphere.compact();
+	const std::vector<Vec3>& vertices = icosphere.getVertices();
+	const std::vector<Vec3> vnormals = icosphere.getVertexNormals();
+	const std::vector<unsigned int> indices = icosphere.genMesh();
+
+	ThreadPool pool(options.threads);
+	std::vector<char> failed(options.count, 0);
+	std::vector<ArenaStats> scratch(options.count);
+	// Of the first planet, once written
+	MemoryReport memory;
+
+	std::unique_ptr<HeightfieldCodec> codec;
+	if (options.compress > 0) codec = std::unique_ptr<HeightfieldCodec>(new HeightfieldCodec(&icosphere));
+	// Per planet: compressed bytes, decode seconds, largest height error
+	std::vector<size_t> compressedBytes(options.count, 0);
+	std::vector<double> decodeSeconds(options.count, 0.0);
+	std::vector<float> maxErrors(options.count, 0.0f);
+
+	pool.parallelFor(0, options.count, 1, [&](int i) {
+		unsigned int seed = options.seed + (unsigned int)i;
+		std::string name = "planet_" + std::to_string(seed);
+
+		TRACE_SCOPE_ARG("planet", "seed", seed);
+		Terrain terrain(&icosphere, seed);
+		Arena arena;
+		terrain.setArena(&arena);
+		TerrainStages stages;
+		stages.erosion = options.erosion > 0;
+		stages.erosionParams.droplets = options.erosion;
+		stages.erosionParams.seed = seed;
+		terrain.generate(stages, pool);
+		scratch[i] = arena.getStats();
+		if (options.compact) terrain.compact();
+
+		TRACE_SCOPE_ARG("write planet", "seed", seed);
+		std::vector<Vec3> positions = displacedVertices(vertices, vnormals, terrain);
+		bool ok = options.format == "ply"
+			? writePly(options.out + "/" + name + ".ply", positions, indices, terrain)
+			: writeGltf(options.out, name, positions, indices, terrain);
+
+		if (ok && options.skybox > 0) {
+			SkyboxGenerator sky(options.skybox, seed);
+			sky.generateSkybox();
+			ok = writeSkybox(options.out, name, sky);
+		}
+
+		ok = ok && writeRasters(options, terrain, options.out + "/" + name, pool);
+
+		if (ok && codec) {
+			std::vector<unsigned char> data = codec->encode(terrain.getHeightMap(), options.compress, pool);
+			ok = !data.empty() && writeFile(options.out + "/" + name + ".hfz", "", data);
+
+			auto decodeBegin = std::chrono::steady_clock::now();
+			std::vector<float> decoded;
+			ok = ok && codec->decode(data, decoded, pool);
+			decodeSeconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - decodeBegin).count();
+			compressedBytes[i] = data.size();
+			for (int v = 0; ok && v < decoded.size(); ++v) {
+				maxErrors[i] = std::max(maxErrors[i], std::abs(decoded[v] - terrain.getHeightMap()[v]));
+			}
+		}
+
+		if (i == 0 && options.memory) terrain.reportMemory(memory, name);
+		failed[i] = !ok;
+	});
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	TRACE_WRITE(options.out + "/planetgen_trace.json");
+
+	int numFailed = (int)std::count(failed.begin(), failed.end(), 1);
+	if (numFailed > 0) {
+		std::cout << numFailed << " planet(s) could not be written to " << options.out << std::endl;
+		return 1;
+	}
+
+	std::cout << options.count << " planets (level " << options.level << ", " << vertices.size() << " vertices) in "
+		<< seconds << " s: " << options.count / seconds << " planets/s on " << pool.getThreadCount() + 1 << " thread(s)" << std::endl;
+
+	long long allocations = 0, peak = 0;
+	for (int i = 0; i < options.count; ++i) {
+		allocations += scratch[i].allocations;
+		peak = std::max(peak, scratch[i].peakBytes);
+	}
+	const ArenaStats& meshScratch = meshArena.getStats();
+	std::cout << "scratch: icosphere " << meshScratch.allocations << " allocations, " << meshScratch.peakBytes / 1e6
+		<< " MB peak; planets " << allocations / options.count << " allocations, " << peak / 1e6 << " MB peak each" << std::endl;
+
+	if (options.memory) {
+		icosphere.reportMemory(memory, "icosphere");
+		memory.add("icosphere/indices", vectorBytes(indices) + vectorBytes(vnormals));
+		memory.print(std::cout);
+	}
+
+	if (codec) {
+		size_t compressed = 0;
+		double decoding = 0.0;
+		for (int i = 0; i < options.count; ++i) {
+			compressed += compressedBytes[i];
+			decoding += decodeSeconds[i];
+		}
+		// Against a float height and a float normal per vertex, what the
+		// terrain keeps and the PLY stores besides the positions
+		double raw = (double)options.count * vertices.size() * (sizeof(float) + sizeof(Vec3));
+		std::cout << "compressed heights: " << compressed / (double)options.count << " bytes/planet, "
+			<< raw / compressed << "x smaller than heights and normals, largest error "
+			<< *std::max_element(maxErrors.begin(), maxErrors.end()) << " (bound " << options.compress << "), decoded at "
+			<< options.count * vertices.size() / decoding / 1e6 << " Mvertices/s" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,363 @@
+// Microbenchmarks of the generation code: noise evaluation, icosphere
+// subdivision, height map (with and without the octave cache), erosion,
+// surface normals, surface queries, ray casting, scattering, height map
+// compression, ocean steps and skybox faces. Runs headless and writes its
+// results as JSON; compare two result files with tools/bench_compare.py.
+//
+// usage: terrain_bench [--filter TEXT] [--out FILE] [--min-time SECONDS]
+//                      [--repetitions N] [--threads N] [--level L] [--skybox SIZE]
+//
+// Every benchmark reports the median over its repetitions. Benchmarks marked
+// as scaling are also run on 2, 4, ... threads and on --threads threads.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "PerlinNoise.h"
+#include "Icosphere.h"
+#include "Terrain.h"
+#include "SkyboxGenerator.h"
+#include "Ocean.h"
+#include "HeightfieldCodec.h"
+#include "ThreadPool.h"
+
+struct Options {
+	std::string filter;
+	std::string out = "terrain_bench.json";
+	double minTime = 0.5;
+	int repetitions = 5;
+	int threads = ThreadPool::defaultThreadCount() + 1;
+	int level = 5;
+	int skybox = 256;
+};
+
+struct BenchResult {
+	std::string name;
+	int threads;
+	long long iterations;
+	// Work items (points, vertices, texels...) processed by one operation
+	long long items;
+	double nsPerOp;
+	double itemsPerSecond;
+	double speedup;
+};
+
+// Runs op until a repetition takes at least minTime / repetitions, then
+// times the repetitions with that iteration count
+BenchResult measure(const std::string& name, int threads, long long items, const Options& options, const std::function<void()>& op) {
+	typedef std::chrono::steady_clock Clock;
+	double target = options.minTime / options.repetitions;
+
+	op();
+
+	long long iterations = 1;
+	while (true) {
+		Clock::time_point begin = Clock::now();
+		for (long long i = 0; i < iterations; ++i) op();
+		double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+		if (seconds >= target) break;
+		iterations = seconds > 0 ? std::max(iterations + 1, (long long)(iterations * 1.2 * target / seconds)) : iterations * 10;
+	}
+
+	std::vector<double> samples;
+	for (int r = 0; r < options.repetitions; ++r) {
+		Clock::time_point begin = Clock::now();
+		for (long long i = 0; i < iterations; ++i) op();
+		samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / iterations);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	BenchResult result;
+	result.name = name;
+	result.threads = threads;
+	result.iterations = iterations;
+	result.items = items;
+	result.nsPerOp = samples[samples.size() / 2];
+	result.itemsPerSecond = items * 1.0e9 / result.nsPerOp;
+	result.speedup = 1.0;
+	return result;
+}
+
+class BenchSuite {
+private:
+	Options options;
+	std::vector<BenchResult> results;
+
+	bool selected(const std::string& name) const {
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	}
+
+	void report(const BenchResult& result) {
+		std::cout << std::left << std::setw(40) << result.name
+			<< std::right << std::setw(4) << result.threads << "t"
+			<< std::fixed << std::setprecision(1) << std::setw(16) << result.nsPerOp << " ns/op"
+			<< std::setprecision(0) << std::setw(16) << result.itemsPerSecond << " items/s";
+		if (result.threads > 1) std::cout << std::setprecision(2) << std::setw(8) << result.speedup << "x";
+		std::cout << std::endl;
+		results.push_back(result);
+	}
+
+public:
+	BenchSuite(const Options& options) : options(options) {}
+
+	void run(const std::string& name, long long items, const std::function<void()>& op) {
+		if (!selected(name)) return;
+		report(measure(name, 1, items, options, op));
+	}
+
+	// op(pool) splits its work over the pool; runs with 1, 2, 4... threads
+	void runScaling(const std::string& name, long long items, const std::function<void(ThreadPool&)>& op) {
+		if (!selected(name)) return;
+
+		double single = 0;
+		for (int threads = 1; threads <= options.threads; threads = (threads * 2 > options.threads && threads < options.threads) ? options.threads : threads * 2) {
+			// The thread calling parallelFor takes part, so the pool has one less
+			ThreadPool pool(threads - 1);
+			BenchResult result = measure(name, threads, items, options, [&op, &pool]() { op(pool); });
+			if (threads == 1) single = result.nsPerOp;
+			result.speedup = single / result.nsPerOp;
+			report(result);
+		}
+	}
+
+	bool writeJSON(const std::string& path) const {
+		std::ofstream file(path.c_str());
+		file << "{\n  \"context\": { \"optimized\": "
+#ifdef NDEBUG
+			<< "true"
+#else
+			<< "false"
+#endif
+			<< ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+			<< ", \"level\": " << options.level << ", \"skybox\": " << options.skybox << " },\n";
+		file << "  \"benchmarks\": [\n";
+		file.precision(6);
+		for (int i = 0; i < results.size(); ++i) {
+			const BenchResult& r = results[i];
+			file << "    { \"name\": \"" << r.name << "\", \"threads\": " << r.threads
+				<< ", \"iterations\": " << r.iterations << ", \"items\": " << r.items
+				<< ", \"ns_per_op\": " << r.nsPerOp << ", \"items_per_second\": " << r.itemsPerSecond
+				<< ", \"speedup\": " << r.speedup << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		file << "  ]\n}\n";
+		return (bool)file;
+	}
+};
+
+// Sample points spread like the vertices of a planet of radius 50 are after
+// the division by the height map period
+std::vector<Vec3> samplePoints(int count) {
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> coordinate(-2.5f, 2.5f);
+	std::vector<Vec3> points(count);
+	for (int i = 0; i < count; ++i) {
+		points[i] = Vec3(coordinate(generator), coordinate(generator), coordinate(generator));
+	}
+	return points;
+}
+
+// A size x size grid of rays from a camera looking at a planet of radius 50
+// at the origin, in scanline order
+std::vector<Ray> cameraRays(int size) {
+	Vec3 eye(-68.8f, 97.1f, -15.9f);
+	std::vector<Ray> rays(size * size);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			Vec3 target((2.0f * x / size - 1) * 50, (2.0f * y / size - 1) * 50, 0);
+			rays[y * size + x].origin = eye;
+			rays[y * size + x].direction = (target - eye).normalized();
+		}
+	}
+	return rays;
+}
+
+bool parseArguments(int argc, char** argv, Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) return false;
+		std::string value = argv[++i];
+
+		if (arg == "--filter") options.filter = value;
+		else if (arg == "--out") options.out = value;
+		else if (arg == "--min-time") options.minTime = atof(value.c_str());
+		else if (arg == "--repetitions") options.repetitions = atoi(value.c_str());
+		else if (arg == "--threads") options.threads = atoi(value.c_str());
+		else if (arg == "--level") options.level = atoi(value.c_str());
+		else if (arg == "--skybox") options.skybox = atoi(value.c_str());
+		else return false;
+	}
+	return options.minTime > 0 && options.repetitions > 0 && options.threads > 0
+		&& options.level >= 0 && options.skybox > 0;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseArguments(argc, argv, options)) {
+		std::cout << "usage: terrain_bench [--filter TEXT] [--out FILE] [--min-time SECONDS]" << std::endl
+			<< "                     [--repetitions N] [--threads N] [--level L] [--skybox SIZE]" << std::endl;
+		return 1;
+	}
+
+#ifndef NDEBUG
+	std::cout << "warning: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release" << std::endl;
+#endif
+
+	BenchSuite suite(options);
+
+	// Noise with the parameters of the planet height map
+	PerlinNoise noise = PerlinNoise(2048, 2048, 8, 2, 0.9, 0.0, 512, 2021);
+	const int numPoints = 4096;
+	std::vector<Vec3> points = samplePoints(numPoints);
+	volatile float sink = 0;
+
+	suite.run("noise/eval", numPoints, [&]() {
+		float sum = 0;
+		for (int i = 0; i < numPoints; ++i) sum += noise.eval(points[i]);
+		sink = sum;
+	});
+	suite.runScaling("noise/fBm", numPoints, [&](ThreadPool& pool) {
+		std::vector<float> values(numPoints);
+		pool.parallelFor(0, numPoints, 256, [&](int i) { values[i] = noise.fBm(points[i]); });
+		sink = values[0];
+	});
+	suite.runScaling("noise/hybridMultifractal", numPoints, [&](ThreadPool& pool) {
+		std::vector<float> values(numPoints);
+		pool.parallelFor(0, numPoints, 256, [&](int i) { values[i] = noise.hybridMultifractal(points[i]); });
+		sink = values[0];
+	});
+
+	PerlinNoise noise2D = PerlinNoise(256, 256, 8, 2, 0.9, 0.0, 64, 2021);
+	suite.run("noise/perlin2D_256", 256 * 256, [&]() {
+		float* values = noise2D.perlin2D(0);
+		sink = values[0];
+		delete[] values;
+	});
+
+	for (int level = 0; level <= 8; ++level) {
+		long long vertices = 10LL * (1LL << (2 * level)) + 2;
+		suite.run("icosphere/level_" + std::to_string(level), vertices, [level]() {
+			Icosphere icosphere(Vec3(0, 0, 0), 50.0f, level);
+		});
+	}
+
+	Icosphere icosphere(Vec3(0, 0, 0), 50.0f, options.level);
+	long long numVertices = (long long)icosphere.getVertices().size();
+	std::string levelSuffix = "_level_" + std::to_string(options.level);
+
+	Terrain terrain(&icosphere, 2021);
+	suite.run("terrain/calcHeightMap" + levelSuffix, numVertices, [&]() { terrain.calcHeightMap(); });
+
+	// A tuning edit of H: every octave comes from the cache
+	OctaveCache octaveCache;
+	Terrain cached(&icosphere, 2021);
+	cached.setOctaveCache(&octaveCache);
+	cached.calcHeightMap();
+	TerrainParams edited = cached.getParams();
+	suite.run("terrain/calcHeightMap_cached_H" + levelSuffix, numVertices, [&]() {
+		edited.H = edited.H == 0.9f ? 0.85f : 0.9f;
+		cached.setParams(edited);
+		cached.calcHeightMap();
+	});
+
+	terrain.calcHeightMap();
+	suite.run("terrain/calcSurfaceNormals" + levelSuffix, numVertices, [&]() { terrain.calcSurfaceNormals(); });
+
+	// Surface queries at random directions, as collisions and object
+	// placement make them
+	terrain.calcSurfaceNormals();
+	std::vector<TerrainSample> samples;
+	suite.runScaling("terrain/sample" + levelSuffix, numPoints, [&](ThreadPool& pool) {
+		terrain.sample(points, samples, pool);
+		sink = samples[0].height;
+	});
+
+	suite.runScaling("bvh/build" + levelSuffix, numVertices, [&](ThreadPool& pool) { terrain.buildBVH(pool); });
+
+	// Closest hits of camera rays, traversed in packets
+	ThreadPool inlinePool(0);
+	terrain.buildBVH(inlinePool);
+	std::vector<Ray> rays = cameraRays(256);
+	std::vector<RayHit> hits;
+	suite.runScaling("bvh/raycast" + levelSuffix, rays.size(), [&](ThreadPool& pool) {
+		terrain.raycast(rays, hits, pool);
+		sink = hits[0].distance;
+	});
+
+	// One droplet per vertex plus the default thermal iterations
+	Terrain uneroded(&icosphere, 2021);
+	uneroded.calcHeightMap();
+	suite.runScaling("terrain/erode" + levelSuffix, numVertices, [&](ThreadPool& pool) {
+		Terrain eroded = uneroded;
+		eroded.erode(ErosionParams(), pool);
+	});
+
+	// Instances one unit apart everywhere on land
+	ScatterLayer layer;
+	layer.spacing = 1.0f;
+	layer.materials = MATERIAL_GRASS | MATERIAL_ROCK | MATERIAL_SNOW;
+	layer.minSlope = 0.0f;
+	Scatter scatter;
+	suite.runScaling("scatter/place" + levelSuffix, numVertices, [&](ThreadPool& pool) {
+		scatter.place(terrain, layer, 2, pool);
+		sink = (float)scatter.getInstances().size();
+	});
+
+	// Heights to within 1e-3, as planetgen --compress 0.001 writes them
+	HeightfieldCodec codec(&icosphere);
+	std::vector<unsigned char> compressed = codec.encode(terrain.getHeightMap(), 1e-3f, inlinePool);
+	suite.runScaling("heightfield/encode" + levelSuffix, numVertices, [&](ThreadPool& pool) {
+		compressed = codec.encode(terrain.getHeightMap(), 1e-3f, pool);
+	});
+	std::vector<float> decoded;
+	suite.runScaling("heightfield/decode" + levelSuffix, numVertices, [&](ThreadPool& pool) {
+		codec.decode(compressed, decoded, pool);
+	});
+
+	// Independent planets sharing one icosphere, as planetgen generates them
+	const int numPlanets = 8;
+	suite.runScaling("terrain/generate_8_planets" + levelSuffix, numPlanets * numVertices, [&](ThreadPool& pool) {
+		pool.parallelFor(0, numPlanets, 1, [&](int i) {
+			Terrain planet(&icosphere, 2021 + i);
+			planet.generate();
+		});
+	});
+
+	// One FFT ocean step per grid size, as the simulator runs it every
+	// 1/30 s; time advances so the spectrum is evolved each time
+	for (int size = 128; size <= 512; size *= 2) {
+		OceanParams oceanParams;
+		oceanParams.size = size;
+		Ocean ocean(oceanParams);
+		OceanField field;
+		float time = 0;
+		suite.runScaling("ocean/step_" + std::to_string(size), (long long)size * size, [&](ThreadPool& pool) {
+			ocean.simulate(time += 1.0f / 30.0f, field, pool);
+			sink = field.texels[0];
+		});
+	}
+
+	SkyboxGenerator sky(options.skybox, 2021);
+	std::string skySuffix = "_" + std::to_string(options.skybox);
+	suite.run("skybox/face" + skySuffix, (long long)options.skybox * options.skybox, [&]() { sky.generateFace(SKYBOX_FRONT); });
+	suite.runScaling("skybox/all_faces" + skySuffix, 6LL * options.skybox * options.skybox, [&](ThreadPool& pool) {
+		pool.parallelFor(0, SKYBOX_FACES, 1, [&](int face) { sky.generateFace(face); });
+	});
+
+	if (!suite.writeJSON(options.out)) {
+		std::cout << "failed to write " << options.out << std::endl;
+		return 1;
+	}
+	std::cout << "results written to " << options.out << std::endl;
+	return 0;
+}
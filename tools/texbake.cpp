@@ -0,0 +1,223 @@
+// Offline texture baker: converts png textures into a single texture pack
+// (see src/TexturePack.h) holding every mip level, already flipped for
+// OpenGL and optionally BC1 (DXT1) compressed.
+//
+// usage: texbake [--bc1] -o <out.pack> <in.png>...
+
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <OpenGP/external/LodePNG/lodepng.cpp>
+
+#include "TexturePack.h"
+
+struct MipLevel {
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> pixels;
+};
+
+// Flips the rows of an RGBA image so the first row is the bottom one
+void flipRows(std::vector<unsigned char>& image, unsigned int width, unsigned int height) {
+	std::vector<unsigned char> row(4 * width);
+	for (unsigned int i = 0; i < height / 2; ++i) {
+		unsigned char* top = &image[4 * i * width];
+		unsigned char* bottom = &image[4 * (height - 1 - i) * width];
+		memcpy(&row[0], top, 4 * width);
+		memcpy(top, bottom, 4 * width);
+		memcpy(bottom, &row[0], 4 * width);
+	}
+}
+
+// Box filters a level down to the next one, clamping at odd edges
+MipLevel downsample(const MipLevel& src) {
+	MipLevel dst;
+	dst.width = std::max(1u, src.width / 2);
+	dst.height = std::max(1u, src.height / 2);
+	dst.pixels.resize(4 * dst.width * dst.height);
+
+	for (unsigned int y = 0; y < dst.height; ++y) {
+		unsigned int y0 = std::min(2 * y, src.height - 1);
+		unsigned int y1 = std::min(2 * y + 1, src.height - 1);
+		for (unsigned int x = 0; x < dst.width; ++x) {
+			unsigned int x0 = std::min(2 * x, src.width - 1);
+			unsigned int x1 = std::min(2 * x + 1, src.width - 1);
+			for (int c = 0; c < 4; ++c) {
+				unsigned int sum = src.pixels[4 * (x0 + y0 * src.width) + c]
+					+ src.pixels[4 * (x1 + y0 * src.width) + c]
+					+ src.pixels[4 * (x0 + y1 * src.width) + c]
+					+ src.pixels[4 * (x1 + y1 * src.width) + c];
+				dst.pixels[4 * (x + y * dst.width) + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+
+	return dst;
+}
+
+unsigned short packRGB565(const int* c) {
+	return (unsigned short)(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+}
+
+void unpackRGB565(unsigned short p, int* c) {
+	c[0] = ((p >> 11) & 31) * 255 / 31;
+	c[1] = ((p >> 5) & 63) * 255 / 63;
+	c[2] = (p & 31) * 255 / 31;
+}
+
+// Encodes one 4x4 block using the bounding box of its colors as endpoints
+void encodeBC1Block(const int block[16][3], unsigned char* out) {
+	int lo[3] = { 255, 255, 255 };
+	int hi[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			lo[c] = std::min(lo[c], block[i][c]);
+			hi[c] = std::max(hi[c], block[i][c]);
+		}
+	}
+
+	unsigned short c0 = packRGB565(hi);
+	unsigned short c1 = packRGB565(lo);
+	if (c0 < c1) std::swap(c0, c1);
+
+	int palette[4][3];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	unsigned int indices = 0;
+	if (c0 != c1) {
+		for (int i = 0; i < 16; ++i) {
+			int best = 0;
+			int bestDist = 1 << 30;
+			for (int p = 0; p < 4; ++p) {
+				int dr = block[i][0] - palette[p][0];
+				int dg = block[i][1] - palette[p][1];
+				int db = block[i][2] - palette[p][2];
+				int dist = dr * dr + dg * dg + db * db;
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (2 * i);
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	out[4] = indices & 0xff;
+	out[5] = (indices >> 8) & 0xff;
+	out[6] = (indices >> 16) & 0xff;
+	out[7] = (indices >> 24) & 0xff;
+}
+
+std::vector<unsigned char> encodeBC1(const MipLevel& level) {
+	unsigned int blocksX = (level.width + 3) / 4;
+	unsigned int blocksY = (level.height + 3) / 4;
+	std::vector<unsigned char> out(8 * blocksX * blocksY);
+
+	for (unsigned int by = 0; by < blocksY; ++by) {
+		for (unsigned int bx = 0; bx < blocksX; ++bx) {
+			int block[16][3];
+			for (int i = 0; i < 16; ++i) {
+				unsigned int x = std::min(4 * bx + i % 4, level.width - 1);
+				unsigned int y = std::min(4 * by + i / 4, level.height - 1);
+				for (int c = 0; c < 3; ++c) {
+					block[i][c] = level.pixels[4 * (x + y * level.width) + c];
+				}
+			}
+			encodeBC1Block(block, &out[8 * (bx + by * blocksX)]);
+		}
+	}
+
+	return out;
+}
+
+std::string baseName(const std::string& path) {
+	size_t pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+int main(int argc, char** argv) {
+	bool bc1 = false;
+	std::string output;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--bc1") bc1 = true;
+		else if (arg == "-o" && i + 1 < argc) output = argv[++i];
+		else inputs.push_back(arg);
+	}
+
+	if (output.empty() || inputs.empty()) {
+		std::cout << "usage: texbake [--bc1] -o <out.pack> <in.png>..." << std::endl;
+		return 1;
+	}
+
+	std::vector<TexturePackEntry> entries(inputs.size());
+	std::vector<std::vector<unsigned char> > blobs;
+	uint64_t offset = sizeof(TexturePackHeader) + entries.size() * sizeof(TexturePackEntry);
+
+	for (size_t t = 0; t < inputs.size(); ++t) {
+		MipLevel level;
+		unsigned error = lodepng::decode(level.pixels, level.width, level.height, inputs[t]);
+		if (error) {
+			std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << " (" << inputs[t] << ")" << std::endl;
+			return 1;
+		}
+		flipRows(level.pixels, level.width, level.height);
+
+		TexturePackEntry& entry = entries[t];
+		memset(&entry, 0, sizeof(entry));
+		strncpy(entry.name, baseName(inputs[t]).c_str(), TEXTUREPACK_NAME_SIZE - 1);
+		entry.width = level.width;
+		entry.height = level.height;
+		entry.format = bc1 ? TEXTUREPACK_BC1 : TEXTUREPACK_RGBA8;
+
+		// Full chain down to 1x1, as glGenerateMipmap would produce
+		while (true) {
+			blobs.push_back(bc1 ? encodeBC1(level) : level.pixels);
+			entry.levelOffset[entry.levels] = offset;
+			entry.levelSize[entry.levels] = (uint32_t)blobs.back().size();
+			offset += blobs.back().size();
+			entry.levels++;
+
+			if ((level.width == 1 && level.height == 1) || entry.levels == TEXTUREPACK_MAX_LEVELS) break;
+			level = downsample(level);
+		}
+
+		std::cout << entry.name << ": " << entry.width << "x" << entry.height << ", " << entry.levels << " levels" << std::endl;
+	}
+
+	TexturePackHeader header;
+	header.magic = TEXTUREPACK_MAGIC;
+	header.version = TEXTUREPACK_VERSION;
+	header.count = (uint32_t)entries.size();
+	header.reserved = 0;
+
+	std::ofstream file(output.c_str(), std::ios::binary);
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&entries[0], entries.size() * sizeof(TexturePackEntry));
+	for (size_t i = 0; i < blobs.size(); ++i) {
+		file.write((const char*)&blobs[i][0], blobs[i].size());
+	}
+
+	if (!file) {
+		std::cout << "failed to write " << output << std::endl;
+		return 1;
+	}
+
+	return 0;
+}